@@ -1,4 +1,7 @@
 #include <Actors/Actor.h>
+#include <Resources/Resource.h>
+#include <Core/Util/ThreadPool.h>
+#include <thread>
 #include "CppUnitTest.h"
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 using namespace Bel;
@@ -12,7 +15,117 @@ public:
     }
 
     virtual ~TestComponent() {}
+    virtual bool Initialize(tinyxml2::XMLElement* pData) override { ++s_numInitializes; return true; }
+
+    virtual bool Initialize(const Bel::ActorDefinition::Element* pData) override
+    {
+        ++s_numInitializes;
+        auto pElement = pData->FirstChildElement("Speed");
+        if (pElement != nullptr)
+        {
+            m_speed = pElement->FloatAttribute("value");
+        }
+        return true;
+    }
+    virtual void Update(float delta) override { ++m_numUpdates; }
+
+    virtual std::unique_ptr<Bel::IActorComponent> Clone(Bel::Actor* pOwner) const override
+    {
+        auto pClone = std::make_unique<TestComponent>(*this);
+        pClone->SetOwner(pOwner);
+        return pClone;
+    }
+
+    int m_numUpdates = 0;
+    float m_speed = 0;
+    static inline int s_numInitializes = 0;
+};
+
+// Only initializes from XML and can't be cloned, like most game components.
+class XmlOnlyComponent : public Bel::IActorComponent
+{
+public:
+    XmlOnlyComponent(Bel::Actor* pOwner, const char* pName)
+        : Bel::IActorComponent(pOwner, pName)
+    {
+    }
+
+    virtual bool Initialize(tinyxml2::XMLElement* pData) override
+    {
+        m_health = pData->IntAttribute("health");
+        return true;
+    }
+
+    int m_health = 0;
+};
+
+// Looks at its owner while initializing, like components that cache their siblings.
+class SiblingComponent : public Bel::IActorComponent
+{
+public:
+    SiblingComponent(Bel::Actor* pOwner, const char* pName)
+        : Bel::IActorComponent(pOwner, pName)
+    {
+    }
+
+    virtual bool Initialize(tinyxml2::XMLElement* pData) override
+    {
+        m_sawSibling = GetOwner()->HasComponent(IActorComponent::HashName("TestComponent"));
+        return true;
+    }
+
+    virtual std::unique_ptr<Bel::IActorComponent> Clone(Bel::Actor* pOwner) const override
+    {
+        auto pClone = std::make_unique<SiblingComponent>(*this);
+        pClone->SetOwner(pOwner);
+        return pClone;
+    }
+
+    bool m_sawSibling = false;
+};
+
+// Updates its own actor only, every tenth one also reports itself through a deferred action.
+class ParallelTestComponent : public Bel::IActorComponent
+{
+public:
+    ParallelTestComponent(Bel::Actor* pOwner, std::vector<Bel::Actor::Id>* pReported)
+        : Bel::IActorComponent(pOwner, "ParallelTestComponent")
+        , m_pReported(pReported)
+    {
+    }
+
+    virtual bool Initialize(tinyxml2::XMLElement* pData) override { return true; }
+    virtual Access GetAccess() const override { return Access::kOwnActor; }
+
+    virtual void Update(float delta) override
+    {
+        ++m_numUpdates;
+        const Bel::Actor::Id kId = GetOwner()->GetId();
+        if (kId % 10 == 0)
+        {
+            Bel::ComponentPools::Defer([this, kId]() { m_pReported->push_back(kId); });
+        }
+    }
+
+    int m_numUpdates = 0;
+    std::vector<Bel::Actor::Id>* m_pReported;
+};
+
+// Lets go of its resource in a parallel update.
+class ReleasingTestComponent : public Bel::IActorComponent
+{
+public:
+    ReleasingTestComponent(Bel::Actor* pOwner, std::shared_ptr<Bel::ResourceHandle> pHandle)
+        : Bel::IActorComponent(pOwner, "ReleasingTestComponent")
+        , m_pHandle(std::move(pHandle))
+    {
+    }
+
     virtual bool Initialize(tinyxml2::XMLElement* pData) override { return true; }
+    virtual Access GetAccess() const override { return Access::kOwnActor; }
+    virtual void Update(float delta) override { Bel::ComponentPools::DeferRelease(std::move(m_pHandle)); }
+
+    std::shared_ptr<Bel::ResourceHandle> m_pHandle;
 };
 
 static std::unique_ptr<Bel::IActorComponent> CreateTestComponent(Bel::Actor* pOwner, const char* pName)
@@ -20,6 +133,27 @@ static std::unique_ptr<Bel::IActorComponent> CreateTestComponent(Bel::Actor* pOw
     return std::unique_ptr<Bel::IActorComponent>(new TestComponent(pOwner, pName));
 }
 
+static std::unique_ptr<Bel::IActorComponent> CreateSiblingComponent(Bel::Actor* pOwner, const char* pName)
+{
+    return std::unique_ptr<Bel::IActorComponent>(new SiblingComponent(pOwner, pName));
+}
+
+static std::unique_ptr<Bel::IActorComponent> CreateXmlOnlyComponent(Bel::Actor* pOwner, const char* pName)
+{
+    return std::unique_ptr<Bel::IActorComponent>(new XmlOnlyComponent(pOwner, pName));
+}
+
+// The size class TestComponent is allocated from.
+static SlabAllocatorStats GetTestComponentStats()
+{
+    for (const SlabAllocatorStats& stats : IActorComponent::GetAllocator().GetStats())
+    {
+        if (stats.m_slotSize >= sizeof(TestComponent) && stats.m_slotSize < sizeof(TestComponent) + SizedSlabAllocator::kGranularity)
+            return stats;
+    }
+    return SlabAllocatorStats();
+}
+
 namespace BelugaTest
 {
     TEST_CLASS(ActorFactoryTest)
@@ -63,5 +197,254 @@ namespace BelugaTest
             TestComponent* pTestComponent = static_cast<TestComponent*>(pActor->GetComponent(IActorComponent::HashName("TestComponent")));
             Assert::IsNotNull(pTestComponent);
         }
+
+        TEST_METHOD(InstancesAreClonedFromOnePrefab)
+        {
+            ActorFactory actorFactory;
+            actorFactory.RegisterComponentCreator("TestComponent", &CreateTestComponent);
+
+            const std::string kXml = "<Actor><TestComponent/></Actor>";
+            auto pResource = std::make_shared<ResourceHandle>(Resource("Actors/Enemy.xml"), std::vector<char>(kXml.begin(), kXml.end()));
+
+            const int kNumInitializes = TestComponent::s_numInitializes;
+            for (int i = 0; i < 100; ++i)
+            {
+                auto pActor = actorFactory.CreateActorByResource(pResource, [i](Actor* pInstance) { pInstance->SetName("Enemy" + std::to_string(i)); });
+                Assert::IsNotNull(pActor.get());
+                Assert::AreEqual(("Enemy" + std::to_string(i)).c_str(), pActor->GetName().c_str());
+                Assert::IsTrue(pActor->GetComponent(IActorComponent::HashName("TestComponent"))->GetOwner() == pActor.get());
+            }
+
+            // Parsed and initialized once, for the prototype.
+            Assert::AreEqual(static_cast<size_t>(1), actorFactory.GetNumPrefabs());
+            Assert::AreEqual(kNumInitializes + 1, TestComponent::s_numInitializes);
+        }
+
+        TEST_METHOD(PrototypesAreInitializedOnAnActor)
+        {
+            ActorFactory actorFactory;
+            actorFactory.RegisterComponentCreator("TestComponent", &CreateTestComponent);
+            actorFactory.RegisterComponentCreator("SiblingComponent", &CreateSiblingComponent);
+
+            const std::string kXml = "<Actor><TestComponent/><SiblingComponent/></Actor>";
+            auto pResource = std::make_shared<ResourceHandle>(Resource("Actors/Knight.xml"), std::vector<char>(kXml.begin(), kXml.end()));
+            for (int i = 0; i < 2; ++i)
+            {
+                auto pActor = actorFactory.CreateActorByResource(pResource);
+                Assert::IsNotNull(pActor.get());
+
+                SiblingComponent* pComponent = static_cast<SiblingComponent*>(pActor->GetComponent(IActorComponent::HashName("SiblingComponent")));
+                Assert::IsTrue(pComponent->GetOwner() == pActor.get());
+                Assert::IsTrue(pComponent->m_sawSibling);
+            }
+        }
+
+        TEST_METHOD(CreatesActorFromCompiledDefinition)
+        {
+            const std::string kXml = "<Actor><TestComponent><Speed value=\"2.5\"/><Name>Bat</Name></TestComponent></Actor>";
+            tinyxml2::XMLDocument doc;
+            doc.Parse(kXml.c_str());
+            std::vector<char> compiled = ActorDefinition::Compile(doc.RootElement());
+
+            // Answers like the XML it came from.
+            const ActorDefinition::Element* pRoot = ActorDefinition::GetRoot(compiled.data(), compiled.size());
+            Assert::IsNotNull(pRoot);
+            const ActorDefinition::Element* pData = pRoot->FirstChildElement();
+            Assert::AreEqual(IActorComponent::HashName("TestComponent"), pData->GetNameHash());
+            Assert::AreEqual(2.5f, pData->FirstChildElement("Speed")->FloatAttribute("value"));
+            Assert::AreEqual(doc.RootElement()->FirstChildElement()->FirstChildElement("Speed")->IntAttribute("value"), pData->FirstChildElement("Speed")->IntAttribute("value"));
+            Assert::AreEqual("Bat", pData->FirstChildElement("Name")->GetText());
+            Assert::IsNull(pData->FirstChildElement("Missing"));
+            Assert::IsNull(pData->NextSiblingElement());
+            Assert::IsNull(ActorDefinition::GetRoot(compiled.data(), compiled.size() - 4));
+
+            ActorFactory actorFactory;
+            actorFactory.RegisterComponentCreator("TestComponent", &CreateTestComponent);
+
+            auto pResource = std::make_shared<ResourceHandle>(Resource("Actors/Bat.xml"), std::move(compiled));
+            auto pActor = actorFactory.CreateActorByResource(pResource);
+            Assert::IsNotNull(pActor.get());
+
+            TestComponent* pComponent = static_cast<TestComponent*>(pActor->GetComponent(IActorComponent::HashName("TestComponent")));
+            Assert::IsNotNull(pComponent);
+            Assert::AreEqual(2.5f, pComponent->m_speed);
+        }
+
+        TEST_METHOD(CompiledActorKeepsXmlOnlyComponents)
+        {
+            const std::string kXml = "<Actor><TestComponent><Speed value=\"2.5\"/></TestComponent><XmlOnlyComponent health=\"7\"/></Actor>";
+            tinyxml2::XMLDocument doc;
+            doc.Parse(kXml.c_str());
+            std::vector<char> compiled = ActorDefinition::Compile(doc.RootElement());
+            Assert::IsTrue(ActorDefinition::GetSource(compiled.data(), compiled.size()) == kXml);
+
+            ActorFactory actorFactory;
+            actorFactory.RegisterComponentCreator("TestComponent", &CreateTestComponent);
+            actorFactory.RegisterComponentCreator("XmlOnlyComponent", &CreateXmlOnlyComponent);
+
+            // The second instance is stamped out of the prefab.
+            auto pResource = std::make_shared<ResourceHandle>(Resource("Actors/Bat.xml"), std::move(compiled));
+            for (int i = 0; i < 2; ++i)
+            {
+                auto pActor = actorFactory.CreateActorByResource(pResource);
+                Assert::IsNotNull(pActor.get());
+
+                TestComponent* pCompiled = static_cast<TestComponent*>(pActor->GetComponent(IActorComponent::HashName("TestComponent")));
+                XmlOnlyComponent* pXmlOnly = static_cast<XmlOnlyComponent*>(pActor->GetComponent(IActorComponent::HashName("XmlOnlyComponent")));
+                Assert::IsNotNull(pCompiled);
+                Assert::IsNotNull(pXmlOnly);
+                Assert::AreEqual(2.5f, pCompiled->m_speed);
+                Assert::AreEqual(7, pXmlOnly->m_health);
+            }
+        }
+
+        TEST_METHOD(ComponentIdsAreCompileTimeConstants)
+        {
+            // FNV-1a, so the value is the same on every compiler and standard library.
+            static_assert(IActorComponent::HashName("TransformComponent") == 0xcab10936u, "Component ids have to be stable");
+
+            TestComponent component(nullptr, "TestComponent");
+            Assert::AreEqual(IActorComponent::HashName("TestComponent"), component.GetId());
+            Assert::AreNotEqual(IActorComponent::HashName("TestComponent"), IActorComponent::HashName("TestComponent2"));
+        }
+
+        TEST_METHOD(SpawnsReuseSlabs)
+        {
+            ActorFactory actorFactory;
+            auto spawn = [&actorFactory]()
+            {
+                std::vector<std::shared_ptr<Actor>> actors;
+                for (int i = 0; i < 1000; ++i)
+                {
+                    actors.push_back(actorFactory.CreateActorWithEmpty());
+                    actors.back()->AddComponent(CreateTestComponent(actors.back().get(), "TestComponent"));
+                }
+            };
+
+            spawn();
+            const SlabAllocatorStats kActors = ActorFactory::GetActorAllocator().GetStats()[0];
+            const SlabAllocatorStats kComponents = GetTestComponentStats();
+
+            // The second storm fits in what the first one left behind.
+            spawn();
+            Assert::AreEqual(kActors.m_numSlabAllocations, ActorFactory::GetActorAllocator().GetStats()[0].m_numSlabAllocations);
+            Assert::AreEqual(kComponents.m_numSlabAllocations, GetTestComponentStats().m_numSlabAllocations);
+            Assert::AreEqual(kComponents.m_numInUse, GetTestComponentStats().m_numInUse);
+            Assert::IsTrue(kComponents.m_peakInUse >= 1000);
+        }
+
+        TEST_METHOD(ParallelUpdateMergesDeferredInPoolOrder)
+        {
+            ActorFactory actorFactory;
+            std::vector<Actor::Id> reported;
+            std::vector<std::shared_ptr<Actor>> actors;
+            for (int i = 0; i < 1000; ++i)
+            {
+                actors.push_back(actorFactory.CreateActorWithEmpty());
+                actors.back()->SetComponentPools(&actorFactory.GetComponentPools());
+                actors.back()->AddComponent(std::make_unique<ParallelTestComponent>(actors.back().get(), &reported));
+            }
+
+            // What a serial walk would have reported.
+            std::vector<Actor::Id> expected;
+            actorFactory.GetComponentPools().GetPool(IActorComponent::HashName("ParallelTestComponent"))->ForEach([&](IActorComponent* pComponent)
+            {
+                if (pComponent->GetOwner()->GetId() % 10 == 0)
+                    expected.push_back(pComponent->GetOwner()->GetId());
+            });
+
+            ThreadPool workers;
+            workers.Initialize(8);
+            actorFactory.GetComponentPools().Update(0.f, &workers);
+
+            Assert::IsTrue(expected == reported);
+            for (auto& pActor : actors)
+            {
+                Assert::AreEqual(1, static_cast<ParallelTestComponent*>(pActor->GetComponent(IActorComponent::HashName("ParallelTestComponent")))->m_numUpdates);
+            }
+        }
+
+        TEST_METHOD(ParallelUpdateReleasesHandlesOnMainThread)
+        {
+            ActorFactory actorFactory;
+            std::vector<std::thread::id> releasedOn;
+            std::vector<std::shared_ptr<Actor>> actors;
+            for (int i = 0; i < 1000; ++i)
+            {
+                std::shared_ptr<ResourceHandle> pHandle(new ResourceHandle(Resource("Sound.wav"), std::vector<char>(16)), [&releasedOn](ResourceHandle* pReleased)
+                {
+                    releasedOn.push_back(std::this_thread::get_id());
+                    delete pReleased;
+                });
+
+                actors.push_back(actorFactory.CreateActorWithEmpty());
+                actors.back()->SetComponentPools(&actorFactory.GetComponentPools());
+                actors.back()->AddComponent(std::make_unique<ReleasingTestComponent>(actors.back().get(), std::move(pHandle)));
+            }
+
+            ThreadPool workers;
+            workers.Initialize(8);
+            actorFactory.GetComponentPools().Update(0.f, &workers);
+
+            Assert::AreEqual(static_cast<size_t>(1000), releasedOn.size());
+            for (std::thread::id thread : releasedOn)
+            {
+                Assert::IsTrue(thread == std::this_thread::get_id());
+            }
+        }
+
+        TEST_METHOD(ComponentsArePooledByType)
+        {
+            ActorFactory actorFactory;
+            std::vector<std::shared_ptr<Actor>> actors;
+            for (int i = 0; i < 3; ++i)
+            {
+                actors.push_back(actorFactory.CreateActorWithEmpty());
+                actors.back()->AddComponent(CreateTestComponent(actors.back().get(), "TestComponent"));
+                actors.back()->SetComponentPools(&actorFactory.GetComponentPools());
+            }
+
+            ComponentPool* pPool = actorFactory.GetComponentPools().GetPool(IActorComponent::HashName("TestComponent"));
+            Assert::IsNotNull(pPool);
+            Assert::AreEqual(static_cast<size_t>(3), pPool->GetSize());
+
+            // Destroying an actor mid walk neither skips nor revisits the others.
+            int numVisited = 0;
+            pPool->ForEach<TestComponent>([&](TestComponent* pComponent)
+            {
+                if (numVisited++ == 0)
+                    actors[1]->RemoveComponents();
+            });
+            Assert::AreEqual(2, numVisited);
+            Assert::AreEqual(static_cast<size_t>(2), pPool->GetSize());
+
+            actors[0].reset();
+            actorFactory.GetComponentPools().Update(0.f);
+            Assert::AreEqual(1, static_cast<TestComponent*>(actors[2]->GetComponent(IActorComponent::HashName("TestComponent")))->m_numUpdates);
+            Assert::AreEqual(static_cast<size_t>(1), actorFactory.GetComponentPools().GetNumComponents());
+        }
+
+        TEST_METHOD(OnlyRegisteredActorsAreUpdated)
+        {
+            ActorFactory actorFactory;
+            ComponentPools& pools = actorFactory.GetComponentPools();
+
+            // Created but never added to a layer, so nothing updates it.
+            auto pActor = actorFactory.CreateActorWithEmpty();
+            pActor->AddComponent(CreateTestComponent(pActor.get(), "TestComponent"));
+            pools.Update(0.f);
+            Assert::AreEqual(static_cast<size_t>(0), pools.GetNumComponents());
+
+            pActor->SetComponentPools(&pools);
+            pActor->AddComponent(CreateTestComponent(pActor.get(), "TestComponent2"));
+            pools.Update(0.f);
+            Assert::AreEqual(static_cast<size_t>(2), pools.GetNumComponents());
+            Assert::AreEqual(1, static_cast<TestComponent*>(pActor->GetComponent(IActorComponent::HashName("TestComponent")))->m_numUpdates);
+
+            pActor->SetComponentPools(nullptr);
+            pools.Update(0.f);
+            Assert::AreEqual(static_cast<size_t>(0), pools.GetNumComponents());
+            Assert::AreEqual(1, static_cast<TestComponent*>(pActor->GetComponent(IActorComponent::HashName("TestComponent")))->m_numUpdates);
+        }
     };
 }
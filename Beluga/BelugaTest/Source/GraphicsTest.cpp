@@ -1,6 +1,9 @@
 #include "CppUnitTest.h"
 #include <Systems/System.h>
 #include <Graphics/Graphics.h>
+#include <Graphics/PixelImage.h>
+#include <SDL_image.h>
+#include <string.h>
 #include <Log/Logging.h>
 #include "TestApp.h"
 
@@ -70,6 +73,32 @@ namespace BelugaTest
             Assert::IsTrue(pGraphics->DrawTexture(pTexture.get()));
         }
 
+        TEST_METHOD(PixelImageRoundTrip)
+        {
+            std::unique_ptr<SDL_Surface, decltype(&SDL_FreeSurface)> pPng(IMG_Load("../../BelugaTest/Assets/CreateTexture/test.png"), &SDL_FreeSurface);
+            Assert::IsNotNull(pPng.get());
+
+            std::vector<char> data = PixelImage::Encode(pPng.get());
+            Assert::IsTrue(PixelImage::IsPixelImage(data.data(), data.size()));
+
+            std::unique_ptr<SDL_Surface, decltype(&SDL_FreeSurface)> pDecoded(PixelImage::Decode(data.data(), data.size()), &SDL_FreeSurface);
+            Assert::IsNotNull(pDecoded.get());
+            Assert::AreEqual(pPng->w, pDecoded->w);
+            Assert::AreEqual(pPng->h, pDecoded->h);
+
+            // Same pixels as SDL_image gives after converting to the same format.
+            std::unique_ptr<SDL_Surface, decltype(&SDL_FreeSurface)> pExpected(SDL_ConvertSurfaceFormat(pPng.get(), pDecoded->format->format, 0), &SDL_FreeSurface);
+            for (int y = 0; y < pDecoded->h; ++y)
+            {
+                const char* pExpectedRow = static_cast<const char*>(pExpected->pixels) + y * pExpected->pitch;
+                const char* pDecodedRow = static_cast<const char*>(pDecoded->pixels) + y * pDecoded->pitch;
+                Assert::AreEqual(0, memcmp(pExpectedRow, pDecodedRow, pDecoded->w * 4));
+            }
+
+            // Truncated data is rejected rather than read past.
+            Assert::IsNull(PixelImage::Decode(data.data(), data.size() - 1));
+        }
+
     private:
         std::unique_ptr<IGraphics> CreateGraphics()
         {
@@ -0,0 +1,990 @@
+#include "CppUnitTest.h"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <Resources/Resource.h>
+#include <Resources/Codec.h>
+
+#define ZLIB_WINAPI
+#include "zlib.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace Bel;
+
+// A file or directory of one test's own, under the temp directory. Whatever a previous run left
+// there is removed first, and everything is removed again when the test ends, so declare it
+// before anything that keeps the file open.
+class TempPath
+{
+private:
+    std::string m_path;
+
+public:
+    TempPath(const std::string& name)
+        : m_path((std::filesystem::temp_directory_path() / ("BelugaResourceTest." + name)).string())
+    {
+        Remove();
+    }
+
+    ~TempPath() { Remove(); }
+
+    TempPath(const TempPath&) = delete;
+    TempPath& operator=(const TempPath&) = delete;
+
+    const std::string& GetPath() const { return m_path; }
+
+private:
+    // Compaction writes next to the pack first.
+    void Remove()
+    {
+        std::error_code error;
+        std::filesystem::remove_all(m_path, error);
+        std::filesystem::remove(m_path + ".tmp", error);
+    }
+};
+
+// Packs share the blob of identical data, give each resource its own variant where that matters.
+static std::vector<char> MakeTestData(size_t size, bool compressible, int variant = 0)
+{
+    std::vector<char> data(size);
+    for (size_t i = 0; i < size; ++i)
+    {
+        data[i] = compressible ? static_cast<char>('a' + (i / 64) % 4) : static_cast<char>((i * 2654435761u) >> 13);
+    }
+    data[0] = static_cast<char>(data[0] + variant);
+    return data;
+}
+
+// Nothing to compress, so the packer stores it as is.
+static std::vector<char> MakeNoise(size_t size)
+{
+    std::vector<char> data(size);
+    uint32_t state = 2463534242u;
+    for (auto& byte : data)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        byte = static_cast<char>(state);
+    }
+    return data;
+}
+
+static std::vector<char> ReadBytes(const std::string& path)
+{
+    std::ifstream in(path, std::ios_base::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static bool Matches(const std::vector<char>& expected, std::string_view actual)
+{
+    return std::string_view(expected.data(), expected.size()) == actual;
+}
+
+// Minimal archive, the way zip tools lay it out. Deflated entries use raw deflate.
+static void WriteZip(const std::string& path, const std::vector<std::pair<std::string, std::vector<char>>>& files, bool useDeflate)
+{
+    std::ofstream out(path, std::ios_base::binary | std::ios_base::trunc);
+    std::string directory;
+    for (auto& file : files)
+    {
+        std::vector<char> data = file.second;
+        if (useDeflate)
+        {
+            std::vector<char> compressed(compressBound(static_cast<uLong>(data.size())) + 64);
+            z_stream stream = {};
+            deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+            stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(file.second.data()));
+            stream.avail_in = static_cast<uInt>(file.second.size());
+            stream.next_out = reinterpret_cast<Bytef*>(compressed.data());
+            stream.avail_out = static_cast<uInt>(compressed.size());
+            deflate(&stream, Z_FINISH);
+            compressed.resize(stream.total_out);
+            deflateEnd(&stream);
+            data.swap(compressed);
+        }
+
+        ZipFile::ZipLocalHeader local = {};
+        local.m_signature   = ZipFile::ZipLocalHeader::SIGNATURE;
+        local.m_compression = useDeflate ? Z_DEFLATED : 0;
+        local.m_crc32       = crc32(0, reinterpret_cast<const Bytef*>(file.second.data()), static_cast<uInt>(file.second.size()));
+        local.m_cSize       = static_cast<uint32_t>(data.size());
+        local.m_ucSize      = static_cast<uint32_t>(file.second.size());
+        local.m_fNameLen    = static_cast<uint16_t>(file.first.size());
+
+        ZipFile::ZipDirFileHeader entry = {};
+        entry.m_signature   = ZipFile::ZipDirFileHeader::SIGNATURE;
+        entry.m_compression = local.m_compression;
+        entry.m_crc32       = local.m_crc32;
+        entry.m_compSize    = local.m_cSize;
+        entry.m_uncompSize  = local.m_ucSize;
+        entry.m_fNameLen    = local.m_fNameLen;
+        entry.m_hdrOffset   = static_cast<uint32_t>(out.tellp());
+        directory.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+        directory.append(file.first);
+
+        out.write(reinterpret_cast<const char*>(&local), sizeof(local));
+        out.write(file.first.data(), file.first.size());
+        out.write(data.data(), data.size());
+    }
+
+    ZipFile::ZipDirHeader end = {};
+    end.m_signature         = ZipFile::ZipDirHeader::SIGNATURE;
+    end.m_dirEntries        = static_cast<uint16_t>(files.size());
+    end.m_totalDirEntries   = end.m_dirEntries;
+    end.m_dirSize           = static_cast<uint32_t>(directory.size());
+    end.m_dirOffset         = static_cast<uint32_t>(out.tellp());
+    end.m_cmntLen           = 7;
+    out.write(directory.data(), directory.size());
+    out.write(reinterpret_cast<const char*>(&end), sizeof(end));
+    out.write("comment", 7);
+}
+
+// Resource0, Resource1, ... each its own variant.
+static std::vector<std::pair<std::string, std::vector<char>>> MakeNumberedResources(int count, size_t size, bool compressible)
+{
+    std::vector<std::pair<std::string, std::vector<char>>> resources;
+    for (int i = 0; i < count; ++i)
+    {
+        resources.emplace_back("Resource" + std::to_string(i), MakeTestData(size, compressible, i));
+    }
+    return resources;
+}
+
+// A pack of the given resources under the test's own path, read by a 1MB cache with one loader thread.
+class PackedCache
+{
+private:
+    TempPath m_packPath;
+    ResourceZlibFile m_file;
+    ResourceCache m_cache;
+
+public:
+    PackedCache(const std::string& name, const std::vector<std::pair<std::string, std::vector<char>>>& resources)
+        : m_packPath(name)
+        , m_file(m_packPath.GetPath())
+        , m_cache(1, &m_file)
+    {
+        ZlibFile packer;
+        for (auto& resource : resources)
+        {
+            packer.AddResource(resource.first, resource.second);
+        }
+        Assert::IsTrue(packer.Save(m_packPath.GetPath()));
+        Assert::IsTrue(m_cache.Initialize(1));
+    }
+
+    const std::string& GetPackPath() const { return m_packPath.GetPath(); }
+    ResourceCache& GetCache() { return m_cache; }
+};
+
+namespace BelugaTest
+{
+    TEST_CLASS(ZlibFileTest)
+    {
+    public:
+        TEST_METHOD(SaveAndLoad)
+        {
+            TempPath packPath("SaveAndLoad.bin");
+            ZlibFile packer;
+            packer.AddResource("Actors\\Player.xml", MakeTestData(4096, true));
+            packer.AddResource("Textures/Noise.png", MakeTestData(1024, false));
+            Assert::IsTrue(packer.Save(packPath.GetPath()));
+
+            ZlibFile pack;
+            Assert::IsTrue(pack.Load(packPath.GetPath()));
+            Assert::AreEqual(static_cast<size_t>(2), pack.GetNumResources());
+
+            auto pXml = pack.LoadResource("actors/player.xml");
+            Assert::IsNotNull(pXml.get());
+            Assert::IsTrue(Matches(MakeTestData(4096, true), pXml->GetData()));
+
+            auto pTexture = pack.LoadResource("TEXTURES\\noise.png");
+            Assert::IsNotNull(pTexture.get());
+            Assert::IsTrue(Matches(MakeTestData(1024, false), pTexture->GetData()));
+        }
+
+        TEST_METHOD(SaveReportsFailure)
+        {
+            TempPath missingDirectory("SaveReportsFailure");
+            ZlibFile packer;
+            packer.AddResource("Actors/Player.xml", MakeTestData(4096, true));
+            Assert::IsFalse(packer.Save(missingDirectory.GetPath() + "/Pack.bin"));
+        }
+
+        TEST_METHOD(FindEntry)
+        {
+            TempPath packPath("FindEntry.bin");
+            ZlibFile packer;
+            packer.AddResource("Levels/Level1.tmx", MakeTestData(2048, true));
+            packer.Save(packPath.GetPath());
+
+            ZlibFile pack;
+            Assert::IsTrue(pack.Load(packPath.GetPath()));
+
+            const Pack::Entry* pEntry = pack.FindEntry("levels/level1.tmx");
+            Assert::IsNotNull(pEntry);
+            Assert::AreEqual("levels/level1.tmx", pack.GetEntryName(*pEntry));
+            Assert::IsNull(pack.FindEntry("levels/level2.tmx"));
+            Assert::IsNull(pack.LoadResource("levels/level2.tmx").get());
+        }
+
+        TEST_METHOD(StoredEntriesAreNotCopied)
+        {
+            TempPath packPath("StoredEntriesAreNotCopied.bin");
+            {
+                ZlibFile packer;
+                packer.AddResource("Music.ogg", MakeNoise(8192));
+                packer.Save(packPath.GetPath());
+            }
+
+            auto pPack = std::make_unique<ZlibFile>();
+            Assert::IsTrue(pPack->Load(packPath.GetPath()));
+            Assert::AreEqual(static_cast<uint16_t>(Pack::kCodecStored), pPack->FindEntry("music.ogg")->m_codec);
+
+            std::shared_ptr<ResourceHandle> pHandle = pPack->LoadResource("music.ogg");
+            Assert::AreEqual(static_cast<size_t>(0), pHandle->GetMemorySize());
+
+            // The handle keeps the mapping alive on its own.
+            pPack.reset();
+            Assert::IsTrue(Matches(MakeNoise(8192), pHandle->GetData()));
+        }
+
+        TEST_METHOD(UpdateAppendsAndRemoves)
+        {
+            TempPath packPath("UpdateAppendsAndRemoves.bin");
+
+            // Little of the data goes dead, well under the ratio.
+            ZlibFile packer;
+            packer.AddResource("Keep.xml", MakeTestData(64 * 1024, false));
+            packer.AddResource("Change.xml", MakeTestData(4096, true, 1));
+            packer.AddResource("Remove.xml", MakeTestData(4096, true, 2));
+            packer.Save(packPath.GetPath());
+            const std::vector<char> kOldPack = ReadBytes(packPath.GetPath());
+
+            ZlibFile updater;
+            Assert::IsTrue(updater.OpenForUpdate(packPath.GetPath()));
+            updater.AddResource("Change.xml", MakeTestData(1024, false));
+            Assert::IsTrue(updater.RemoveResource("Remove.xml"));
+            Assert::IsTrue(updater.Save(packPath.GetPath()));
+
+            // Appended behind the old pack, its table and footer included, which stay untouched.
+            const std::vector<char> kNewPack = ReadBytes(packPath.GetPath());
+            Assert::IsTrue(kNewPack.size() > kOldPack.size());
+            Assert::IsTrue(std::equal(kOldPack.begin(), kOldPack.end(), kNewPack.begin()));
+
+            ZlibFile pack;
+            Assert::IsTrue(pack.Load(packPath.GetPath()));
+            Assert::AreEqual(static_cast<size_t>(2), pack.GetNumResources());
+            Assert::IsTrue(Matches(MakeTestData(64 * 1024, false), pack.LoadResource("keep.xml")->GetData()));
+            Assert::IsTrue(Matches(MakeTestData(1024, false), pack.LoadResource("change.xml")->GetData()));
+            Assert::IsNull(pack.LoadResource("remove.xml").get());
+        }
+
+        TEST_METHOD(UpdateCompacts)
+        {
+            TempPath packPath("UpdateCompacts.bin");
+            ZlibFile packer;
+            packer.AddResource("Keep.png", MakeTestData(4096, false));
+            packer.AddResource("Change.png", MakeTestData(4096, false, 1));
+            packer.Save(packPath.GetPath());
+
+            // Half of the data goes dead, well over the ratio.
+            ZlibFile updater;
+            Assert::IsTrue(updater.OpenForUpdate(packPath.GetPath(), 0.1f));
+            updater.AddResource("Change.png", MakeTestData(2048, false));
+            Assert::IsTrue(updater.GetDeadBytes() > 0);
+            Assert::IsTrue(updater.Save(packPath.GetPath()));
+
+            ZlibFile pack;
+            Assert::IsTrue(pack.OpenForUpdate(packPath.GetPath()));
+            Assert::AreEqual(static_cast<uint64_t>(0), pack.GetDeadBytes());
+            Assert::IsTrue(Matches(MakeTestData(4096, false), pack.LoadResource("keep.png")->GetData()));
+            Assert::IsTrue(Matches(MakeTestData(2048, false), pack.LoadResource("change.png")->GetData()));
+        }
+
+        TEST_METHOD(IdenticalDataSharesBlob)
+        {
+            TempPath packPath("IdenticalDataSharesBlob.bin");
+            {
+                ZlibFile packer;
+                packer.AddResource("Tiles/Grass.png", MakeTestData(4096, false));
+                packer.AddResource("Copy/Grass.png", MakeTestData(4096, false));
+                packer.AddResource("Tiles/Dirt.png", MakeTestData(4096, false, 1));
+                packer.Save(packPath.GetPath());
+            }
+
+            ZlibFile pack;
+            Assert::IsTrue(pack.Load(packPath.GetPath()));
+            Assert::AreEqual(static_cast<size_t>(3), pack.GetNumResources());
+            Assert::AreEqual(pack.FindEntry("tiles/grass.png")->m_offset, pack.FindEntry("copy/grass.png")->m_offset);
+            Assert::AreEqual(pack.GetContentId(ResourceId("tiles/grass.png")), pack.GetContentId(ResourceId("copy/grass.png")));
+            Assert::AreNotEqual(pack.GetContentId(ResourceId("tiles/grass.png")), pack.GetContentId(ResourceId("tiles/dirt.png")));
+            Assert::IsTrue(Matches(MakeTestData(4096, false), pack.LoadResource("copy/grass.png")->GetData()));
+
+            // Shared blobs are live as long as any alias is.
+            ZlibFile updater;
+            Assert::IsTrue(updater.OpenForUpdate(packPath.GetPath()));
+            Assert::IsTrue(updater.RemoveResource("Tiles/Grass.png"));
+            Assert::AreEqual(static_cast<uint64_t>(0), updater.GetDeadBytes());
+        }
+
+        TEST_METHOD(HashIgnoresCaseAndSlashes)
+        {
+            Assert::AreEqual(HashResourcePath(std::string("a/b/c.xml")), HashResourcePath(std::string("A\\B\\C.XML")));
+            Assert::AreNotEqual(HashResourcePath(std::string("a/b/c.xml")), HashResourcePath(std::string("a/b/d.xml")));
+        }
+
+        TEST_METHOD(ResourceIdIsComputedAtCompileTime)
+        {
+            static constexpr ResourceId kPlayer("Actors\\Player.xml");
+            static_assert(kPlayer == ResourceId("actors/player.xml"), "ResourceId has to normalize like the pack");
+            static_assert(kPlayer.GetHash() == HashResourcePath("actors/player.xml", 17), "ResourceId is the path hash");
+            Assert::IsTrue(Resource("ACTORS/PLAYER.XML").GetId() == kPlayer);
+        }
+    };
+
+    TEST_CLASS(ZipFileTest)
+    {
+    public:
+        TEST_METHOD(FindsAndInflatesEntries)
+        {
+            TempPath zipPath("FindsAndInflatesEntries.zip");
+            std::vector<std::pair<std::string, std::vector<char>>> files;
+            for (int i = 0; i < 16; ++i)
+            {
+                files.emplace_back("Mods/Level" + std::to_string(i) + ".xml", MakeTestData(50000, true, i));
+            }
+            WriteZip(zipPath.GetPath(), files, true);
+
+            ZipFile zip;
+            Assert::IsTrue(zip.Initialize(zipPath.GetPath()));
+            Assert::AreEqual(16, zip.GetNumFiles());
+            Assert::AreEqual(3, zip.Find("MODS\\level3.xml"));
+            Assert::AreEqual(-1, zip.Find("mods/level16.xml"));
+            Assert::AreEqual("Mods/Level0.xml", zip.GetFileName(0).c_str());
+
+            std::vector<char> data(zip.GetFileLength(5));
+            Assert::IsTrue(zip.ReadLargeFile(5, data.data(), nullptr));
+            Assert::IsTrue(Matches(MakeTestData(50000, true, 5), std::string_view(data.data(), data.size())));
+
+            // Every entry at once, through the loader threads.
+            ResourceZipFile file(zipPath.GetPath());
+            Assert::IsTrue(file.Open());
+            ResourceCache cache(8, &file);
+            Assert::IsTrue(cache.Initialize(4));
+
+            std::vector<std::shared_ptr<ResourceHandle>> handles(files.size());
+            for (size_t i = 0; i < files.size(); ++i)
+            {
+                Resource resource(files[i].first);
+                cache.GetHandleAsync(&resource, [&handles, i](std::shared_ptr<ResourceHandle> pHandle) { handles[i] = pHandle; });
+            }
+            while (cache.GetNumPendingLoads() > 0)
+            {
+                cache.ProcessAsyncLoads();
+                std::this_thread::yield();
+            }
+
+            for (size_t i = 0; i < files.size(); ++i)
+            {
+                Assert::IsNotNull(handles[i].get());
+                Assert::IsTrue(Matches(files[i].second, handles[i]->GetData()));
+            }
+        }
+    };
+
+    TEST_CLASS(CodecTest)
+    {
+    public:
+        TEST_METHOD(LzRoundTrip)
+        {
+            // Short runs, long runs (overlapping copies) and a tail shorter than a match.
+            std::vector<char> data = MakeTestData(100000, true);
+            data.insert(data.end(), 5000, 'x');
+            std::vector<char> noise = MakeTestData(3000, false);
+            data.insert(data.end(), noise.begin(), noise.end());
+            data.push_back('!');
+
+            LzCodec codec;
+            std::vector<char> compressed;
+            Assert::IsTrue(codec.Compress(data.data(), data.size(), compressed));
+            Assert::IsTrue(compressed.size() < data.size() / 4);
+
+            std::vector<char> decompressed(data.size());
+            Assert::IsTrue(codec.Decompress(compressed.data(), compressed.size(), decompressed.data(), decompressed.size()));
+            Assert::IsTrue(data == decompressed);
+
+            // A wrong size or a truncated stream is refused instead of overrunning the buffer.
+            Assert::IsFalse(codec.Decompress(compressed.data(), compressed.size(), decompressed.data(), decompressed.size() - 1));
+            Assert::IsFalse(codec.Decompress(compressed.data(), compressed.size() / 2, decompressed.data(), decompressed.size()));
+        }
+
+        TEST_METHOD(PackPicksCodecPerEntry)
+        {
+            TempPath packPath("PackPicksCodecPerEntry.bin");
+            ZlibFile packer;
+            packer.AddResource("Small.xml", MakeTestData(2048, true));
+            packer.AddResource("Large.png", MakeTestData(1 << 20, true));
+            packer.Save(packPath.GetPath());
+
+            ZlibFile pack;
+            Assert::IsTrue(pack.Load(packPath.GetPath()));
+            Assert::AreEqual(static_cast<uint16_t>(Pack::kCodecZlib), pack.FindEntry("small.xml")->m_codec);
+            Assert::AreNotEqual(static_cast<uint16_t>(Pack::kCodecStored), pack.FindEntry("large.png")->m_codec);
+            Assert::IsTrue(Matches(MakeTestData(2048, true), pack.LoadResource("small.xml")->GetData()));
+            Assert::IsTrue(Matches(MakeTestData(1 << 20, true), pack.LoadResource("large.png")->GetData()));
+        }
+
+        TEST_METHOD(SmallEntriesUseTypeDictionary)
+        {
+            TempPath packPath("SmallEntriesUseTypeDictionary.bin");
+
+            // Actor files are mostly the same tags with different numbers in them.
+            std::vector<std::vector<char>> actors;
+            for (int i = 0; i < 16; ++i)
+            {
+                const std::string kXml = "<Actor name=\"Enemy" + std::to_string(i) + "\">\n"
+                    "    <TransformComponent><Position x=\"" + std::to_string(i * 32) + "\" y=\"" + std::to_string(i * 7) + "\"/></TransformComponent>\n"
+                    "    <Box2DPhysicsComponent><Body type=\"dynamic\"/><Shape type=\"box\" width=\"" + std::to_string(16 + i) + "\" height=\"32\"/></Box2DPhysicsComponent>\n"
+                    "    <AnimationComponent><Sprite image=\"Textures/Enemy.png\" frames=\"" + std::to_string(i % 4 + 1) + "\"/></AnimationComponent>\n"
+                    "</Actor>\n";
+                actors.emplace_back(kXml.begin(), kXml.end());
+            }
+
+            std::vector<std::string_view> samples;
+            for (auto& actor : actors)
+            {
+                samples.emplace_back(actor.data(), actor.size());
+            }
+            const std::vector<char> kDictionary = TrainDictionary(samples);
+            Assert::IsFalse(kDictionary.empty());
+            Assert::IsTrue(kDictionary.size() <= ZlibDictionaryCodec::kMaxDictionarySize);
+
+            const std::string kDictionaryPath = ZlibFile::GetDictionaryPath("Actors/Enemy0.XML");
+            Assert::AreEqual(std::string(kDictionaryPathPrefix) + "xml", kDictionaryPath);
+
+            ZlibFile packer;
+            packer.AddCompressedResource({ kDictionaryPath, kDictionary, static_cast<uint32_t>(kDictionary.size()), Pack::kCodecStored, 
+                HashResourceData(kDictionary.data(), kDictionary.size()) });
+            for (size_t i = 0; i < actors.size(); ++i)
+            {
+                const std::string kPath = "Actors/Enemy" + std::to_string(i) + ".xml";
+                ZlibFile::CompressedResource plain = ZlibFile::CompressResource(kPath, actors[i]);
+                ZlibFile::CompressedResource primed = ZlibFile::CompressResource(kPath, actors[i], std::string_view(kDictionary.data(), kDictionary.size()));
+                Assert::AreEqual(static_cast<uint16_t>(Pack::kCodecZlibDictionary), primed.m_codec);
+                Assert::IsTrue(primed.m_data.size() * 2 < plain.m_data.size());
+                packer.AddCompressedResource(std::move(primed));
+            }
+            packer.Save(packPath.GetPath());
+
+            ZlibFile pack;
+            Assert::IsTrue(pack.Load(packPath.GetPath()));
+            for (size_t i = 0; i < actors.size(); ++i)
+            {
+                std::shared_ptr<ResourceHandle> pHandle = pack.LoadResource("actors/enemy" + std::to_string(i) + ".xml");
+                Assert::IsNotNull(pHandle.get());
+                Assert::IsTrue(Matches(actors[i], pHandle->GetData()));
+            }
+        }
+
+        TEST_METHOD(DictionaryBlobsAreNotSharedAcrossTypes)
+        {
+            TempPath packPath("DictionaryBlobsAreNotSharedAcrossTypes.bin");
+            std::vector<std::vector<char>> samples;
+            std::vector<std::string_view> sampleViews;
+            for (int i = 0; i < 16; ++i)
+            {
+                const std::string kXml = "<Actor name=\"Enemy" + std::to_string(i) + "\"><TransformComponent><Position x=\"" + std::to_string(i * 32) + "\"/></TransformComponent></Actor>";
+                samples.emplace_back(kXml.begin(), kXml.end());
+            }
+            for (auto& sample : samples)
+            {
+                sampleViews.emplace_back(sample.data(), sample.size());
+            }
+            const std::vector<char> kDictionary = TrainDictionary(sampleViews);
+            const std::string_view kDictionaryView(kDictionary.data(), kDictionary.size());
+
+            // The same bytes as an .xml, compressed against the .xml dictionary, and as a .tsx, which has none.
+            ZlibFile packer;
+            packer.AddCompressedResource({ ZlibFile::GetDictionaryPath("a.xml"), kDictionary, static_cast<uint32_t>(kDictionary.size()), Pack::kCodecStored,
+                HashResourceData(kDictionary.data(), kDictionary.size()) });
+            ZlibFile::CompressedResource primed = ZlibFile::CompressResource("a.xml", samples[3], kDictionaryView);
+            Assert::AreEqual(static_cast<uint16_t>(Pack::kCodecZlibDictionary), primed.m_codec);
+            packer.AddCompressedResource(std::move(primed));
+            packer.AddCompressedResource(ZlibFile::CompressResource("b.tsx", samples[3]));
+            Assert::IsFalse(packer.AddAlias("c.tsx", "a.xml"));
+            Assert::IsTrue(packer.AddAlias("d.xml", "a.xml"));
+            packer.Save(packPath.GetPath());
+
+            ZlibFile pack;
+            Assert::IsTrue(pack.Load(packPath.GetPath()));
+            for (const char* pPath : { "a.xml", "b.tsx", "d.xml" })
+            {
+                std::shared_ptr<ResourceHandle> pHandle = pack.LoadResource(pPath);
+                Assert::IsNotNull(pHandle.get());
+                Assert::IsTrue(Matches(samples[3], pHandle->GetData()));
+            }
+            Assert::AreNotEqual(pack.FindEntry("a.xml")->m_offset, pack.FindEntry("b.tsx")->m_offset);
+        }
+    };
+
+    TEST_CLASS(ResourceStreamTest)
+    {
+    public:
+        TEST_METHOD(StreamsCompressedEntry)
+        {
+            TempPath packPath("StreamsCompressedEntry.bin");
+
+            // Under the size where the packer times codecs, so it stays on zlib.
+            const std::vector<char> kData = MakeTestData(60000, true);
+            {
+                ZlibFile packer;
+                packer.AddResource("Music.ogg", kData);
+                packer.Save(packPath.GetPath());
+            }
+
+            ZlibFile pack;
+            Assert::IsTrue(pack.Load(packPath.GetPath()));
+            Assert::AreEqual(static_cast<uint16_t>(Pack::kCodecZlib), pack.FindEntry("music.ogg")->m_codec);
+
+            // A window much smaller than the entry, read in odd sized pieces.
+            std::unique_ptr<IResourceStream> pStream = pack.OpenStream("music.ogg", 4096);
+            Assert::IsNotNull(pStream.get());
+            Assert::AreEqual(static_cast<uint64_t>(kData.size()), pStream->GetSize());
+
+            std::vector<char> read;
+            char buffer[1000];
+            while (size_t count = pStream->Read(buffer, sizeof(buffer)))
+            {
+                read.insert(read.end(), buffer, buffer + count);
+            }
+            Assert::IsTrue(kData == read);
+
+            // Backwards restarts the decoder, forwards skips ahead.
+            Assert::IsTrue(pStream->Seek(10));
+            Assert::AreEqual(static_cast<size_t>(100), pStream->Read(buffer, 100));
+            Assert::IsTrue(std::equal(buffer, buffer + 100, kData.begin() + 10));
+            Assert::IsTrue(pStream->Seek(50000));
+            Assert::AreEqual(static_cast<size_t>(100), pStream->Read(buffer, 100));
+            Assert::IsTrue(std::equal(buffer, buffer + 100, kData.begin() + 50000));
+            Assert::IsFalse(pStream->Seek(kData.size() + 1));
+        }
+
+        TEST_METHOD(BlockedEntryReadsRanges)
+        {
+            TempPath packPath("BlockedEntryReadsRanges.bin");
+            const std::vector<char> kData = MakeTestData(3 * 1024 * 1024 + 123, true);
+            {
+                ZlibFile packer;
+                packer.AddResource("Levels/World.tmx", kData);
+                packer.Save(packPath.GetPath());
+            }
+
+            ZlibFile pack;
+            Assert::IsTrue(pack.Load(packPath.GetPath()));
+            Assert::IsTrue((pack.FindEntry("levels/world.tmx")->m_flags & Pack::kFlagBlocks) != 0);
+            Assert::IsTrue(Matches(kData, pack.LoadResource("levels/world.tmx")->GetData()));
+
+            // Across a block boundary, and the short last block.
+            std::vector<char> range(100000);
+            const size_t kOffset = BlockCodec::kDefaultBlockSize - 5000;
+            Assert::IsTrue(pack.ReadRange("levels/world.tmx", kOffset, range.data(), range.size()));
+            Assert::IsTrue(std::equal(range.begin(), range.end(), kData.begin() + kOffset));
+            Assert::IsTrue(pack.ReadRange("levels/world.tmx", kData.size() - 100, range.data(), 100));
+            Assert::IsTrue(std::equal(range.begin(), range.begin() + 100, kData.end() - 100));
+            Assert::IsFalse(pack.ReadRange("levels/world.tmx", kData.size() - 100, range.data(), 101));
+
+            // Going backwards only decodes the block that holds the position.
+            std::unique_ptr<IResourceStream> pStream = pack.OpenStream("levels/world.tmx");
+            char buffer[100];
+            Assert::IsTrue(pStream->Seek(2 * 1024 * 1024));
+            Assert::AreEqual(static_cast<size_t>(100), pStream->Read(buffer, 100));
+            Assert::IsTrue(std::equal(buffer, buffer + 100, kData.begin() + 2 * 1024 * 1024));
+            Assert::IsTrue(pStream->Seek(10));
+            Assert::AreEqual(static_cast<size_t>(100), pStream->Read(buffer, 100));
+            Assert::IsTrue(std::equal(buffer, buffer + 100, kData.begin() + 10));
+        }
+
+        TEST_METHOD(BlockedEntryDecodesOnLentThreads)
+        {
+            TempPath packPath("BlockedEntryDecodesOnLentThreads.bin");
+            const std::vector<char> kData = MakeTestData(3 * 1024 * 1024 + 123, true);
+            {
+                ZlibFile packer;
+                packer.AddResource("Levels/World.tmx", kData);
+                packer.Save(packPath.GetPath());
+            }
+
+            ZlibFile pack;
+            Assert::IsTrue(pack.Load(packPath.GetPath()));
+            ThreadPool threads;
+            threads.Initialize(3);
+            pack.SetBlockThreads(&threads);
+
+            // Several loads at once share the three helpers, every one still finishes whole.
+            std::vector<std::thread> loaders;
+            std::atomic<int> numMatches(0);
+            for (int i = 0; i < 4; ++i)
+            {
+                loaders.emplace_back([&]()
+                {
+                    if (Matches(kData, pack.LoadResource("levels/world.tmx")->GetData()))
+                        ++numMatches;
+                });
+            }
+            for (auto& loader : loaders)
+            {
+                loader.join();
+            }
+            Assert::AreEqual(4, numMatches.load());
+
+            // Without a pool the loading thread does it alone.
+            threads.Shutdown();
+            pack.SetBlockThreads(nullptr);
+            Assert::IsTrue(Matches(kData, pack.LoadResource("levels/world.tmx")->GetData()));
+        }
+    };
+
+    class TestLoader : public DefaultResourceLoader
+    {
+    private:
+        std::string m_pattern;
+
+    public:
+        TestLoader(const std::string& pattern) : m_pattern(pattern) {}
+        virtual std::string GetPattern() override { return m_pattern; }
+    };
+
+    TEST_CLASS(ResourceLoaderTableTest)
+    {
+    public:
+        TEST_METHOD(MatchWildcard)
+        {
+            Assert::IsTrue(ResourceLoaderTable::MatchWildcard("actors/player.xml", "*.xml"));
+            Assert::IsTrue(ResourceLoaderTable::MatchWildcard("actors/player.xml", "actors/*"));
+            Assert::IsTrue(ResourceLoaderTable::MatchWildcard("actors/player.xml", "a*s/p?ayer.*"));
+            Assert::IsTrue(ResourceLoaderTable::MatchWildcard("aaab", "*a*b"));
+            Assert::IsFalse(ResourceLoaderTable::MatchWildcard("actors/player.xml", "*.png"));
+            Assert::IsFalse(ResourceLoaderTable::MatchWildcard("actors/player.xml", "actors/?.xml"));
+        }
+
+        TEST_METHOD(NewestMatchingLoaderWins)
+        {
+            auto pDefault = std::make_shared<TestLoader>("*");
+            auto pXml = std::make_shared<TestLoader>("*.xml");
+            auto pLevels = std::make_shared<TestLoader>("levels/*.xml");
+            auto pNormals = std::make_shared<TestLoader>("*_normal.png");
+            auto pPlayer = std::make_shared<TestLoader>("actors/player.xml");
+
+            ResourceLoaderTable table;
+            table.Register(pDefault);
+            table.Register(pLevels);
+            table.Register(pXml);
+            table.Register(pNormals);
+            table.Register(pPlayer);
+
+            Assert::IsTrue(pPlayer == table.Find("actors/player.xml"));
+            Assert::IsTrue(pXml == table.Find("actors/enemy.xml"));
+            Assert::IsTrue(pXml == table.Find("levels/level1.xml"));     // "*.xml" came later.
+            Assert::IsTrue(pNormals == table.Find("textures/rock_normal.png"));
+            Assert::IsTrue(pDefault == table.Find("textures/rock.png"));
+            Assert::IsTrue(pDefault == table.Find("readme"));
+
+            auto pXml2 = std::make_shared<TestLoader>("*.xml");
+            table.Register(pXml2);
+            Assert::IsTrue(pXml2 == table.Find("actors/enemy.xml"));
+        }
+    };
+
+    TEST_CLASS(ResourceDependencyGraphTest)
+    {
+    public:
+        TEST_METHOD(GroupIsTransitiveClosure)
+        {
+            ResourceDependencyGraph graph;
+            graph.AddDependency("Maps/Level1.tmx", "tilesets/grass.tsx");
+            graph.AddDependency("maps/level1.tmx", "actors/player.xml");
+            graph.AddDependency("tilesets/grass.tsx", "textures/grass.png");
+            graph.AddDependency("actors/player.xml", "scripts/player.lua");
+            graph.AddDependency("scripts/player.lua", "actors/player.xml");     // Cycles are allowed.
+
+            std::vector<std::string> group = graph.GetGroup("maps/level1.tmx");
+            Assert::AreEqual(static_cast<size_t>(5), group.size());
+            Assert::AreEqual("maps/level1.tmx", group[0].c_str());
+
+            ResourceDependencyGraph copy;
+            copy.Deserialize(graph.Serialize());
+            Assert::IsTrue(graph.Serialize() == copy.Serialize());
+            Assert::AreEqual(static_cast<size_t>(5), copy.GetGroup("maps/level1.tmx").size());
+        }
+    };
+
+    TEST_CLASS(LayeredResourceFileTest)
+    {
+    public:
+        TEST_METHOD(HigherLayersShadowLowerOnes)
+        {
+            TempPath packPath("HigherLayersShadowLowerOnes.bin");
+            TempPath patchPath("HigherLayersShadowLowerOnes.patch.bin");
+            TempPath loosePath("HigherLayersShadowLowerOnes.loose");
+            {
+                ZlibFile base;
+                base.AddResource("Maps/Level1.tmx", MakeTestData(2048, true));
+                base.AddResource("Tilesets/Grass.tsx", MakeTestData(2048, true, 1));
+                base.AddResource("Tilesets/Sand.tsx", MakeTestData(2048, true, 2));
+                const std::string kBaseDependencies = "maps/level1.tmx\ttilesets/grass.tsx\n";
+                base.AddResource(kDependencyTablePath, std::vector<char>(kBaseDependencies.begin(), kBaseDependencies.end()));
+                base.Save(packPath.GetPath());
+
+                // The patched level uses the other tileset now.
+                ZlibFile patch;
+                patch.AddResource("Maps/Level1.tmx", MakeTestData(4096, true, 3));
+                const std::string kPatchDependencies = "maps/level1.tmx\ttilesets/sand.tsx\n";
+                patch.AddResource(kDependencyTablePath, std::vector<char>(kPatchDependencies.begin(), kPatchDependencies.end()));
+                patch.Save(patchPath.GetPath());
+
+                std::filesystem::create_directories(loosePath.GetPath() + "/Scripts");
+                std::ofstream loose(loosePath.GetPath() + "/Scripts/Debug.lua", std::ios_base::binary);
+                loose << "print('loose')";
+            }
+
+            LayeredResourceFile layers;
+            Assert::IsTrue(layers.Mount(std::make_unique<ResourceZlibFile>(packPath.GetPath())));
+            Assert::IsTrue(layers.Mount(std::make_unique<ResourceZlibFile>(patchPath.GetPath())));
+            ResourceCache cache(16, &layers);
+            Assert::IsTrue(cache.Initialize(1));
+
+            // Mounted after the cache is up, e.g. a dev directory.
+            Assert::IsTrue(layers.Mount(std::make_unique<ResourceDirectoryFile>(loosePath.GetPath())));
+            Assert::AreEqual(1, layers.FindLayer("maps/level1.tmx"));
+            Assert::AreEqual(0, layers.FindLayer("TILESETS\\Grass.tsx"));
+            Assert::AreEqual(2, layers.FindLayer("scripts/debug.lua"));
+            Assert::AreEqual(-1, layers.FindLayer("missing.xml"));
+
+            Resource level("maps/level1.tmx");
+            Resource grass("tilesets/grass.tsx");
+            Resource script("scripts/debug.lua");
+            Assert::IsTrue(Matches(MakeTestData(4096, true, 3), cache.GetHandle(&level)->GetData()));
+            Assert::IsTrue(Matches(MakeTestData(2048, true, 1), cache.GetHandle(&grass)->GetData()));
+            Assert::IsTrue(cache.GetHandle(&script)->GetData() == "print('loose')");
+
+            // Each path keeps the dependencies of the layer that serves it.
+            std::vector<std::string> group = cache.GetDependencyGraph().GetGroup("maps/level1.tmx");
+            Assert::AreEqual(static_cast<size_t>(2), group.size());
+            Assert::AreEqual("tilesets/sand.tsx", group[1].c_str());
+        }
+    };
+
+    TEST_CLASS(ResourceCacheTest)
+    {
+    public:
+        TEST_METHOD(EvictsLeastRecentlyUsed)
+        {
+            PackedCache packed("EvictsLeastRecentlyUsed.bin", MakeNumberedResources(4, 400 * 1024, false));
+            ResourceCache& cache = packed.GetCache();
+
+            Resource resource0("Resource0");
+            Resource resource1("Resource1");
+            Resource resource2("Resource2");
+            cache.GetHandle(&resource0);
+            cache.GetHandle(&resource1);
+            cache.GetHandle(&resource0);
+            Assert::AreEqual(static_cast<size_t>(800 * 1024), cache.GetAllocated());
+
+            // Resource1 is the coldest one, so it has to make room for Resource2.
+            cache.GetHandle(&resource2);
+            Assert::AreEqual(static_cast<size_t>(2), cache.GetNumResources());
+            Assert::AreEqual(static_cast<size_t>(800 * 1024), cache.GetAllocated());
+            Assert::IsTrue(cache.GetAllocated() <= cache.GetCacheSize());
+        }
+
+        TEST_METHOD(KeepsHandlesInUse)
+        {
+            PackedCache packed("KeepsHandlesInUse.bin", MakeNumberedResources(4, 300 * 1024, false));
+            ResourceCache& cache = packed.GetCache();
+
+            Resource resource0("Resource0");
+            Resource resource1("Resource1");
+            Resource resource2("Resource2");
+            Resource resource3("Resource3");
+            auto pInUse = cache.GetHandle(&resource0);
+            auto pPinned = cache.GetHandle(&resource1);
+            ResourceHandle* pPinnedRaw = pPinned.get();
+            cache.Pin(pPinned);
+            pPinned.reset();
+            cache.GetHandle(&resource2);
+
+            // Resource0 and Resource1 are colder, but only Resource2 may go.
+            cache.GetHandle(&resource3);
+            Assert::AreEqual(static_cast<size_t>(3), cache.GetNumResources());
+            Assert::AreEqual(static_cast<size_t>(900 * 1024), cache.GetAllocated());
+            Assert::IsTrue(pInUse == cache.GetHandle(&resource0));
+            Assert::IsTrue(pPinnedRaw == cache.GetHandle(&resource1).get());
+        }
+
+        TEST_METHOD(ReleasedHandlesRejoinAsMostRecent)
+        {
+            PackedCache packed("ReleasedHandlesRejoinAsMostRecent.bin", MakeNumberedResources(4, 400 * 1024, false));
+            ResourceCache& cache = packed.GetCache();
+
+            Resource resource0("Resource0");
+            Resource resource1("Resource1");
+            Resource resource2("Resource2");
+            Resource resource3("Resource3");
+
+            // Requested first but released last, so Resource1 is the coldest.
+            auto pHandle0 = cache.GetHandle(&resource0);
+            cache.GetHandle(&resource1);
+            pHandle0.reset();
+            cache.GetHandle(&resource2);
+            Assert::AreEqual(static_cast<size_t>(2), cache.GetNumResources());
+            ResourceHandle* pCached0 = cache.GetHandle(&resource0).get();
+
+            // Released while pinned, it only rejoins when unpinned, after Resource2 was touched.
+            cache.Pin(cache.GetHandle(&resource0));
+            cache.GetHandle(&resource2);
+            cache.Unpin(cache.GetHandle(&resource0));
+            cache.GetHandle(&resource3);
+            Assert::AreEqual(static_cast<size_t>(2), cache.GetNumResources());
+            Assert::IsTrue(pCached0 == cache.GetHandle(&resource0).get());
+        }
+
+        TEST_METHOD(RecordsAndPrefetchesAccessTrace)
+        {
+            TempPath tracePath("RecordsAndPrefetchesAccessTrace.trace");
+            PackedCache packed("RecordsAndPrefetchesAccessTrace.bin", MakeNumberedResources(4, 1024, true));
+            {
+                ResourceCache& cache = packed.GetCache();
+
+                Resource resource2("Resource2");
+                Resource resource0("Resource0");
+                Resource resource3("Resource3");
+                cache.StartRecording();
+                cache.GetHandle(&resource2);
+                cache.GetHandle(&resource0);
+                cache.GetHandle(&resource2);
+                cache.StopRecording();
+                cache.GetHandle(&resource3);
+
+                Assert::AreEqual(static_cast<size_t>(2), cache.GetAccessTrace().size());
+                Assert::IsTrue(cache.SaveAccessTrace(tracePath.GetPath()));
+            }
+
+            std::vector<std::string> trace = ResourceCache::LoadAccessTrace(tracePath.GetPath());
+            Assert::AreEqual(static_cast<size_t>(2), trace.size());
+            Assert::AreEqual("Resource2", trace[0].c_str());
+            Assert::AreEqual("Resource0", trace[1].c_str());
+
+            // A cache of its own on the same pack, as on the next run.
+            ResourceZlibFile file(packed.GetPackPath());
+            ResourceCache cache(1, &file);
+            Assert::IsTrue(cache.Initialize(1));
+            Assert::IsTrue(cache.Prefetch(tracePath.GetPath()));
+            while (cache.GetNumPendingLoads() > 0 || cache.GetNumPrefetchQueued() > 0)
+            {
+                cache.ProcessAsyncLoads();
+                std::this_thread::yield();
+            }
+            Assert::AreEqual(static_cast<size_t>(2), cache.GetNumResources());
+        }
+
+        TEST_METHOD(AliasesShareDecodedData)
+        {
+            PackedCache packed("AliasesShareDecodedData.bin", {
+                { "Tiles/Grass.png", MakeTestData(4096, true) },
+                { "Copy/Grass.png", MakeTestData(4096, true) }
+            });
+            ResourceCache& cache = packed.GetCache();
+
+            Resource original("tiles/grass.png");
+            Resource copy("copy/grass.png");
+            auto pOriginal = cache.GetHandle(&original);
+            auto pCopy = cache.GetHandle(&copy);
+            Assert::AreEqual(static_cast<size_t>(2), cache.GetNumResources());
+            Assert::IsTrue(pOriginal->GetData().data() == pCopy->GetData().data());
+            Assert::AreEqual(static_cast<size_t>(4096), cache.GetAllocated());
+        }
+
+        TEST_METHOD(SpellingsOfAPathShareOneHandle)
+        {
+            PackedCache packed("SpellingsOfAPathShareOneHandle.bin", {
+                { "Actors/Player.xml", MakeTestData(1024, true) }
+            });
+            ResourceCache& cache = packed.GetCache();
+
+            Resource lower("actors/player.xml");
+            Resource upper("ACTORS\\PLAYER.XML");
+            auto pLower = cache.GetHandle(&lower);
+            auto pUpper = cache.GetHandle(&upper);
+            Assert::IsTrue(pLower != nullptr && pLower == pUpper);
+            Assert::AreEqual(static_cast<size_t>(1), cache.GetNumResources());
+            Assert::AreEqual(static_cast<uint64_t>(1), cache.GetStats().m_hits);
+        }
+
+        TEST_METHOD(CountsHitsMissesAndEvictions)
+        {
+            PackedCache packed("CountsHitsMissesAndEvictions.bin", MakeNumberedResources(3, 400 * 1024, true));
+            ResourceCache& cache = packed.GetCache();
+
+            Resource resource0("Resource0");
+            Resource resource1("Resource1");
+            Resource resource2("Resource2");
+            cache.GetHandle(&resource0);
+            cache.GetHandle(&resource0);
+            cache.GetHandle(&resource1);
+            cache.GetHandle(&resource2);
+
+            ResourceCacheStats stats = cache.GetStats();
+            Assert::AreEqual(static_cast<uint64_t>(1), stats.m_hits);
+            Assert::AreEqual(static_cast<uint64_t>(3), stats.m_misses);
+            Assert::AreEqual(static_cast<uint64_t>(1), stats.m_evictions);
+            Assert::AreEqual(static_cast<size_t>(800 * 1024), stats.m_peakBytesResident);
+            Assert::AreEqual(static_cast<uint64_t>(3 * 400 * 1024), stats.m_file.m_bytesInflated);
+            Assert::IsTrue(stats.m_file.m_bytesRead < stats.m_file.m_bytesInflated);
+
+            Assert::AreEqual(static_cast<uint32_t>(3), cache.GetLoadLatencies().at("*").m_numLoads);
+            Assert::AreEqual("Resource0", cache.GetHottest(1)[0].first.c_str());
+            TempPath statsPath("CountsHitsMissesAndEvictions.stats");
+            Assert::IsTrue(cache.DumpStats(statsPath.GetPath()));
+        }
+
+        TEST_METHOD(ReleaseGroupFreesExclusiveAssets)
+        {
+            PackedCache packed("ReleaseGroupFreesExclusiveAssets.bin", {
+                { "level1.xml", MakeTestData(1024, true) },
+                { "level2.xml", MakeTestData(1024, true, 1) },
+                { "shared.png", MakeTestData(1024, true, 2) },
+                { "only1.png", MakeTestData(1024, true, 3) }
+            });
+            ResourceCache& cache = packed.GetCache();
+            cache.GetDependencyGraph().AddDependency("level1.xml", "shared.png");
+            cache.GetDependencyGraph().AddDependency("level1.xml", "only1.png");
+            cache.GetDependencyGraph().AddDependency("level2.xml", "shared.png");
+
+            bool loaded = false;
+            cache.LoadGroup("level1.xml", [&loaded](bool success) { loaded = success; });
+            cache.LoadGroup("level2.xml");
+            while (!loaded || !cache.IsGroupLoaded("level2.xml"))
+            {
+                cache.ProcessAsyncLoads();
+                std::this_thread::yield();
+            }
+            Assert::AreEqual(static_cast<size_t>(4), cache.GetNumResources());
+
+            // shared.png is still needed by level2.
+            cache.ReleaseGroup("level1.xml");
+            Assert::AreEqual(static_cast<size_t>(2), cache.GetNumResources());
+            Assert::IsFalse(cache.IsGroupLoaded("level1.xml"));
+
+            cache.ReleaseGroup("level2.xml");
+            Assert::AreEqual(static_cast<size_t>(0), cache.GetNumResources());
+        }
+    };
+}
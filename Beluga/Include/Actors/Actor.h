@@ -1,19 +1,28 @@
 #pragma once
 #include <unordered_map>
+#include <vector>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <string_view>
+#include <cstdint>
 
 #include "Scripting/Scripting.h"
 #include "Parshing/tinyxml2.h"
+#include "Actors/ActorDefinition.h"
+#include "Core/Util/SlabAllocator.h"
 
 namespace Bel
 {
     class Actor;
+    class ComponentPool;
+    class EventManager;
+    class IEvent;
     class IGraphics;
     class IView;
     class ResourceHandle;
     class ScriptingManager;
+    class ThreadPool;
 
     // Empty struct for identifying  each component.
     // This is required for checking which kind of family type that component came from,
@@ -26,64 +35,205 @@ namespace Bel
     public:
         typedef uint32_t Id;
 
+        // What Update() touches, which decides whether a type may be updated on worker threads.
+        // Cross-actor effects go through ComponentPools::Defer() in either parallel kind, and so does
+        // dropping a resource handle, the cache takes released handles back on the main thread only.
+        enum class Access
+        {
+            kMainThread,    // Anything, e.g. Lua, SDL or the physics world.
+            kReadOnly,      // Writes only the component itself. Reads components of other types on any actor,
+                            // but no other component of its own type, those are being written meanwhile.
+            kOwnActor,      // Reads and writes its own actor only.
+        };
+
     private:
+        friend class ComponentPool;
+
         Actor* m_pOwner;
         Id m_familyId;
         Id m_compId;
+        uint32_t m_poolSlot;    // Index in the pool of its type, owned by ComponentPool.
 
     public:
         IActorComponent(Actor* pOwner, std::string_view name)
+            : IActorComponent(pOwner, HashName(name))
+        {
+        }
+
+        IActorComponent(Actor* pOwner, Id id)
             : m_pOwner(pOwner)
-            , m_compId(HashName(name))
-            , m_familyId(HashName(name))
+            , m_familyId(id)
+            , m_compId(id)
+            , m_poolSlot(0)
         {
         }
         virtual ~IActorComponent() {}
 
+        // Every component type comes from slabs of its size (the virtual destructor hands
+        // delete the real one), so spawning and destroying stops hitting the heap.
+        static void* operator new(size_t size) { return GetAllocator().Allocate(size); }
+        static void operator delete(void* pMemory, size_t size) { GetAllocator().Free(pMemory, size); }
+        static SizedSlabAllocator& GetAllocator();
+
         virtual bool Initialize(tinyxml2::XMLElement* pData) = 0;
+
+        // From a definition the packer compiled. Element mirrors XMLElement, so a type usually
+        // serves both through one template. Types that don't override it are initialized from
+        // the XML the definition keeps.
+        virtual bool Initialize(const ActorDefinition::Element* /*pData*/) { return false; }
         virtual bool PostInit() { return true; }
+
+        // Copy of an initialized component that was never post-initialized, prefabs stamp
+        // their instances out of these. nullptr if the type can't be copied, the prefab then
+        // initializes it from the XML it already parsed.
+        virtual std::unique_ptr<IActorComponent> Clone(Actor* /*pOwner*/) const { return nullptr; }
         virtual void Update(float delta) {}
         virtual void Render(IGraphics* pGraphics) {}
 
+        // The same for every component of a type.
+        virtual Access GetAccess() const { return Access::kMainThread; }
+
         virtual void RegisterWithScript() {}
 
         Actor* GetOwner() { return m_pOwner; }
 
+    protected:
+        void SetOwner(Actor* pOwner) { m_pOwner = pOwner; }
+
+    public:
+
         Id GetId()         const { return m_compId; }
         Id GetFamilyId()   const { return m_familyId; }
 
 
-        static Id HashName(std::string_view name)
+        // 32-bit FNV-1a, the same with every compiler and standard library,
+        // so ids of literal names are compile time constants:
+        //     constexpr IActorComponent::Id kTransformId = IActorComponent::HashName("TransformComponent");
+        static constexpr Id HashName(std::string_view name)
+        {
+            return ActorDefinition::HashName(name);
+        }
+
+        // Debug builds remember the name behind every id the factory registered and assert on
+        // collisions. Release builds keep nothing and return an empty name.
+        static void RegisterName(std::string_view name);
+        static std::string_view GetRegisteredName(Id id);
+    };
+
+    /// Class Description
+    ///
+    /// Every live component of one type, packed densely so a system walks them in order
+    /// instead of hopping from actor to actor through hash maps.
+    /// Removing one swaps the last into its place, except while the pool is being walked:
+    /// then the slot is cleared and the pool compacts once the walk is done.
+    class ComponentPool
+    {
+    private:
+        std::vector<IActorComponent*> m_components;
+        size_t m_numHoles;
+        unsigned int m_walkDepth;
+        IActorComponent::Access m_access;
+
+    public:
+        explicit ComponentPool(IActorComponent::Access access = IActorComponent::Access::kMainThread)
+            : m_numHoles(0)
+            , m_walkDepth(0)
+            , m_access(access)
+        {
+        }
+
+        void Add(IActorComponent* pComponent);
+        void Remove(IActorComponent* pComponent);
+
+        size_t GetSize() const { return m_components.size() - m_numHoles; }
+        IActorComponent::Access GetAccess() const { return m_access; }
+
+        // Updates contiguous ranges as jobs on the workers and waits for them. What they deferred
+        // is applied afterwards, range by range, so in pool order like a serial walk.
+        void UpdateParallel(float delta, ThreadPool& workers);
+
+        // Components added during the walk are visited from the next one on.
+        template <class Component = IActorComponent, class Function>
+        void ForEach(Function function)
         {
-            std::hash<std::string> hasher;
-            return static_cast<Id>(hasher(std::string(name)));
+            ++m_walkDepth;
+            const size_t kCount = m_components.size();
+            for (size_t i = 0; i < kCount; ++i)
+            {
+                if (m_components[i] != nullptr)
+                    function(static_cast<Component*>(m_components[i]));
+            }
+            if (--m_walkDepth == 0 && m_numHoles > 0)
+                Compact();
         }
+
+    private:
+        void Compact();
+    };
+
+    /// Class Description
+    ///
+    /// One ComponentPool per component type. Actors the game layer holds register their
+    /// components here, so it updates them type by type, in the order the types first showed up.
+    class ComponentPools
+    {
+    public:
+        using Action = std::function<void()>;
+
+        // Smaller pools are walked on the main thread, the jobs would cost more than they save.
+        static constexpr size_t kMinParallelSize = 64;
+
+    private:
+        std::deque<ComponentPool> m_pools;      // Never moved, a type can appear in the middle of Update().
+        std::unordered_map<IActorComponent::Id, ComponentPool*> m_poolsById;
+
+    public:
+        void Add(IActorComponent* pComponent);
+        void Remove(IActorComponent* pComponent);
+
+        // nullptr if no component of that type was ever added.
+        ComponentPool* GetPool(IActorComponent::Id id);
+        size_t GetNumComponents() const;
+
+        // Pools whose type isn't main thread only are split over the workers, when they run.
+        void Update(float delta, ThreadPool* pWorkers = nullptr);
+
+        // Spawning, destroying, queueing events and releasing resource handles from a parallel
+        // update have to wait until its pass is over, then they run on the main thread in pool
+        // order, so the outcome doesn't depend on thread timing. Anywhere else the action runs right away.
+        static void Defer(Action action);
+        static void DeferEvent(EventManager& eventManager, std::unique_ptr<IEvent> pEvent);
+        static void DeferRelease(std::shared_ptr<ResourceHandle> pHandle);
     };
 
     class Actor
     {
     public:
         typedef uint32_t Id;
+        typedef std::vector<std::unique_ptr<IActorComponent>> ComponentList;
 
     private:
         Id m_id;
         //IView* m_pOwnerView;
 
         std::string m_name;
-        std::unordered_map<IActorComponent::Id, std::unique_ptr<IActorComponent>> m_components;
+        ComponentList m_components;     // An actor has a handful, scanning them beats hashing.
+        ComponentPools* m_pPools;       // Where its components are registered, nullptr until it is added to a layer.
 
     public:
         Actor(Id id)
             : m_id(id)
+            , m_pPools(nullptr)
         {
         }
 
         ~Actor()
         {
-            m_components.clear();
+            RemoveComponents();
         }
 
         bool Initialize(tinyxml2::XMLElement* pData);
+        bool Initialize(const ActorDefinition::Element* pData);
         bool PostInit();
         void Destroy();
         void Update(float delta);
@@ -92,8 +242,12 @@ namespace Bel
         void AddComponent(std::unique_ptr<IActorComponent> pComponent);
         IActorComponent* GetComponent(IActorComponent::Id id);
         bool HasComponent(IActorComponent::Id id);
+        void RemoveComponents();
+
+        // Registers the components, and those added later, so they are updated. nullptr takes them out again.
+        void SetComponentPools(ComponentPools* pPools);
 
-        std::unordered_map<IActorComponent::Id, std::unique_ptr<IActorComponent>>* GetComponents() { return &m_components; }
+        ComponentList* GetComponents() { return &m_components; }
 
         Id GetId() const { return m_id; }
         void SetName(const std::string_view& name) { m_name = name; }
@@ -108,10 +262,49 @@ namespace Bel
     {
     public:
         typedef std::function<std::unique_ptr<IActorComponent>(Actor*, const char*)> ComponentFunction;
-    
+
+        // Runs on a new instance after its components were created and before PostInit(),
+        // e.g. to name and place it, so physics bodies are created where it spawns.
+        using ActorOverride = std::function<void(Actor* pActor)>;
+
     private:
+        struct ComponentCreator
+        {
+            std::string m_name;     // Compiled definitions only know the id.
+            ComponentFunction m_function;
+        };
+
+        // Owns the prototypes of a prefab, never handed out, registered with pools or post-initialized.
+        static constexpr Actor::Id kPrototypeId = UINT32_MAX;
+
+        // An actor resource parsed once. Instances clone the prototypes, which are initialized on an
+        // actor of their own, so they see their owner and the components before them like an instance.
+        // Holds either the XML or the compiled definition, whichever the resource was. A compiled
+        // one parses its XML too once a component type only initializes from that.
+        struct Prefab
+        {
+            struct Component
+            {
+                IActorComponent::Id m_id;           // Of the prototype on m_prototype.
+                tinyxml2::XMLElement* m_pData;      // For types that can't be cloned, or only initialize from XML.
+                const ActorDefinition::Element* m_pCompiled;
+            };
+
+            Actor m_prototype{ kPrototypeId };
+            std::string m_name;
+            tinyxml2::XMLDocument m_doc;
+            std::vector<uint32_t> m_compiled;       // Copied, elements are read in place and need the alignment.
+            size_t m_compiledSize = 0;              // In bytes.
+            const ActorDefinition::Element* m_pCompiledRoot = nullptr;
+            std::vector<Component> m_components;  // In the order of the resource, one per type.
+
+            void AddPrototype(std::unique_ptr<IActorComponent> pPrototype, tinyxml2::XMLElement* pData, const ActorDefinition::Element* pCompiled);
+        };
+
         Actor::Id m_nextActorId;
-        std::unordered_map<std::string, ComponentFunction> m_actorComponentCreatorMap;
+        std::unordered_map<IActorComponent::Id, ComponentCreator> m_actorComponentCreatorMap;
+        ComponentPools m_componentPools;    // Must outlive every actor registered with it.
+        std::unordered_map<uint64_t, std::unique_ptr<Prefab>> m_prefabs;  // By ResourceId hash.
 
     public:
         ActorFactory()
@@ -122,18 +315,34 @@ namespace Bel
 
         std::shared_ptr<Actor> CreateActorWithEmpty();
         std::shared_ptr<Actor> CreateActorByFileName(const std::string_view& fileName);
-        std::shared_ptr<Actor> CreateActorByResource(std::shared_ptr<ResourceHandle> pResource);
+        std::shared_ptr<Actor> CreateActorByResource(std::shared_ptr<ResourceHandle> pResource, const ActorOverride& override = nullptr);
+
+        // Prefabs live until cleared, e.g. when the actor resources were reloaded.
+        void ClearPrefabs() { m_prefabs.clear(); }
+        size_t GetNumPrefabs() const { return m_prefabs.size(); }
 
         void RegisterComponentCreator(const char* pComponentName, ComponentFunction pFunction)
         {
-            m_actorComponentCreatorMap[pComponentName] = pFunction;
+            IActorComponent::RegisterName(pComponentName);
+            m_actorComponentCreatorMap[IActorComponent::HashName(pComponentName)] = { pComponentName, pFunction };
         }
 
         const Actor::Id GetNextActorId() { return m_nextActorId++; }
+
+        // Actors are allocated together with their shared_ptr control block from these slabs.
+        // Shared by every factory and never destroyed. Actors registered with the factory's pools
+        // still have to go before it, they unregister their components.
+        static SizedSlabAllocator& GetActorAllocator();
         size_t GetNumComponentCreator() { return m_actorComponentCreatorMap.size(); }
+        ComponentPools& GetComponentPools() { return m_componentPools; }
 
     private:
         std::shared_ptr<Actor> CreateActor(tinyxml2::XMLDocument& kDoc, const tinyxml2::XMLError& kError);
         std::unique_ptr<IActorComponent> CreateComponent(tinyxml2::XMLElement* pData, Actor* pOwner);
+        std::unique_ptr<IActorComponent> CreateComponent(const ActorDefinition::Element* pData, Actor* pOwner);
+        bool LoadPrefab(Prefab& prefab, const ResourceHandle& resource);
+        tinyxml2::XMLElement* FindSourceElement(Prefab& prefab, const ActorDefinition::Element* pElement);
+        Prefab* FindPrefab(const ResourceHandle& resource);
+        std::shared_ptr<Actor> Instantiate(Prefab& prefab, const ActorOverride& override);
     };
 }
\ No newline at end of file
@@ -0,0 +1,116 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace tinyxml2
+{
+    class XMLElement;
+}
+
+namespace Bel
+{
+    /// Class Description
+    ///
+    /// Actor XML as the packer ships it: the element tree flattened into one buffer, with every
+    /// attribute and text already parsed the way tinyxml2 would. Loading is a bounds check instead
+    /// of building a DOM. Element answers the same queries as tinyxml2::XMLElement, so a component
+    /// initializes from either through one template. XML stays the authoring format, and ships
+    /// behind the tree for component types that only initialize from XML.
+    namespace ActorDefinition
+    {
+        constexpr uint32_t kMagic = 0x54434142;    // "BACT"
+        constexpr uint16_t kVersion = 2;
+
+        // 32-bit FNV-1a, which is also what component ids are, so a component element's name is its id.
+        constexpr uint32_t HashName(std::string_view name)
+        {
+            uint32_t hash = 2166136261u;
+            for (char c : name)
+            {
+                hash ^= static_cast<uint8_t>(c);
+                hash *= 16777619u;
+            }
+            return hash;
+        }
+
+        struct Header
+        {
+            uint32_t m_magic;
+            uint16_t m_version;
+            uint16_t m_reserved;
+            uint32_t m_size;        // Header included, the root element follows it.
+            uint32_t m_sourceSize;  // The XML it was compiled from, which follows the root element.
+        }; // 16 bytes
+
+        // An attribute, or the text of its element.
+        struct Value
+        {
+            enum Flags : uint8_t
+            {
+                kIsInt      = 1 << 0,
+                kIsFloat    = 1 << 1,
+                kIsBool     = 1 << 2,
+            };
+
+            uint32_t m_name;        // Hashed attribute name, kTextName for the text.
+            uint32_t m_text;        // Offset of the null terminated text from its element.
+            int32_t m_int;
+            float m_float;
+            uint8_t m_flags;        // Which of the numbers the text parsed to.
+            uint8_t m_bool;
+            uint16_t m_reserved;
+        }; // 20 bytes
+
+        constexpr uint32_t kTextName = 0;
+
+        static_assert(sizeof(Header) == 16 && sizeof(Value) == 20, "Actor definitions are read straight from the buffer");
+
+        // Lives inside the buffer, only ever used through pointers. Its values follow it, then their
+        // texts, then its children, each child directly after the previous one.
+        struct Element
+        {
+            uint32_t m_name;
+            uint16_t m_numValues;
+            uint16_t m_isLast;      // No sibling follows it.
+            uint32_t m_size;        // Values, texts and children included.
+            uint32_t m_children;    // Offset of the first child, m_size if there is none.
+
+            uint32_t GetNameHash() const { return m_name; }
+
+            // nullptr when there is none, like tinyxml2. pName nullptr for any element.
+            const Element* FirstChildElement(const char* pName = nullptr) const;
+            const Element* NextSiblingElement(const char* pName = nullptr) const;
+
+            const char* Attribute(const char* pName) const;
+            int IntAttribute(const char* pName, int defaultValue = 0) const;
+            float FloatAttribute(const char* pName, float defaultValue = 0) const;
+            bool BoolAttribute(const char* pName, bool defaultValue = false) const;
+
+            const char* GetText() const;
+            int IntText(int defaultValue = 0) const;
+            float FloatText(float defaultValue = 0) const;
+            bool BoolText(bool defaultValue = false) const;
+
+            const Value* FindValue(uint32_t name) const;
+            const char* GetBytes() const { return reinterpret_cast<const char*>(this); }
+        }; // 16 bytes
+
+        static_assert(sizeof(Element) == 16, "Actor definitions are read straight from the buffer");
+
+        bool IsActorDefinition(const char* pData, size_t size);
+
+        // The actor element, whose children are its components. Checks every offset once, so the
+        // queries don't have to. nullptr if the data is not a valid definition of this version.
+        // pData has to be 4 byte aligned.
+        const Element* GetRoot(const char* pData, size_t size);
+
+        // The XML text the definition was compiled from, for parsing it after all. Empty if the data
+        // is not a valid definition of this version.
+        std::string_view GetSource(const char* pData, size_t size);
+
+        // Empty on failure.
+        std::vector<char> Compile(const tinyxml2::XMLElement* pRoot);
+    }
+}
@@ -11,6 +11,7 @@
 #include "Resources/Resource.h"
 #include "Scripting/Scripting.h"
 #include "Levels/Level.h"
+#include "Core/Util/ThreadPool.h"
 
 namespace Bel
 {
@@ -39,6 +40,7 @@ namespace Bel
 
     private:
         std::vector<std::unique_ptr<IView>> m_pendingViews;
+        ThreadPool m_updateThreads;     // Idle unless the parallel update was enabled.
 
     public:
         IGameLayer(float&& xGravity, float&& yGravity);
@@ -46,6 +48,10 @@ namespace Bel
         {
             m_views.clear();
             m_actors.clear();
+            m_guis.clear();
+
+            // Prototypes hold components too, gone before the physics manager they would unregister from.
+            m_actorFactory.ClearPrefabs();
         }
         virtual const char* GetGameName() const = 0;
         virtual void LoadLevel(IEvent* pEvent) = 0;
@@ -68,6 +74,18 @@ namespace Bel
             return true;
         }
 
+        // Component types that declared they can run off the main thread are then updated
+        // across these workers. Zero means one less than the number of hardware threads.
+        bool EnableParallelUpdate(size_t numThreads = 0)
+        {
+            return m_updateThreads.Initialize(numThreads);
+        }
+
+        void DisableParallelUpdate()
+        {
+            m_updateThreads.Shutdown();
+        }
+
         virtual void AddView(std::unique_ptr<IView> pView)
         {
             m_pendingViews.emplace_back(std::move(pView));
@@ -84,24 +102,17 @@ namespace Bel
             }
 
             m_eventManager.ProcessEvents();
-            m_pPhysicsManager->Update(delta);
-            m_processManager.UpdateProcesses(delta);
 
-            for (auto& actor : m_actors)
+            if (m_pResCache != nullptr)
             {
-                if (actor.second == nullptr)
-                    continue;
-
-                actor.second->Update(delta);
+                m_pResCache->ProcessAsyncLoads();
             }
 
-            for (auto& actor : m_guis)
-            {
-                if (actor.second == nullptr)
-                    continue;
+            m_pPhysicsManager->Update(delta);
+            m_processManager.UpdateProcesses(delta);
 
-                actor.second->Update(delta);
-            }
+            // Type by type through the pools, which hold the actors and GUIs of this layer.
+            m_actorFactory.GetComponentPools().Update(delta, &m_updateThreads);
 
             for (auto& pView : m_views)
             {
@@ -124,6 +135,11 @@ namespace Bel
             m_scriptingManager.AddToTable("actors");
             
             m_scriptingManager.SetGlobal("g_logic");
+
+            if (m_pResCache != nullptr)
+            {
+                m_pResCache->RegisterWithScript();
+            }
         }
     
         void AddPendingView()
@@ -184,13 +200,16 @@ namespace Bel
             return nullptr;
         }
 
+        // Its components are updated from now on, until it is destroyed.
         void AddActor(Actor::Id id, std::shared_ptr<Actor> pActor)
         {
+            pActor->SetComponentPools(&m_actorFactory.GetComponentPools());
             m_actors[id] = pActor;
         }
 
         void AddGUI(Actor::Id id, std::shared_ptr<Actor> pActor)
         {
+            pActor->SetComponentPools(&m_actorFactory.GetComponentPools());
             m_guis[id] = pActor;
         }
 
@@ -201,12 +220,7 @@ namespace Bel
             if (pActor == nullptr)
                 return;
 
-            auto components = pActor->GetComponents();
-            for (auto compIter = components->begin(); compIter != components->end(); ++compIter)
-            {
-                compIter->second.reset();
-            }
-            pActor->GetComponents()->clear();
+            pActor->RemoveComponents();
             pActor.reset();
             m_actors.erase(id);
         }
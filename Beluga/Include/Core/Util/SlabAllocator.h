@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace Bel
+{
+    struct SlabAllocatorStats
+    {
+        size_t m_slotSize = 0;
+        size_t m_numSlabs = 0;
+        size_t m_numSlots = 0;      // Over every slab.
+        size_t m_numInUse = 0;
+        size_t m_peakInUse = 0;
+        uint64_t m_numAllocations = 0;
+        uint64_t m_numSlabAllocations = 0;  // Times a slab had to come from the heap.
+    };
+
+    /// Class Description
+    ///
+    /// Fixed-size slots carved out of large slabs, recycled through a free list.
+    /// Slabs are kept until the allocator goes away, so once a spawn storm has grown it
+    /// to its peak, allocating and freeing no longer touch the general heap. Thread safe.
+    class SlabAllocator
+    {
+    private:
+        size_t m_slotSize;
+        size_t m_slotsPerSlab;
+        std::vector<std::unique_ptr<char[]>> m_slabs;
+        void* m_pFree;              // Each free slot starts with the pointer to the next one.
+
+        mutable std::mutex m_mutex;
+        SlabAllocatorStats m_stats;
+
+    public:
+        SlabAllocator(size_t slotSize, size_t slotsPerSlab = 256);
+        SlabAllocator(const SlabAllocator& src) = delete;
+        SlabAllocator& operator=(const SlabAllocator& rhs) = delete;
+
+        void* Allocate();
+        void Free(void* pSlot);
+
+        size_t GetSlotSize() const { return m_slotSize; }
+        SlabAllocatorStats GetStats() const;
+
+    private:
+        void AddSlab();
+    };
+
+    /// Class Description
+    ///
+    /// One SlabAllocator per size class, for types whose size is only known at the
+    /// allocation (operator new of a base class). Larger requests go to the heap.
+    class SizedSlabAllocator
+    {
+    public:
+        static constexpr size_t kGranularity = 16;
+        static constexpr size_t kMaxSlotSize = 1024;
+
+    private:
+        std::unique_ptr<SlabAllocator> m_pAllocators[kMaxSlotSize / kGranularity];
+        std::mutex m_mutex;     // Only guards creating an allocator.
+
+    public:
+        void* Allocate(size_t size);
+        void Free(void* pMemory, size_t size);
+
+        // One entry per size class in use.
+        std::vector<SlabAllocatorStats> GetStats();
+
+    private:
+        SlabAllocator* GetAllocator(size_t size);
+    };
+
+    /// Class Description
+    ///
+    /// Standard allocator over a SizedSlabAllocator, for std::allocate_shared() and the like,
+    /// whose control block size only the standard library knows.
+    template <class Type>
+    class SlabStlAllocator
+    {
+        template <class Other> friend class SlabStlAllocator;
+        static_assert(alignof(Type) <= alignof(std::max_align_t), "Slab slots are only aligned like operator new");
+
+    private:
+        SizedSlabAllocator* m_pSlabs;
+
+    public:
+        using value_type = Type;
+
+        explicit SlabStlAllocator(SizedSlabAllocator* pSlabs) : m_pSlabs(pSlabs) {}
+
+        template <class Other>
+        SlabStlAllocator(const SlabStlAllocator<Other>& src) : m_pSlabs(src.m_pSlabs) {}
+
+        Type* allocate(size_t count) { return static_cast<Type*>(m_pSlabs->Allocate(count * sizeof(Type))); }
+        void deallocate(Type* pMemory, size_t count) { m_pSlabs->Free(pMemory, count * sizeof(Type)); }
+
+        template <class Other>
+        bool operator==(const SlabStlAllocator<Other>& rhs) const { return m_pSlabs == rhs.m_pSlabs; }
+        template <class Other>
+        bool operator!=(const SlabStlAllocator<Other>& rhs) const { return m_pSlabs != rhs.m_pSlabs; }
+    };
+}
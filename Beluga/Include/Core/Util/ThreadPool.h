@@ -0,0 +1,57 @@
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace Bel
+{
+    /// Class Description
+    ///
+    /// Fixed-size pool of worker threads that pulls jobs from a single FIFO queue.
+    /// Jobs must not touch main-thread only state (SDL renderer, Lua state, ...),
+    /// results should be handed back to the main thread by the caller.
+    class ThreadPool
+    {
+    public:
+        using Job = std::function<void()>;
+
+    private:
+        std::vector<std::thread>    m_workers;
+        std::queue<Job>             m_jobs;
+
+        // --- Multi-threading ---
+        std::mutex                  m_mutex;
+        std::condition_variable     m_condVar;
+        std::condition_variable     m_idleCondVar;
+        size_t                      m_numActiveJobs;
+        bool                        m_exit;
+
+    public:
+        ThreadPool();
+        ThreadPool(const ThreadPool& src) = delete;
+        ThreadPool& operator=(const ThreadPool& rhs) = delete;
+        ~ThreadPool();
+
+        // Spawns the workers. Zero means one less than the number of hardware threads.
+        bool Initialize(size_t numThreads = 0);
+
+        // Finishes the queued jobs, then joins every worker.
+        void Shutdown();
+
+        void AddJob(Job job);
+
+        // Blocks until the queue is empty and every worker is idle.
+        void Wait();
+
+        size_t GetNumThreads() const { return m_workers.size(); }
+        bool IsRunning() const { return !m_workers.empty(); }
+
+    private:
+        // Function that will be running at each worker thread.
+        void ProcessJobs();
+    };
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+struct SDL_Surface;
+
+namespace Bel
+{
+    /// Class Description
+    ///
+    /// Images as the packer stores them: a small header followed by the rows in the pixel
+    /// format textures are created from, so loading is a header check instead of a PNG decode.
+    /// The pack codec compresses the pixels like any other entry.
+    namespace PixelImage
+    {
+        constexpr uint32_t kMagic = 0x4C585042;    // "BPXL"
+        constexpr uint16_t kVersion = 1;
+
+        struct Header
+        {
+            uint32_t m_magic;
+            uint16_t m_version;
+            uint16_t m_bytesPerPixel;
+            uint32_t m_format;      // SDL_PixelFormatEnum.
+            uint32_t m_width;
+            uint32_t m_height;
+            uint32_t m_pitch;       // Rows are tightly packed, width * bytes per pixel.
+        }; // 24 bytes
+
+        static_assert(sizeof(Header) == 24, "PixelImage::Header is read straight from the pack");
+
+        bool IsPixelImage(const char* pData, size_t size);
+
+        // Converts to the native format first if needed. Empty on failure.
+        std::vector<char> Encode(SDL_Surface* pSurface);
+
+        // The surface points into pData, which has to outlive it. nullptr (and SDL_GetError()) on failure.
+        SDL_Surface* Decode(const char* pData, size_t size);
+    }
+}
@@ -8,7 +8,7 @@
 #include "Parshing/tinyxml2.h"
 #include "Actors/Actor.h"
 
-static const Bel::IActorComponent::Id kTileId = Bel::IActorComponent::HashName("TileSetComponent");
+constexpr Bel::IActorComponent::Id kTileId = Bel::IActorComponent::HashName("TileSetComponent");
 
 namespace Bel
 {
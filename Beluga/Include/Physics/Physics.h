@@ -9,9 +9,9 @@
 #include "Scripting/Scripting.h"
 #include "Physics/PhysicsShape.h"
 
-static const Bel::IActorComponent::Id kTransformId = Bel::IActorComponent::HashName("TransformComponent");
-static const Bel::IActorComponent::Id kDynamicBodyId = Bel::IActorComponent::HashName("DynamicBodyComponent");
-static const Bel::IActorComponent::Id kStaticBodyId = Bel::IActorComponent::HashName("StaticBodyComponent");
+constexpr Bel::IActorComponent::Id kTransformId = Bel::IActorComponent::HashName("TransformComponent");
+constexpr Bel::IActorComponent::Id kDynamicBodyId = Bel::IActorComponent::HashName("DynamicBodyComponent");
+constexpr Bel::IActorComponent::Id kStaticBodyId = Bel::IActorComponent::HashName("StaticBodyComponent");
 
 namespace Bel
 {
@@ -37,6 +37,14 @@ namespace Bel
         virtual ~TransformComponent() {}
 
         virtual bool Initialize(tinyxml2::XMLElement* pData) override;
+        virtual bool Initialize(const ActorDefinition::Element* pData) override;
+
+        virtual std::unique_ptr<IActorComponent> Clone(Actor* pOwner) const override
+        {
+            auto pClone = std::make_unique<TransformComponent>(*this);
+            pClone->SetOwner(pOwner);
+            return pClone;
+        }
 
         LUA_REGISTER();
 
@@ -67,6 +75,10 @@ namespace Bel
         const int GetSpeed() { return m_speed; }
         void SetSpeed(int speed) { m_speed = speed; }
 
+    private:
+        // Both Initialize() overloads, XMLElement and compiled elements answer the same queries.
+        template <class Element>
+        bool InitializeFrom(const Element* pData);
     };
 
     class IStaticBodyComponent : public IActorComponent
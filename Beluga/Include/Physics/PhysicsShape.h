@@ -1,6 +1,7 @@
 #pragma once
 #include <memory>
 #include "Parshing/tinyxml2.h"
+#include "Actors/ActorDefinition.h"
 
 namespace Bel
 {
@@ -29,7 +30,8 @@ namespace Bel
     public:
         IPhysicalShape() {}
         virtual ~IPhysicalShape() = 0 {}
-        virtual void Initialize(tinyxml2::XMLElement* pData) = 0;
+        virtual void Initialize(const tinyxml2::XMLElement* pData) = 0;
+        virtual void Initialize(const ActorDefinition::Element* pData) = 0;
         virtual void SetThisToFixture(IFixtureDef* pFixture) = 0;
 
         virtual float GetDensity()  = 0;
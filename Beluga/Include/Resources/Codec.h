@@ -0,0 +1,146 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace Bel
+{
+    /// Class Description
+    ///
+    /// Compression scheme of a single pack entry. The id is written to disk in Pack::Entry::m_codec,
+    /// so an id must never be reused for a different format.
+    class ICodec
+    {
+    public:
+        virtual ~ICodec() = 0 {}
+        virtual uint16_t GetId() const = 0;
+        virtual const char* GetName() const = 0;
+
+        // Fails when the output would not be smaller than the input.
+        virtual bool Compress(const char* pSrc, size_t srcSize, std::vector<char>& out) const = 0;
+
+        // pDest must be exactly the uncompressed size. Thread safe.
+        virtual bool Decompress(const char* pSrc, size_t srcSize, char* pDest, size_t destSize) const = 0;
+    };
+
+    class StoredCodec : public ICodec
+    {
+    public:
+        virtual uint16_t GetId() const override;
+        virtual const char* GetName() const override { return "stored"; }
+        virtual bool Compress(const char* pSrc, size_t srcSize, std::vector<char>& out) const override;
+        virtual bool Decompress(const char* pSrc, size_t srcSize, char* pDest, size_t destSize) const override;
+    };
+
+    class ZlibCodec : public ICodec
+    {
+    public:
+        virtual uint16_t GetId() const override;
+        virtual const char* GetName() const override { return "zlib"; }
+        virtual bool Compress(const char* pSrc, size_t srcSize, std::vector<char>& out) const override;
+        virtual bool Decompress(const char* pSrc, size_t srcSize, char* pDest, size_t destSize) const override;
+    };
+
+    /// Class Description
+    ///
+    /// Byte oriented LZ77 in the LZ4 block layout: a token with literal and match lengths,
+    /// the literals, then a 16 bit offset. No entropy stage, so decoding is mostly memcpy.
+    class LzCodec : public ICodec
+    {
+    public:
+        virtual uint16_t GetId() const override;
+        virtual const char* GetName() const override { return "lz"; }
+        virtual bool Compress(const char* pSrc, size_t srcSize, std::vector<char>& out) const override;
+        virtual bool Decompress(const char* pSrc, size_t srcSize, char* pDest, size_t destSize) const override;
+    };
+
+    /// Class Description
+    ///
+    /// Raw deflate primed with a dictionary shared by every small entry of one asset type, so even
+    /// a tiny XML file finds its tags to match against. Without a dictionary it is plain raw deflate.
+    class ZlibDictionaryCodec : public ICodec
+    {
+    public:
+        static constexpr size_t kMaxDictionarySize = 32 * 1024;    // Deflate never looks further back.
+
+    private:
+        std::string_view m_dictionary;
+
+    public:
+        ZlibDictionaryCodec() {}
+        explicit ZlibDictionaryCodec(std::string_view dictionary) : m_dictionary(dictionary) {}
+
+        virtual uint16_t GetId() const override;
+        virtual const char* GetName() const override { return "zlib+dictionary"; }
+        virtual bool Compress(const char* pSrc, size_t srcSize, std::vector<char>& out) const override;
+        virtual bool Decompress(const char* pSrc, size_t srcSize, char* pDest, size_t destSize) const override;
+    };
+
+    /// Class Description
+    ///
+    /// Splits an entry into fixed size blocks that another codec compresses one by one, so any
+    /// byte range decodes without the blocks in front of it and the blocks decode in parallel.
+    /// Layout: [Header][uint32_t end offset of every block, relative to the first one][blocks ...]
+    /// A block that does not shrink is stored, which its compressed size equalling its size tells.
+    class BlockCodec : public ICodec
+    {
+    public:
+        static constexpr uint32_t kDefaultBlockSize = 256 * 1024;
+
+        struct Header
+        {
+            uint32_t m_blockSize;
+            uint32_t m_numBlocks;
+        };
+
+        // Where the blocks of one compressed entry are. Only points into the compressed data.
+        class Index
+        {
+        private:
+            const char* m_pEnds;
+            const char* m_pBlocks;
+            uint64_t m_size;
+            uint32_t m_blockSize;
+            uint32_t m_numBlocks;
+
+        public:
+            Index() : m_pEnds(nullptr), m_pBlocks(nullptr), m_size(0), m_blockSize(0), m_numBlocks(0) {}
+
+            // False if the data is not a block layout that decodes to size bytes.
+            bool Read(const char* pSrc, size_t srcSize, uint64_t size);
+
+            uint32_t GetNumBlocks() const { return m_numBlocks; }
+            uint32_t GetBlockSize() const { return m_blockSize; }
+            uint64_t GetBlockStart(uint32_t block) const { return static_cast<uint64_t>(block) * m_blockSize; }
+            size_t GetDecodedSize(uint32_t block) const;
+            void GetCompressed(uint32_t block, const char*& pData, size_t& size) const;
+        };
+
+    private:
+        const ICodec& m_inner;
+        uint32_t m_blockSize;
+
+    public:
+        explicit BlockCodec(const ICodec& inner, uint32_t blockSize = kDefaultBlockSize) : m_inner(inner), m_blockSize(blockSize) {}
+
+        // The inner codec's, blocked entries are told apart by Pack::kFlagBlocks.
+        virtual uint16_t GetId() const override { return m_inner.GetId(); }
+        virtual const char* GetName() const override { return "blocks"; }
+        virtual bool Compress(const char* pSrc, size_t srcSize, std::vector<char>& out) const override;
+
+        // Every block in turn, see DecompressBlock() to spread them over threads.
+        virtual bool Decompress(const char* pSrc, size_t srcSize, char* pDest, size_t destSize) const override;
+
+        // Writes Index::GetDecodedSize(block) bytes. Thread safe.
+        bool DecompressBlock(const Index& index, uint32_t block, char* pDest) const;
+    };
+
+    // Picks the byte runs that the most samples share, up to capacity bytes.
+    // The most useful ones go last, where deflate reaches them with the shortest distances.
+    std::vector<char> TrainDictionary(const std::vector<std::string_view>& samples, size_t capacity = ZlibDictionaryCodec::kMaxDictionarySize);
+
+    // Codec registered for a Pack::Codec id, nullptr if unknown.
+    // The one for Pack::kCodecZlibDictionary has no dictionary, construct a ZlibDictionaryCodec to decode those.
+    const ICodec* GetCodec(uint16_t id);
+}
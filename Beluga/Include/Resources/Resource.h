@@ -1,17 +1,30 @@
 #pragma once
 #include <string.h>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <cstdint>
 #include <vector>
 #include <unordered_map>
 #include <map>
 #include <fstream>
 #include <memory>
 #include <list>
+#include <deque>
+#include <unordered_set>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
 
 #if defined(_WIN32)
 #include <Windows.h>
 #endif
 
 #include "Parshing/tinyxml2.h"
+#include "Core/Util/ThreadPool.h"
+#include "Resources/ResourceStream.h"
+#include "Resources/Codec.h"
 
 namespace Bel
 {
@@ -20,6 +33,7 @@ namespace Bel
     **********************************************************************************************/
     class ResourceCache;
     class ResourceHandle;
+    class ICodec;
 
     class IResourceLoader
     {
@@ -44,18 +58,153 @@ namespace Bel
         virtual bool LoadResource(char* pRawBuffer, unsigned int rawSize, std::shared_ptr<ResourceHandle> pHandle) override;
     };
 
+    /// Class Description
+    ///
+    /// Registered loaders, compiled once so that picking one for a name never allocates.
+    /// "*.ext" patterns are found through a table keyed by extension, anything else
+    /// (exact names, suffixes, general wildcards) is tried in priority order.
+    /// The most recently registered loader wins when several patterns match.
+    class ResourceLoaderTable
+    {
+    private:
+        enum class PatternKind
+        {
+            kExact,         // "player.xml"
+            kSuffix,        // "*_normal.png", "*"
+            kWildcard       // Anything with '?' or a '*' that is not leading.
+        };
+
+        struct CompiledLoader
+        {
+            std::string m_pattern;
+            std::string m_literal;      // The name for kExact, the suffix for kSuffix.
+            PatternKind m_kind;
+            size_t m_priority;
+            std::shared_ptr<IResourceLoader> m_pLoader;
+        };
+
+        // "*.ext" loaders, m_literal holds the extension without the dot.
+        std::vector<CompiledLoader> m_byExtension;
+        std::unordered_map<size_t, size_t> m_extensions;    // Extension hash -> index into m_byExtension.
+
+        // Every other pattern, highest priority first.
+        std::vector<CompiledLoader> m_others;
+        size_t m_nextPriority;
+
+    public:
+        ResourceLoaderTable() : m_nextPriority(0) {}
+
+        void Register(std::shared_ptr<IResourceLoader> pLoader);
+        std::shared_ptr<IResourceLoader> Find(std::string_view name) const;
+
+        // '*' matches any run of characters, '?' exactly one.
+        static bool MatchWildcard(std::string_view name, std::string_view pattern);
+    };
+
+    /// Class Description
+    ///
+    /// Which resources need which (level -> tileset -> texture, actor -> script, ...).
+    /// The packer records it for every XML file it packs, loaders and game code may add to it.
+    /// Paths are pack paths: lower case with forward slashes.
+    class ResourceDependencyGraph
+    {
+    private:
+        std::unordered_map<std::string, std::vector<std::string>> m_dependencies;
+
+    public:
+        void AddDependency(const std::string& parent, const std::string& child);
+        void Clear() { m_dependencies.clear(); }
+        bool IsEmpty() const { return m_dependencies.empty(); }
+        const std::unordered_map<std::string, std::vector<std::string>>& GetDependencies() const { return m_dependencies; }
+
+        // The root followed by everything it needs, each path once.
+        std::vector<std::string> GetGroup(const std::string& root) const;
+
+        // One tab separated "parent child" pair per line, sorted so the same graph always gives the same text.
+        std::string Serialize() const;
+        void Deserialize(std::string_view text);
+    };
+
+    // Where the packer stores the graph inside a pack.
+    constexpr const char* kDependencyTablePath = ".beluga/dependencies";
+    // Followed by an extension, the shared compression dictionary for small entries of that type.
+    constexpr const char* kDictionaryPathPrefix = ".beluga/dictionaries/";
+
+    // FNV-1a over the normalized path (lower case, forward slashes), so that lookups never build a string.
+    constexpr uint64_t HashResourcePath(const char* pPath, size_t length)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < length; ++i)
+        {
+            char c = pPath[i];
+            if (c >= 'A' && c <= 'Z')
+                c = static_cast<char>(c - 'A' + 'a');
+            else if (c == '\\')
+                c = '/';
+
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    inline uint64_t HashResourcePath(const std::string& path) { return HashResourcePath(path.c_str(), path.size()); }
+
+    /// Class Description
+    ///
+    /// What the pack table, the resource files and the cache key resources by: the path hash,
+    /// computed once. Literal paths hash at compile time:
+    ///     static constexpr ResourceId kPlayer("Actors/Player.xml");
+    class ResourceId
+    {
+    private:
+        uint64_t m_hash;
+
+    public:
+        constexpr ResourceId() : m_hash(0) {}
+        constexpr explicit ResourceId(std::string_view path) : m_hash(HashResourcePath(path.data(), path.size())) {}
+        static constexpr ResourceId FromHash(uint64_t hash) { ResourceId id; id.m_hash = hash; return id; }
+
+        constexpr uint64_t GetHash() const { return m_hash; }
+        constexpr bool operator==(const ResourceId& rhs) const { return m_hash == rhs.m_hash; }
+        constexpr bool operator!=(const ResourceId& rhs) const { return m_hash != rhs.m_hash; }
+    };
+}
+
+namespace std
+{
+    // Already a hash, nothing left to mix.
+    template <>
+    struct hash<Bel::ResourceId>
+    {
+        size_t operator()(Bel::ResourceId id) const { return static_cast<size_t>(id.GetHash()); }
+    };
+}
+
+namespace Bel
+{
+
     class Resource
     {
     private:
-        std::string m_name;
+        std::string m_name;     // For loader patterns and log messages, lookups go by m_id.
+        ResourceId m_id;
 
     public:
         Resource(const std::string& name)
             : m_name(name)
+            , m_id(name)
+        {
+        }
+
+        Resource(const std::string& name, ResourceId id)
+            : m_name(name)
+            , m_id(id)
         {
         }
 
         const std::string& GetName() const { return m_name; }
+        ResourceId GetId() const { return m_id; }
     };
 
     class IResourceExtraData
@@ -65,6 +214,14 @@ namespace Bel
         virtual std::string ToString() = 0;
     };
 
+    // What a resource file read and decoded, for telling I/O stalls from decompression stalls.
+    struct ResourceFileStats
+    {
+        uint64_t m_bytesRead = 0;           // Entry bytes as they are stored in the file.
+        uint64_t m_bytesInflated = 0;       // Output of a codec, stored entries don't count.
+        uint64_t m_decodeMicroseconds = 0;  // Summed over the loader threads.
+    };
+
     class IResourceFile
     {
     protected:
@@ -77,51 +234,301 @@ namespace Bel
         virtual std::shared_ptr<ResourceHandle> LoadResource(const std::string& path) = 0;
         virtual size_t GetRawResourceSize(const Resource& resource) = 0;
         void SetResourceCache(ResourceCache* pCache) { m_pCache = pCache; }
+
+        // What the cache calls. Files that index by ResourceId look it up without hashing the
+        // name again, by default it is loaded by name.
+        virtual std::shared_ptr<ResourceHandle> LoadResource(const Resource& resource) { return LoadResource(resource.GetName()); }
+
+        // Reads the resource without decoding all of it up front. By default it is loaded whole.
+        virtual std::unique_ptr<IResourceStream> OpenStream(const std::string& path);
+
+        // Paths with the same non zero id hold identical bytes, the cache decodes them once.
+        // 0 when unknown, which is the default.
+        virtual uint64_t GetContentId(ResourceId /*id*/) const { return 0; }
+
+        // Thread safe. Empty unless the file keeps track.
+        virtual ResourceFileStats GetStats() const { return ResourceFileStats(); }
+
+        // Threads the owner lends for decoding one resource in parallel, nullptr to stop using them.
+        // Ignored by files that decode serially.
+        virtual void SetWorkerThreads(ThreadPool* /*pThreads*/) {}
+
+        // Every path the file holds, for merging it with others. Empty if it can't list them.
+        virtual std::vector<std::string> GetResourceNames() const { return std::vector<std::string>(); }
     };
     
+    // FNV-1a over raw bytes, used to tell whether the content of a resource changed.
+    inline uint64_t HashResourceData(const char* pData, size_t size)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= static_cast<uint8_t>(pData[i]);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    /// Class Description
+    ///
+    /// Read-only view of a whole file mapped into the address space.
+    class MappedFile
+    {
+    private:
+        const char* m_pData;
+        size_t m_size;
+
+#if defined(_WIN32)
+        HANDLE m_file;
+        HANDLE m_mapping;
+#else
+        int m_file;
+#endif
+
+    public:
+        MappedFile();
+        MappedFile(const MappedFile& src) = delete;
+        MappedFile& operator=(const MappedFile& rhs) = delete;
+        ~MappedFile();
+
+        bool Open(const std::string& path);
+        void Close();
+
+        bool IsOpen()           const { return m_pData != nullptr; }
+        const char* GetData()   const { return m_pData; }
+        size_t GetSize()        const { return m_size; }
+    };
+
+    /// Binary pack layout (version 2)
+    ///
+    /// [entry data ...][PackEntry * count, sorted by hash][name table][PackFooter]
+    ///
+    /// The footer is read first, then the entry table is used straight out of the mapping.
+    /// Version 1 packs (XML header followed by its size) are still readable.
+    namespace Pack
+    {
+        constexpr uint32_t kMagic = 0x4B415042;    // "BPAK"
+        constexpr uint32_t kVersion = 2;
+
+        enum Codec : uint16_t
+        {
+            kCodecStored,
+            kCodecZlib,
+            kCodecLz,
+            kCodecZlibDictionary,   // Against the stored entry at ZlibFile::GetDictionaryPath() of its name.
+            kCodecCount
+        };
+
+        enum Flags : uint16_t
+        {
+            kFlagBlocks = 1 << 0,   // BlockCodec layout around m_codec, decodes in parallel and by range.
+        };
+
+        struct Entry
+        {
+            uint64_t m_hash;
+            uint64_t m_offset;
+            uint32_t m_compressed;
+            uint32_t m_size;
+            uint32_t m_nameOffset;  // Into the name table, only used by tools and debugging.
+            uint16_t m_codec;
+            uint16_t m_flags;
+        }; // 32 bytes
+
+        struct Footer
+        {
+            uint64_t m_tocOffset;
+            uint64_t m_namesOffset;
+            uint32_t m_namesSize;
+            uint32_t m_numEntries;
+            uint32_t m_version;
+            uint32_t m_magic;       // Last, so it sits where a version 1 pack keeps its header size.
+        }; // 32 bytes
+
+        static_assert(sizeof(Entry) == 32, "Pack::Entry is read straight from disk");
+        static_assert(sizeof(Footer) == 32, "Pack::Footer is read straight from disk");
+    }
+
     class ZlibFile
     {
+    public:
+        // One compressed input. Built by CompressResource() on any thread, then handed to AddCompressedResource().
+        struct CompressedResource
+        {
+            std::string m_path;
+            std::vector<char> m_data;
+            uint32_t m_size;
+            uint16_t m_codec;
+            uint64_t m_contentHash;     // Of the uncompressed data, identical inputs share one blob.
+            uint16_t m_flags = 0;
+        };
+
     private:
         struct ResourceInfo
         {
             uint32_t m_compressed;
             uint32_t m_size;
-            uint32_t m_offset;
+            uint64_t m_offset;
+            uint16_t m_codec;
+            uint16_t m_flags;
+            bool m_retained;        // Data still lives in the pack opened by OpenForUpdate().
+        };
+        struct AddedBlob
+        {
+            ResourceInfo m_info;
+            std::string m_path;     // The first one added, it picked the dictionary.
         };
         std::unordered_map<std::string, ResourceInfo> m_info;
+        std::unordered_map<uint64_t, AddedBlob> m_addedBlobs;   // Content hash -> blob added since the last save.
 
-        uint32_t m_currentOffset;
+        uint64_t m_currentOffset;
         std::vector<std::vector<char>> m_pendingData;
-        std::fstream m_file;
         ResourceCache* m_pCache;
 
+        // --- Version 2 ---
+        std::shared_ptr<MappedFile> m_pMapping;    // Shared with the handles and streams that point into it.
+        const Pack::Entry* m_pEntries;
+        const char* m_pNames;
+        uint32_t m_numEntries;
+        uint64_t m_dataSize;        // Bytes of entry data in front of the table.
+        uint64_t m_packSize;        // The whole file, table and footer included.
+
+        // --- Update ---
+        bool m_updating;
+        float m_compactRatio;
+
+        // --- Statistics, updated by the loader threads ---
+        std::atomic<uint64_t> m_bytesRead;
+        std::atomic<uint64_t> m_bytesInflated;
+        std::atomic<uint64_t> m_decodeMicroseconds;
+
+        // --- Blocked entries ---
+        ThreadPool* m_pBlockThreads;    // Lent by the owner to help the loading thread, may be nullptr.
+
+        // --- Version 1 ---
+        std::fstream m_file;
+        std::mutex m_fileMutex;     // Guards seek + read, LoadResource is called from the loader threads.
+
     public:
         ZlibFile()
             : m_currentOffset(0)
             , m_pCache(nullptr)
+            , m_pEntries(nullptr)
+            , m_pNames(nullptr)
+            , m_numEntries(0)
+            , m_dataSize(0)
+            , m_packSize(0)
+            , m_updating(false)
+            , m_compactRatio(0.f)
+            , m_bytesRead(0)
+            , m_bytesInflated(0)
+            , m_decodeMicroseconds(0)
+            , m_pBlockThreads(nullptr)
         {
         }
 
+        // Lower case with forward slashes, the form every entry is stored under.
+        static std::string NormalizePath(std::string path);
+
+        // Entries from this size on are split into independently compressed blocks.
+        static constexpr size_t kMinBlockedEntrySize = 1024 * 1024;
+
+        // Entries up to this size are also tried against their type's dictionary.
+        static constexpr size_t kMaxDictionaryEntrySize = 16 * 1024;
+
+        // Where the dictionary for path's type is stored, empty if the path has no extension.
+        static std::string GetDictionaryPath(const std::string& path);
+
+        // Thread safe, it only touches its arguments. The dictionary (usually the one at
+        // GetDictionaryPath()) must have been added to the pack as a stored entry.
+        static CompressedResource CompressResource(std::string path, std::vector<char> data, std::string_view dictionary = std::string_view());
+
         void AddResource(std::string path, std::vector<char> data);
+        // A resource whose data matches one already added only gets a table entry pointing at that blob.
+        void AddCompressedResource(CompressedResource resource);
+
+        // Points path at target's blob, e.g. when the packer finds a changed file now matches one kept in the pack.
+        // False if there is no target, or its blob was compressed against another type's dictionary.
+        bool AddAlias(const std::string& path, const std::string& target);
         std::shared_ptr<ResourceHandle> LoadResource(std::string path);
-        void Save(const std::string& path);
+        std::shared_ptr<ResourceHandle> LoadResource(const Resource& resource);
+
+        // Stored entries are read straight from the mapping and zlib ones are inflated a window at
+        // a time. Streams keep the mapping alive.
+        std::unique_ptr<IResourceStream> OpenStream(std::string path, size_t windowSize = InflateResourceStream::kDefaultWindowSize);
+
+        // Copies [offset, offset + size) of the decoded entry. A blocked entry only decodes the blocks
+        // that cover the range, e.g. one chunk of a huge level. Anything else is decoded whole first.
+        bool ReadRange(const std::string& path, uint64_t offset, char* pDest, size_t size);
+
+        // False if the pack could not be written. Two paths with the same hash are found before
+        // anything is written, the file is left alone and the added resources are kept.
+        bool Save(const std::string& path);
         bool Load(const std::string& path);
         void SetCache(ResourceCache* pCache) { m_pCache = pCache; }
+
+        // Shared with the owner's other work, e.g. the cache's loader threads. Blocked entries
+        // decode on the calling thread alone while there is none.
+        void SetBlockThreads(ThreadPool* pThreads) { m_pBlockThreads = pThreads; }
+
+        // ===== Incremental packing =====
+        // Opens an existing version 2 pack so that Save() only appends the added entries and a new table,
+        // the old one stays behind as dead data. Once more than compactRatio of the entry data is dead,
+        // Save() compacts the whole pack into a temporary file instead, which then replaces it.
+        bool OpenForUpdate(const std::string& path, float compactRatio = 0.25f);
+        bool RemoveResource(const std::string& path);
+        std::vector<std::string> GetResourceNames() const;
+        uint64_t GetDeadBytes() const;
+
+        // Returns nullptr for version 1 packs or unknown paths.
+        const Pack::Entry* FindEntry(const std::string& path) const { return FindEntry(ResourceId(path)); }
+        const Pack::Entry* FindEntry(ResourceId id) const;
+        const char* GetEntryName(const Pack::Entry& entry) const { return m_pNames + entry.m_nameOffset; }
+
+        // Identifies the blob behind path, aliases of the same data get the same id. 0 if unknown or empty.
+        uint64_t GetContentId(ResourceId id) const;
+
+        // Streams count their whole entry as read when they are opened.
+        ResourceFileStats GetStats() const;
+        size_t GetNumResources() const { return (m_pEntries != nullptr && !m_updating) ? m_numEntries : m_info.size(); }
+
+    private:
+        bool LoadMapped(const std::string& path);
+        bool LoadLegacy(const std::string& path);
+        std::shared_ptr<ResourceHandle> LoadLegacyResource(std::string path);
+
+        bool Decode(const ICodec& codec, const char* pSrc, size_t srcSize, char* pDest, size_t destSize);
+        // Blocks [first, last) of a blocked entry into pDest, which starts at block first.
+        // Spread over m_pBlockThreads when there are several, the calling thread takes part.
+        bool DecodeBlocks(const BlockCodec& codec, const BlockCodec::Index& index, uint32_t first, uint32_t last, char* pDest);
+        // Points into the mapping, nullptr data if the entry's dictionary is missing.
+        std::string_view FindDictionary(const Pack::Entry& entry) const;
+
+        bool SaveUpdate(const std::string& path);
+        // False, and both paths are logged, if two paths share a hash.
+        bool CheckPathHashes() const;
+        bool WriteTable(std::ostream& out, uint64_t tocOffset);
+        void Reset();
     };
 
 #if defined(_WIN32) == false
-    using DWORD = unsigned long;
-    using WORD = unsigned short;
+    using DWORD = uint32_t;
+    using WORD = uint16_t;
 #endif
 
+    /// Class Description
+    ///
+    /// Read only access to a zip archive (mod packs and the like). The central directory is read once
+    /// and indexed by path hash, so Find() never allocates. ReadFile() is thread safe: every reader
+    /// takes its own file handle and compressed data buffer from a pool, so the cache's loader
+    /// threads inflate several entries at once.
     class ZipFile
     {
     public:
-        using ZipContentsMap = std::map<std::string, int>;
-
+#pragma pack(push, 1)
         struct ZipLocalHeader
         {
-            enum { SIGNATURE = 0xbb63938b };
+            enum { SIGNATURE = 0x04034b50 };
             DWORD m_signature;
             WORD  m_version;
             WORD  m_flag;
@@ -136,7 +543,7 @@ namespace Bel
         };
         struct ZipDirHeader
         {
-            enum { SIGNATURE = 0x59490b02 };
+            enum { SIGNATURE = 0x06054b50 };
             DWORD   m_signature;
             WORD    m_disk;
             WORD    m_startDisk;
@@ -148,7 +555,7 @@ namespace Bel
         };
         struct ZipDirFileHeader
         {
-            enum { SIGNATURE = 0x870e15e5 };
+            enum { SIGNATURE = 0x02014b50 };
             DWORD   m_signature;
             WORD    m_verMade;
             WORD    m_verNeeded;
@@ -164,36 +571,71 @@ namespace Bel
             WORD    m_cmntLen;
             WORD    m_diskStart;
             WORD    m_intAttr;
-            WORD    m_extAttr;
+            DWORD   m_extAttr;
             DWORD   m_hdrOffset;
 
             char* GetName()    { return reinterpret_cast<char*>(this + 1); }
             char* GetExtra()   { return GetName() + m_fNameLen; }
             char* GetComment() { return GetExtra() + m_extraLen; }
         };
+#pragma pack(pop)
+
+        static_assert(sizeof(ZipLocalHeader) == 30, "ZipLocalHeader is read straight from the archive");
+        static_assert(sizeof(ZipDirHeader) == 22, "ZipDirHeader is read straight from the archive");
+        static_assert(sizeof(ZipDirFileHeader) == 46, "ZipDirFileHeader is read straight from the archive");
 
     private:
-        ZipContentsMap m_contentsMap;
+        struct IndexSlot
+        {
+            uint64_t m_hash;
+            int m_entry;        // -1 when the slot is empty.
+        };
+
+        // Open addressing over HashResourcePath(), a power of two in size and at most half full.
+        std::vector<IndexSlot> m_index;
 
-        FILE* m_pFile;
-        std::string m_dirData;
+        std::string m_fileName;
+        std::vector<char> m_dirData;
         int m_numEntries;
 
         std::vector<ZipDirFileHeader*> m_dirs;
 
+        // --- Pools, shared by the reading threads ---
+        std::vector<FILE*> m_freeFiles;
+        std::vector<std::vector<char>> m_freeBuffers;
+        std::mutex m_poolMutex;
+
     public:
         ZipFile();
+        ZipFile(const ZipFile& src) = delete;
+        ZipFile& operator=(const ZipFile& rhs) = delete;
         virtual ~ZipFile();
 
         bool Initialize(const std::string& fileName);
         void End();
 
+        // pBuffer must hold GetFileLength(i) bytes.
         bool ReadFile(int i, void* pBuffer);
         std::string GetFileName(int index) const;
         int GetNumFiles() const { return m_numEntries; }
+
+        // Reads and inflates in 128 KB steps. The callback gets the progress in percent and may cancel.
         bool ReadLargeFile(int i, void* pBuffer, void(*ProgressCallback)(int, bool&));
-        int Find(const std::string& path) const;
+
+        // Case and slash insensitive, -1 if the archive has no such file.
+        int Find(const std::string& path) const { return Find(ResourceId(path)); }
+        int Find(ResourceId id) const;
         int GetFileLength(int i) const;
+
+    private:
+        FILE* AcquireFile();
+        void ReleaseFile(FILE* pFile);
+        std::vector<char> AcquireBuffer(size_t size);
+        void ReleaseBuffer(std::vector<char> buffer);
+
+        // Leaves pFile at the first byte of entry i's data.
+        bool SeekToData(FILE* pFile, int i) const;
+        bool ReadDirectory(FILE* pFile);
     };
 
     class ResourceZipFile : public IResourceFile
@@ -210,6 +652,9 @@ namespace Bel
         virtual bool Open();
         virtual size_t GetRawResourceSize(const Resource& resource) override;
         virtual int GetNumResources() const override;
+        virtual std::shared_ptr<ResourceHandle> LoadResource(const std::string& path) override;
+        virtual std::shared_ptr<ResourceHandle> LoadResource(const Resource& resource) override;
+        virtual std::vector<std::string> GetResourceNames() const override;
         //virtual int GetRawResource(const Resource& resource, char* pBuffer) override;
         //virtual std::string GetResourceName(int num) const override;
     };
@@ -227,7 +672,82 @@ namespace Bel
         // Inherited via IResourceFile
         virtual int GetNumResources() const override;
         virtual std::shared_ptr<ResourceHandle> LoadResource(const std::string& path) override;
+        virtual std::shared_ptr<ResourceHandle> LoadResource(const Resource& resource) override;
+        virtual size_t GetRawResourceSize(const Resource& resource) override;
+        virtual std::unique_ptr<IResourceStream> OpenStream(const std::string& path) override;
+        virtual uint64_t GetContentId(ResourceId id) const override;
+        virtual ResourceFileStats GetStats() const override;
+        virtual void SetWorkerThreads(ThreadPool* pThreads) override;
+        virtual std::vector<std::string> GetResourceNames() const override;
+    };
+
+    /// Class Description
+    ///
+    /// Loose files under a directory, for iterating on assets without repacking.
+    /// The file list is read by Open(), the files themselves on every load, so edits show up
+    /// as soon as the cache lets go of the old handle. New files need another Open().
+    class ResourceDirectoryFile : public IResourceFile
+    {
+    private:
+        std::string m_rootPath;
+        std::unordered_map<ResourceId, std::string> m_files;    // Path on disk.
+        std::vector<std::string> m_names;                       // Pack paths, for GetResourceNames().
+
+    public:
+        ResourceDirectoryFile(const std::string& rootPath);
+
+        // Inherited via IResourceFile
+        virtual bool Open() override;
+        virtual int GetNumResources() const override { return static_cast<int>(m_files.size()); }
+        virtual std::shared_ptr<ResourceHandle> LoadResource(const std::string& path) override { return LoadResource(Resource(path)); }
+        virtual std::shared_ptr<ResourceHandle> LoadResource(const Resource& resource) override;
+        virtual size_t GetRawResourceSize(const Resource& resource) override;
+        virtual std::vector<std::string> GetResourceNames() const override { return m_names; }
+    };
+
+    /// Class Description
+    ///
+    /// An ordered stack of resource files the cache sees as one: base pack, DLC, patch, loose files.
+    /// Later layers shadow earlier ones, so a patch pack only has to carry what changed.
+    /// Open() merges every layer's paths into one hash index, after that a lookup never
+    /// touches the layers that don't hold the path.
+    class LayeredResourceFile : public IResourceFile
+    {
+    private:
+        std::vector<std::unique_ptr<IResourceFile>> m_layers;   // Bottom first.
+        std::unordered_map<ResourceId, uint32_t> m_index;       // Layer that serves the path.
+        ThreadPool* m_pWorkerThreads;                           // Lent to every layer, mounted later too.
+        bool m_isOpen;
+
+    public:
+        LayeredResourceFile() : m_pWorkerThreads(nullptr), m_isOpen(false) {}
+
+        // Goes on top of the stack. After Open() the layer is opened and indexed right away,
+        // which must not happen while loads are in flight.
+        bool Mount(std::unique_ptr<IResourceFile> pLayer);
+        size_t GetNumLayers() const { return m_layers.size(); }
+
+        // Index of the layer that serves path, -1 if none does.
+        int FindLayer(ResourceId id) const;
+        int FindLayer(const std::string& path) const { return FindLayer(ResourceId(path)); }
+
+        // Inherited via IResourceFile
+        // Every layer has to open. The dependency tables of the layers are merged: each path keeps the
+        // dependencies recorded by the layer that serves it.
+        virtual bool Open() override;
+        virtual int GetNumResources() const override { return static_cast<int>(m_index.size()); }
+        virtual std::shared_ptr<ResourceHandle> LoadResource(const std::string& path) override { return LoadResource(Resource(path)); }
+        virtual std::shared_ptr<ResourceHandle> LoadResource(const Resource& resource) override;
         virtual size_t GetRawResourceSize(const Resource& resource) override;
+        virtual std::unique_ptr<IResourceStream> OpenStream(const std::string& path) override;
+        virtual uint64_t GetContentId(ResourceId id) const override;
+        virtual ResourceFileStats GetStats() const override;
+        virtual void SetWorkerThreads(ThreadPool* pThreads) override;
+        virtual std::vector<std::string> GetResourceNames() const override;
+
+    private:
+        void IndexLayer(uint32_t layer);
+        std::shared_ptr<ResourceHandle> LoadDependencyTable();
     };
 
     class ResourceHandle
@@ -238,64 +758,260 @@ namespace Bel
     protected:
         Resource m_resource;
         std::vector<char> m_data;
+        std::string_view m_view;                // What GetData() returns, either m_data or memory owned by m_pViewOwner.
+        std::shared_ptr<const void> m_pViewOwner;
         std::shared_ptr<IResourceExtraData> m_extra;
         ResourceCache* m_pResCache;
 
+        // --- Cache bookkeeping, owned by ResourceCache ---
+        // Only a cached handle that is neither pinned nor leased is on the LRU list.
+        ResourceHandle* m_pLruPrev;     // Towards the most recently used end.
+        ResourceHandle* m_pLruNext;     // Towards the least recently used end.
+        size_t m_chargedSize;           // Bytes counted against the cache budget, 0 when not cached.
+        unsigned int m_pinCount;
+        bool m_isCached;
+        std::weak_ptr<ResourceHandle> m_pLease;     // What every user shares while it is handed out.
+
     public:
         ResourceHandle(const Resource& resource, std::vector<char> data);
         ResourceHandle(const Resource& resource, std::vector<char> data, ResourceCache* pResCache);
+
+        // Non-owning, e.g. a stored entry in a mapped pack. pOwner keeps that memory alive.
+        ResourceHandle(const Resource& resource, std::string_view view, std::shared_ptr<const void> pOwner, ResourceCache* pResCache);
         virtual ~ResourceHandle();
 
-        size_t GetSize()            const    { return m_data.size(); }
+        size_t GetSize()            const    { return m_view.size(); }
         std::string GetName()       const    { return m_resource.GetName(); }
-        std::vector<char>& GetData()         { return m_data; }
+        ResourceId GetId()          const    { return m_resource.GetId(); }
+        std::string_view GetData()  const    { return m_view; }
+
+        // Heap bytes held by the handle, 0 for a view.
+        size_t GetMemorySize()      const    { return m_data.size(); }
 
         std::shared_ptr<IResourceExtraData> GetExtra()           { return m_extra; }
         void SetExtra(std::shared_ptr<IResourceExtraData> extra) { m_extra = extra; }
+
+        bool IsPinned()             const    { return m_pinCount > 0; }
+    };
+
+
+    /// Class Description
+    ///
+    /// Load times of one loader in power of two buckets: bucket i counts the loads that took
+    /// [2^i, 2^(i+1)) microseconds, the first one also everything quicker and the last one everything slower.
+    struct LoadLatencyHistogram
+    {
+        static constexpr size_t kNumBuckets = 24;   // The last one starts at ~8 s.
+
+        uint32_t m_counts[kNumBuckets] = {};
+        uint32_t m_numLoads = 0;
+        uint64_t m_totalMicroseconds = 0;
+        uint64_t m_maxMicroseconds = 0;
+
+        void Add(uint64_t microseconds);
     };
 
+    struct ResourceCacheStats
+    {
+        uint64_t m_hits = 0;
+        uint64_t m_misses = 0;
+        uint64_t m_evictions = 0;
+        size_t m_bytesResident = 0;
+        size_t m_peakBytesResident = 0;
+        ResourceFileStats m_file;
+    };
 
     constexpr unsigned int kCacheSize = 1024;
     class ResourceCache
     {
     public:
-        using ResourceHandleList = std::list<std::shared_ptr<ResourceHandle>>;
-        using ResourceHandleMap = std::map<std::string, std::shared_ptr<ResourceHandle>>;
-        using ResourceLoaders = std::list<std::shared_ptr<IResourceLoader>>;
+        using ResourceHandleMap = std::unordered_map<ResourceId, std::shared_ptr<ResourceHandle>>;
+
+        // Invoked on the main thread from ProcessAsyncLoads(), pHandle is nullptr when the load failed.
+        using AsyncLoadCallback = std::function<void(std::shared_ptr<ResourceHandle> pHandle)>;
+        using PendingLoadMap = std::unordered_map<ResourceId, std::vector<AsyncLoadCallback>>;
+        struct CompletedLoad
+        {
+            Resource m_resource;
+            std::shared_ptr<ResourceHandle> m_pHandle;
+            uint64_t m_microseconds;
+            bool m_fromFile;            // False when it was answered from the cache.
+        };
+        using CompletedLoadList = std::vector<CompletedLoad>;
+
+        // Name and request count or decoded bytes.
+        using ResourceRanking = std::vector<std::pair<std::string, uint64_t>>;
+
+        // Invoked once every member of the group finished loading, false if any of them failed.
+        using GroupLoadCallback = std::function<void(bool success)>;
 
     protected:
-        ResourceHandleList m_lru;
+        struct ResourceGroup
+        {
+            std::vector<std::shared_ptr<ResourceHandle>> m_handles;
+            std::vector<GroupLoadCallback> m_callbacks;
+            size_t m_numPending;
+            bool m_failed;
+        };
+        using ResourceGroupMap = std::unordered_map<std::string, ResourceGroup>;
+
+        struct ResourceUsage
+        {
+            std::string m_name;
+            uint64_t m_numRequests = 0;
+            size_t m_size = 0;          // Decoded size of the last load.
+        };
+
+    protected:
+        // The map owns the cached handles, the LRU list is threaded through them,
+        // so both touch and evict are O(1).
         ResourceHandleMap  m_resources;
-        ResourceLoaders    m_resourceLoaders;
+        ResourceHandle*    m_pLruHead;      // Most recently used.
+        ResourceHandle*    m_pLruTail;      // Least recently used.
+        ResourceLoaderTable m_resourceLoaders;
 
         IResourceFile* m_pFile;
 
-        unsigned int m_cacheSize;
-        unsigned int m_allocated;
+        size_t m_cacheSize;
+        size_t m_allocated;
+        std::thread::id m_mainThread;   // The one that created the cache, handed out handles go back on it.
+
+        // --- Async loading ---
+        ThreadPool          m_loaderThreads;
+        PendingLoadMap      m_pendingLoads;     // Main thread only, one entry per path in flight.
+        CompletedLoadList   m_completedLoads;   // Filled by the loader threads.
+        std::mutex          m_completedMutex;
+
+        // --- Access trace ---
+        bool                            m_recording;
+        std::vector<std::string>        m_accessTrace;      // First request of every path, in order.
+        std::unordered_set<std::string> m_tracedNames;
+        std::deque<std::string>         m_prefetchQueue;
+        size_t                          m_numPrefetching;
+
+        // --- Groups ---
+        ResourceDependencyGraph         m_dependencyGraph;
+        ResourceGroupMap                m_groups;
+
+        // --- Aliases ---
+        // Content id -> the last handle decoded for it. Paths packed from identical files share its data.
+        std::unordered_map<uint64_t, std::weak_ptr<ResourceHandle>> m_contentHandles;
+
+        // --- Statistics ---
+        uint64_t                                                m_numHits;
+        uint64_t                                                m_numMisses;
+        uint64_t                                                m_numEvictions;
+        size_t                                                  m_peakAllocated;
+        std::unordered_map<ResourceId, ResourceUsage>           m_usage;
+        std::unordered_map<std::string, LoadLatencyHistogram>   m_loadLatencies;    // By loader pattern.
+        std::string                                             m_statsDumpPath;
     
     public:
         ResourceCache(const unsigned int sizeInMb, IResourceFile* pResFile);
         ~ResourceCache();
 
-        bool Initialize();
+        bool Initialize(size_t numLoaderThreads = 0);
         void RegisterLoader(std::shared_ptr<IResourceLoader> pLoader);
         std::shared_ptr<ResourceHandle> GetHandle(Resource* pResource);
 
+        // ===== Async loading =====
+        // Reads and decompresses on the loader threads. Requests for a path that is already
+        // in flight share the same load. Cache hits are answered on the next ProcessAsyncLoads().
+        void GetHandleAsync(Resource* pResource, AsyncLoadCallback callback);
+        
+        // Must be called once per frame on the main thread, hands finished loads to the cache and fires callbacks.
+        void ProcessAsyncLoads();
+
+        // ===== Access traces =====
+        // Record which paths a level load or session asks for, then replay them next run
+        // as a background prefetch. The packer can lay a pack out in the same order (-order).
+        void StartRecording();
+        void StopRecording() { m_recording = false; }
+        const std::vector<std::string>& GetAccessTrace() const { return m_accessTrace; }
+        bool SaveAccessTrace(const std::string& path) const;
+        static std::vector<std::string> LoadAccessTrace(const std::string& path);
+
+        // Queues the traced paths, ProcessAsyncLoads() keeps a few of them loading at a time
+        // and stops once the cache is full.
+        bool Prefetch(const std::string& tracePath);
+        void CancelPrefetch() { m_prefetchQueue.clear(); }
+        size_t GetNumPrefetchQueued() const { return m_prefetchQueue.size(); }
+
+        // ===== Groups =====
+        // Loads a resource and everything it transitively depends on, in parallel on the loader threads.
+        // The group holds its handles until ReleaseGroup(), which then frees every member no one else uses.
+        // The callback runs on the main thread (right away if the group is already loaded).
+        // Members are cached under their pack paths, request them the same way to share the handles.
+        void LoadGroup(const std::string& root, GroupLoadCallback callback = nullptr);
+        void ReleaseGroup(const std::string& root);
+        bool IsGroupLoaded(const std::string& root) const;
+        ResourceDependencyGraph& GetDependencyGraph() { return m_dependencyGraph; }
+
+        // ===== Streaming =====
+        // For large assets (music, ...) that should not sit decoded in the cache.
+        // A cached handle is streamed from memory, anything else straight from the resource file.
+        std::unique_ptr<IResourceStream> OpenStream(Resource* pResource);
+        
+        bool IsLoading(const std::string& name) const { return m_pendingLoads.find(ResourceId(name)) != m_pendingLoads.end(); }
+        size_t GetNumPendingLoads() const { return m_pendingLoads.size(); }
+
+        // ===== Statistics =====
+        // Hits and misses count GetHandle(), GetHandleAsync() and OpenStream() calls, prefetches and groups don't.
+        ResourceCacheStats GetStats() const;
+        const std::unordered_map<std::string, LoadLatencyHistogram>& GetLoadLatencies() const { return m_loadLatencies; }
+        ResourceRanking GetHottest(size_t count) const;
+        ResourceRanking GetLargest(size_t count) const;
+        void ResetStats();
+
+        // Plain text report. With a dump path set the destructor writes one too.
+        bool DumpStats(const std::string& path, size_t topCount = 10) const;
+        void SetStatsDumpPath(const std::string& path) { m_statsDumpPath = path; }
+
+        // Adds g_logic.ResourceCache, the same queries for scripts.
+        void RegisterWithScript();
+
+        // ===== Pinning =====
+        // A handle that is pinned, or still referenced outside of the cache, is never evicted.
+        // Handed out handles have to be released on the main thread, debug builds assert it.
+        void Pin(std::shared_ptr<ResourceHandle> pHandle);
+        void Unpin(std::shared_ptr<ResourceHandle> pHandle);
+
         //std::vector<std::string> Match(const std::string pattern);
 
+        // Drops every cached handle, pinned ones included.
         void Flush(void);
 
-        void MemoryHasBeenFreed(unsigned int size);
+        size_t GetAllocated()       const { return m_allocated; }
+        size_t GetCacheSize()       const { return m_cacheSize; }
+        size_t GetNumResources()    const { return m_resources.size(); }
 
     protected:
-        bool MakeRoom(unsigned int size);
-        char* Allocate(unsigned int size);
+        bool MakeRoom(size_t size);
         void Free(std::shared_ptr<ResourceHandle> pGonner);
 
         std::shared_ptr<ResourceHandle> Load(Resource* pResource);
+        std::shared_ptr<ResourceHandle> FindAlias(const Resource& resource);
+        void RecordRequest(const Resource& resource, bool hit);
+        void RecordLoad(const Resource& resource, const ResourceHandle* pHandle, uint64_t microseconds);
+        void RequestLoad(const Resource& resource, AsyncLoadCallback callback);
+        void RecordAccess(const std::string& name);
+        void IssuePrefetches();
+        void OnGroupMemberLoaded(const std::string& root, std::shared_ptr<ResourceHandle> pHandle);
+        std::shared_ptr<ResourceHandle> Insert(std::shared_ptr<ResourceHandle> pHandle, ResourceId id);
+        std::shared_ptr<IResourceLoader> FindLoader(const std::string& name);
         std::shared_ptr<ResourceHandle> Find(Resource* pResource);
-        void Update(std::shared_ptr<ResourceHandle> handle);
 
-        void FreeOneResource();
+        // What users get instead of the handle the map owns. The first lease takes a cached handle
+        // off the LRU list, releasing the last one puts it back at the front.
+        std::shared_ptr<ResourceHandle> HandOut(const std::shared_ptr<ResourceHandle>& pHandle);
+
+        // Evicts the LRU tail, false if every handle is in use.
+        bool FreeOneResource();
+
+        // --- LRU list ---
+        void LinkFront(ResourceHandle* pHandle);
+        void Unlink(ResourceHandle* pHandle);
+        // Reads the handle only, released handles may outlive the cache.
+        static bool IsEvictable(const ResourceHandle* pHandle);
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "Resources/Codec.h"
+
+struct SDL_RWops;
+struct z_stream_s;
+
+namespace Bel
+{
+    /// Class Description
+    ///
+    /// Sequential reader over one resource that never holds the whole decoded entry.
+    /// Seeking is always allowed, but going backwards on a compressed entry restarts the decoder.
+    class IResourceStream
+    {
+    public:
+        virtual ~IResourceStream() = 0 {}
+
+        // Copies up to size bytes, returns how many. 0 at the end or on error.
+        virtual size_t Read(char* pDest, size_t size) = 0;
+        virtual bool Seek(uint64_t position) = 0;
+        virtual uint64_t Tell() const = 0;
+        virtual uint64_t GetSize() const = 0;
+    };
+
+    /// Class Description
+    ///
+    /// Stream over bytes that are already decoded: a stored pack entry or a cached handle.
+    class MemoryResourceStream : public IResourceStream
+    {
+    private:
+        const char* m_pData;
+        uint64_t m_size;
+        uint64_t m_position;
+        std::shared_ptr<const void> m_pOwner;   // Keeps the memory alive, may be nullptr.
+
+    public:
+        MemoryResourceStream(const char* pData, uint64_t size, std::shared_ptr<const void> pOwner);
+
+        // Inherited via IResourceStream
+        virtual size_t Read(char* pDest, size_t size) override;
+        virtual bool Seek(uint64_t position) override;
+        virtual uint64_t Tell() const override { return m_position; }
+        virtual uint64_t GetSize() const override { return m_size; }
+    };
+
+    /// Class Description
+    ///
+    /// Inflates a zlib entry one window at a time. Memory use is the window, whatever the entry size.
+    class InflateResourceStream : public IResourceStream
+    {
+    public:
+        static constexpr size_t kDefaultWindowSize = 64 * 1024;
+
+    private:
+        const char* m_pSrc;
+        size_t m_srcSize;
+        uint64_t m_size;
+        std::shared_ptr<const void> m_pOwner;
+
+        std::unique_ptr<z_stream_s> m_pInflate;
+        bool m_failed;
+
+        // Last decoded chunk, covers [m_windowStart, m_windowStart + m_windowSize).
+        std::vector<char> m_window;
+        uint64_t m_windowStart;
+        size_t m_windowSize;
+        uint64_t m_position;
+
+    public:
+        InflateResourceStream(const char* pSrc, size_t srcSize, uint64_t size, std::shared_ptr<const void> pOwner, size_t windowSize = kDefaultWindowSize);
+        InflateResourceStream(const InflateResourceStream& src) = delete;
+        InflateResourceStream& operator=(const InflateResourceStream& rhs) = delete;
+        virtual ~InflateResourceStream() override;
+
+        // Inherited via IResourceStream
+        virtual size_t Read(char* pDest, size_t size) override;
+        virtual bool Seek(uint64_t position) override;
+        virtual uint64_t Tell() const override { return m_position; }
+        virtual uint64_t GetSize() const override { return m_size; }
+
+    private:
+        bool Restart();
+        bool DecodeNextWindow();
+    };
+
+    /// Class Description
+    ///
+    /// Decodes a BlockCodec entry one block at a time. Seeking anywhere, backwards included,
+    /// only costs decoding the block that holds the new position.
+    class BlockResourceStream : public IResourceStream
+    {
+    private:
+        BlockCodec m_codec;
+        BlockCodec::Index m_index;
+        bool m_valid;
+        uint64_t m_size;
+        std::shared_ptr<const void> m_pOwner;
+
+        std::vector<char> m_block;
+        uint32_t m_currentBlock;    // The one in m_block, kNoBlock before the first read.
+        uint64_t m_position;
+
+        static constexpr uint32_t kNoBlock = ~0u;
+
+    public:
+        BlockResourceStream(const char* pSrc, size_t srcSize, uint64_t size, const ICodec& innerCodec, std::shared_ptr<const void> pOwner);
+
+        // False if the data is not a block layout of size bytes, nothing can be read then.
+        bool IsValid() const { return m_valid; }
+
+        // Inherited via IResourceStream
+        virtual size_t Read(char* pDest, size_t size) override;
+        virtual bool Seek(uint64_t position) override;
+        virtual uint64_t Tell() const override { return m_position; }
+        virtual uint64_t GetSize() const override { return m_size; }
+    };
+
+    // Wraps the stream for SDL (Mix_LoadMUS_RW, IMG_Load_RW, ...). The RWops owns the stream
+    // and frees it on close, so pass freesrc = 1.
+    SDL_RWops* CreateResourceRWops(std::unique_ptr<IResourceStream> pStream);
+}
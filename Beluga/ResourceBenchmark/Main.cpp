@@ -0,0 +1,369 @@
+#include <Resources/Resource.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Bel;
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchmarkConfig
+{
+    size_t m_count = 2000;
+    size_t m_size = 16 * 1024;          // Average entry size, each one is between half and one and a half of it.
+    float m_compressibility = 0.5f;     // Share of the data that is repeated text, the rest is noise.
+    unsigned int m_budgetMb = 4;        // Cache size for the eviction run.
+    size_t m_maxThreads = 0;            // 0 for every hardware thread.
+    size_t m_churnRequests = 0;         // 0 for four requests per entry.
+    uint32_t m_seed = 1;
+    std::string m_packPath = "ResourceBenchmark.bin";
+    std::string m_outputPath;           // Empty for stdout.
+    bool m_keepPack = false;
+};
+
+// Microseconds, sorted.
+struct LatencySummary
+{
+    size_t m_count = 0;
+    double m_mean = 0.0;
+    double m_p50 = 0.0;
+    double m_p90 = 0.0;
+    double m_p99 = 0.0;
+    double m_max = 0.0;
+};
+
+struct ChurnResult
+{
+    size_t m_requests = 0;
+    ResourceCacheStats m_stats;
+    double m_seconds = 0.0;
+};
+
+struct ThroughputResult
+{
+    size_t m_threads = 0;
+    size_t m_loads = 0;
+    size_t m_failures = 0;
+    uint64_t m_bytes = 0;
+    double m_seconds = 0.0;
+};
+
+static double MicrosecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+static LatencySummary Summarize(std::vector<double> samples)
+{
+    LatencySummary summary;
+    if (samples.empty())
+        return summary;
+
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double fraction)
+    {
+        return samples[std::min(samples.size() - 1, static_cast<size_t>(fraction * samples.size()))];
+    };
+
+    double total = 0.0;
+    for (double sample : samples)
+    {
+        total += sample;
+    }
+
+    summary.m_count = samples.size();
+    summary.m_mean  = total / samples.size();
+    summary.m_p50   = percentile(0.50);
+    summary.m_p90   = percentile(0.90);
+    summary.m_p99   = percentile(0.99);
+    summary.m_max   = samples.back();
+    return summary;
+}
+
+static std::string GetEntryPath(size_t index)
+{
+    // A few extensions, so loaders and per-type dictionaries see the mix a game pack has.
+    static const char* const kExtensions[] = { "xml", "png", "ogg", "lua" };
+    return "Bench/Entry" + std::to_string(index) + "." + kExtensions[index % 4];
+}
+
+// Runs of repeated text between runs of noise, in the configured ratio.
+static std::vector<char> MakeEntryData(std::mt19937& random, size_t size, float compressibility)
+{
+    static const char kText[] = "<Actor><TransformComponent x=\"0\" y=\"0\"/><SpriteComponent image=\"Textures/Tiles.png\"/></Actor>\n";
+    constexpr size_t kRunLength = 32;
+
+    std::uniform_real_distribution<float> chance(0.f, 1.f);
+    std::uniform_int_distribution<int> noise(0, 255);
+    std::vector<char> data(size);
+    for (size_t run = 0; run < size; run += kRunLength)
+    {
+        const size_t kEnd = std::min(size, run + kRunLength);
+        const bool kRepeated = chance(random) < compressibility;
+        for (size_t i = run; i < kEnd; ++i)
+        {
+            data[i] = kRepeated ? kText[i % (sizeof(kText) - 1)] : static_cast<char>(noise(random));
+        }
+    }
+    return data;
+}
+
+static bool ParseArguments(int argc, char* args[], BenchmarkConfig& config)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string kOption = args[i];
+        const bool kHasValue = (i + 1 < argc);
+        if (kOption == "-count" && kHasValue)
+            config.m_count = std::stoul(args[++i]);
+        else if (kOption == "-size" && kHasValue)
+            config.m_size = std::stoul(args[++i]);
+        else if (kOption == "-compressibility" && kHasValue)
+            config.m_compressibility = std::clamp(std::stof(args[++i]), 0.f, 1.f);
+        else if (kOption == "-budget" && kHasValue)
+            config.m_budgetMb = static_cast<unsigned int>(std::stoul(args[++i]));
+        else if (kOption == "-threads" && kHasValue)
+            config.m_maxThreads = std::stoul(args[++i]);
+        else if (kOption == "-requests" && kHasValue)
+            config.m_churnRequests = std::stoul(args[++i]);
+        else if (kOption == "-seed" && kHasValue)
+            config.m_seed = static_cast<uint32_t>(std::stoul(args[++i]));
+        else if (kOption == "-pack" && kHasValue)
+            config.m_packPath = args[++i];
+        else if (kOption == "-out" && kHasValue)
+            config.m_outputPath = args[++i];
+        else if (kOption == "-keep")
+            config.m_keepPack = true;
+        else
+            return false;
+    }
+
+    if (config.m_maxThreads == 0)
+        config.m_maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    if (config.m_churnRequests == 0)
+        config.m_churnRequests = config.m_count * 4;
+    return config.m_count > 0 && config.m_size > 0;
+}
+
+// Returns the uncompressed bytes packed.
+static uint64_t BuildPack(const BenchmarkConfig& config)
+{
+    std::mt19937 random(config.m_seed);
+    std::uniform_int_distribution<size_t> size(config.m_size / 2, config.m_size + config.m_size / 2);
+
+    uint64_t totalSize = 0;
+    ZlibFile packer;
+    for (size_t i = 0; i < config.m_count; ++i)
+    {
+        std::vector<char> data = MakeEntryData(random, std::max<size_t>(1, size(random)), config.m_compressibility);
+        totalSize += data.size();
+        packer.AddResource(GetEntryPath(i), std::move(data));
+    }
+    packer.Save(config.m_packPath);
+    return totalSize;
+}
+
+static LatencySummary MeasureOpen(const BenchmarkConfig& config)
+{
+    // The OS has the file cached by now, this is the cost of mapping it and checking the table.
+    constexpr size_t kRepeats = 20;
+    std::vector<double> samples;
+    for (size_t i = 0; i < kRepeats; ++i)
+    {
+        ZlibFile pack;
+        const Clock::time_point kStart = Clock::now();
+        if (!pack.Load(config.m_packPath))
+            break;
+        samples.push_back(MicrosecondsSince(kStart));
+    }
+    return Summarize(samples);
+}
+
+// Cold is the first request of every entry (read and decode), warm the same requests answered from the cache.
+static void MeasureGetHandle(const BenchmarkConfig& config, unsigned int budgetMb, LatencySummary& cold, LatencySummary& warm)
+{
+    ResourceZlibFile file(config.m_packPath);
+    ResourceCache cache(budgetMb, &file);
+    if (!cache.Initialize(1))
+        return;
+
+    std::vector<double> coldSamples;
+    std::vector<double> warmSamples;
+    for (std::vector<double>* pSamples : { &coldSamples, &warmSamples })
+    {
+        for (size_t i = 0; i < config.m_count; ++i)
+        {
+            Resource resource(GetEntryPath(i));
+            const Clock::time_point kStart = Clock::now();
+            std::shared_ptr<ResourceHandle> pHandle = cache.GetHandle(&resource);
+            pSamples->push_back(MicrosecondsSince(kStart));
+        }
+    }
+    cold = Summarize(std::move(coldSamples));
+    warm = Summarize(std::move(warmSamples));
+}
+
+// Random requests through a cache far smaller than the pack, so most of them evict something.
+static ChurnResult MeasureChurn(const BenchmarkConfig& config)
+{
+    ChurnResult result;
+    ResourceZlibFile file(config.m_packPath);
+    ResourceCache cache(config.m_budgetMb, &file);
+    if (!cache.Initialize(1))
+        return result;
+
+    // Skewed like a game: a few entries are asked for far more often than the rest.
+    std::mt19937 random(config.m_seed + 1);
+    std::geometric_distribution<size_t> pick(8.0 / config.m_count);
+
+    const Clock::time_point kStart = Clock::now();
+    for (size_t i = 0; i < config.m_churnRequests; ++i)
+    {
+        Resource resource(GetEntryPath(pick(random) % config.m_count));
+        cache.GetHandle(&resource);
+    }
+    result.m_seconds = MicrosecondsSince(kStart) / 1e6;
+    result.m_requests = config.m_churnRequests;
+    result.m_stats = cache.GetStats();
+    return result;
+}
+
+// Every entry requested at once through GetHandleAsync(), finished when the last callback ran.
+static ThroughputResult MeasureThroughput(const BenchmarkConfig& config, size_t numThreads, unsigned int budgetMb)
+{
+    ThroughputResult result;
+    result.m_threads = numThreads;
+
+    ResourceZlibFile file(config.m_packPath);
+    ResourceCache cache(budgetMb, &file);
+    if (!cache.Initialize(numThreads))
+        return result;
+
+    const Clock::time_point kStart = Clock::now();
+    for (size_t i = 0; i < config.m_count; ++i)
+    {
+        Resource resource(GetEntryPath(i));
+        cache.GetHandleAsync(&resource, [&result](std::shared_ptr<ResourceHandle> pHandle)
+        {
+            ++result.m_loads;
+            if (pHandle == nullptr)
+                ++result.m_failures;
+            else
+                result.m_bytes += pHandle->GetSize();
+        });
+    }
+
+    while (cache.GetNumPendingLoads() > 0)
+    {
+        cache.ProcessAsyncLoads();
+        std::this_thread::yield();
+    }
+    result.m_seconds = MicrosecondsSince(kStart) / 1e6;
+    return result;
+}
+
+static void WriteLatency(std::ostream& out, const char* pName, const LatencySummary& summary)
+{
+    out << "    \"" << pName << "\": { \"count\": " << summary.m_count << ", \"mean_us\": " << summary.m_mean
+        << ", \"p50_us\": " << summary.m_p50 << ", \"p90_us\": " << summary.m_p90 << ", \"p99_us\": " << summary.m_p99
+        << ", \"max_us\": " << summary.m_max << " }";
+}
+
+// Usage: ResourceBenchmark [-count <n>] [-size <bytes>] [-compressibility <0..1>] [-budget <MB>] [-threads <n>]
+//                          [-requests <n>] [-seed <n>] [-pack <path>] [-out <json>] [-keep]
+int main(int argc, char* args[])
+{
+    BenchmarkConfig config;
+    if (!ParseArguments(argc, args, config))
+    {
+        std::cerr << "Usage: ResourceBenchmark [-count <n>] [-size <bytes>] [-compressibility <0..1>] [-budget <MB>] [-threads <n>] "
+                     "[-requests <n>] [-seed <n>] [-pack <path>] [-out <json>] [-keep]" << std::endl;
+        return 1;
+    }
+
+    Clock::time_point start = Clock::now();
+    const uint64_t kTotalSize = BuildPack(config);
+    const double kBuildSeconds = MicrosecondsSince(start) / 1e6;
+
+    std::ifstream packFile(config.m_packPath, std::ios_base::binary | std::ios_base::ate);
+    const uint64_t kPackSize = packFile.is_open() ? static_cast<uint64_t>(packFile.tellg()) : 0;
+    packFile.close();
+    if (kPackSize == 0)
+    {
+        std::cerr << "Unable to write " << config.m_packPath << std::endl;
+        return 1;
+    }
+
+    // Big enough that nothing is evicted while latency and throughput are measured.
+    const unsigned int kFullBudgetMb = static_cast<unsigned int>(kTotalSize / (kCacheSize * kCacheSize)) + 16;
+
+    const LatencySummary kOpen = MeasureOpen(config);
+    LatencySummary cold;
+    LatencySummary warm;
+    MeasureGetHandle(config, kFullBudgetMb, cold, warm);
+    const ChurnResult kChurn = MeasureChurn(config);
+
+    std::vector<ThroughputResult> throughput;
+    for (size_t threads = 1; ; threads *= 2)
+    {
+        threads = std::min(threads, config.m_maxThreads);
+        throughput.push_back(MeasureThroughput(config, threads, kFullBudgetMb));
+        if (threads == config.m_maxThreads)
+            break;
+    }
+
+    if (!config.m_keepPack)
+        std::remove(config.m_packPath.c_str());
+
+    std::ofstream outputFile;
+    if (!config.m_outputPath.empty())
+    {
+        outputFile.open(config.m_outputPath, std::ios_base::out | std::ios_base::trunc);
+        if (!outputFile.is_open())
+        {
+            std::cerr << "Unable to write " << config.m_outputPath << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = config.m_outputPath.empty() ? std::cout : outputFile;
+
+    const uint64_t kChurnRequests = kChurn.m_stats.m_hits + kChurn.m_stats.m_misses;
+    out << "{\n";
+    out << "  \"config\": { \"count\": " << config.m_count << ", \"size\": " << config.m_size
+        << ", \"compressibility\": " << config.m_compressibility << ", \"budget_mb\": " << config.m_budgetMb
+        << ", \"max_threads\": " << config.m_maxThreads << ", \"seed\": " << config.m_seed << " },\n";
+    out << "  \"pack\": { \"uncompressed_bytes\": " << kTotalSize << ", \"pack_bytes\": " << kPackSize
+        << ", \"build_seconds\": " << kBuildSeconds << " },\n";
+    out << "  \"latency\": {\n";
+    WriteLatency(out, "open", kOpen);
+    out << ",\n";
+    WriteLatency(out, "get_handle_cold", cold);
+    out << ",\n";
+    WriteLatency(out, "get_handle_warm", warm);
+    out << "\n  },\n";
+    out << "  \"churn\": { \"requests\": " << kChurn.m_requests << ", \"hits\": " << kChurn.m_stats.m_hits
+        << ", \"misses\": " << kChurn.m_stats.m_misses << ", \"evictions\": " << kChurn.m_stats.m_evictions
+        << ", \"hit_ratio\": " << (kChurnRequests > 0 ? static_cast<double>(kChurn.m_stats.m_hits) / kChurnRequests : 0.0)
+        << ", \"peak_bytes_resident\": " << kChurn.m_stats.m_peakBytesResident
+        << ", \"us_per_request\": " << (kChurn.m_requests > 0 ? kChurn.m_seconds * 1e6 / kChurn.m_requests : 0.0) << " },\n";
+    out << "  \"throughput\": [\n";
+    for (size_t i = 0; i < throughput.size(); ++i)
+    {
+        const ThroughputResult& kResult = throughput[i];
+        const double kSeconds = std::max(kResult.m_seconds, 1e-9);
+        out << "    { \"threads\": " << kResult.m_threads << ", \"loads\": " << kResult.m_loads << ", \"failures\": " << kResult.m_failures
+            << ", \"seconds\": " << kResult.m_seconds << ", \"loads_per_second\": " << kResult.m_loads / kSeconds
+            << ", \"mb_per_second\": " << kResult.m_bytes / kSeconds / (kCacheSize * kCacheSize) << " }"
+            << (i + 1 < throughput.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n";
+    out << "}" << std::endl;
+    return 0;
+}
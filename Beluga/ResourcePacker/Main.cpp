@@ -1,12 +1,22 @@
 #include <Resources/Resource.h>
+#include <Resources/Codec.h>
+#include <Graphics/PixelImage.h>
+#include <Actors/ActorDefinition.h>
 #include <Systems/System.h>
+#include <Core/Util/ThreadPool.h>
 #include <memory>
 #include <iostream>
+#include <sstream>
 #include <cstdlib>
+#include <cstring>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <ctime>
 #include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <unordered_set>
+#include <SDL_image.h>
 
 #if defined(_WIN32)
 #include <Windows.h>
@@ -14,38 +24,543 @@
 
 using namespace Bel;
 
+// Fewer small files of a type than this and a dictionary costs more than it saves.
+static constexpr size_t kMinDictionarySamples = 8;
+
+// First line of the manifest. One without it predates the dependencies, or the actor definitions
+// that keep their XML, and is ignored so everything is packed again.
+static constexpr const char* kManifestHeader = "BelugaManifest 3";
+
+// What we knew about an input the last time it was packed.
+struct ManifestEntry
+{
+    uint64_t m_contentHash;
+    uint64_t m_size;
+    int64_t m_modifiedTime;
+    std::vector<std::string> m_dependencies;    // Pack paths an XML input refers to.
+};
+using Manifest = std::unordered_map<std::string, ManifestEntry>;
+
+struct PackInput
+{
+    std::string m_file;             // As found on disk, relative to the asset directory.
+    std::string m_path;             // Normalized pack path.
+    ManifestEntry m_state;
+    bool m_changed;
+    ZlibFile::CompressedResource m_compressed;
+    std::vector<char> m_uncompressed;   // Small inputs wait here until their type's dictionary is trained.
+};
+
+// One line per input, followed by a tab indented line per dependency.
+static Manifest LoadManifest(const std::string& path)
+{
+    Manifest manifest;
+    std::ifstream file(path);
+    std::string line;
+    if (!std::getline(file, line) || line != kManifestHeader)
+        return manifest;
+
+    ManifestEntry* pLast = nullptr;
+    while (std::getline(file, line))
+    {
+        if (!line.empty() && line[0] == '\t')
+        {
+            if (pLast != nullptr)
+                pLast->m_dependencies.push_back(line.substr(1));
+            continue;
+        }
+
+        pLast = nullptr;
+        std::istringstream stream(line);
+        ManifestEntry entry;
+        std::string resourcePath;
+        stream >> std::hex >> entry.m_contentHash >> std::dec >> entry.m_size >> entry.m_modifiedTime;
+        std::getline(stream >> std::ws, resourcePath);
+        if (!stream.fail() && !resourcePath.empty())
+        {
+            pLast = &manifest[resourcePath];
+            *pLast = entry;
+        }
+    }
+    return manifest;
+}
+
+static void SaveManifest(const std::string& path, const std::vector<PackInput>& inputs)
+{
+    std::ofstream file(path, std::ios_base::out | std::ios_base::trunc);
+    file << kManifestHeader << '\n';
+    for (auto& input : inputs)
+    {
+        file << std::hex << input.m_state.m_contentHash << std::dec << ' ' << input.m_state.m_size << ' ' 
+             << input.m_state.m_modifiedTime << ' ' << input.m_path << '\n';
+        for (auto& dependency : input.m_state.m_dependencies)
+        {
+            file << '\t' << dependency << '\n';
+        }
+    }
+}
+
+static bool ReadWholeFile(const std::string& path, std::vector<char>& data)
+{
+    std::fstream resourceFile(path, std::ios_base::in | std::ios_base::binary);
+    if (!resourceFile.is_open())
+        return false;
+
+    resourceFile.seekg(0, resourceFile.end);
+    std::size_t fileSize = static_cast<size_t>(resourceFile.tellg());
+    resourceFile.seekg(0, resourceFile.beg);
+
+    data.resize(fileSize);
+    resourceFile.read(data.data(), fileSize);
+    return true;
+}
+
+static bool IsXmlFile(const std::string& path)
+{
+    const size_t kDot = path.rfind('.');
+    if (kDot == std::string::npos)
+        return false;
+
+    const std::string kExtension = path.substr(kDot + 1);
+    return kExtension == "xml" || kExtension == "tmx" || kExtension == "tsx";
+}
+
+static bool IsImageFile(const std::string& path)
+{
+    const size_t kDot = path.rfind('.');
+    if (kDot == std::string::npos)
+        return false;
+
+    const std::string kExtension = path.substr(kDot + 1);
+    return kExtension == "png" || kExtension == "jpg" || kExtension == "jpeg" || kExtension == "bmp" || kExtension == "tga";
+}
+
+// Replaces the encoded image with its pixels, so the game never runs libpng on it. The path stays the same.
+static void TranscodeImage(const std::string& file, std::vector<char>& data)
+{
+    SDL_Surface* pSurface = IMG_Load_RW(SDL_RWFromConstMem(data.data(), static_cast<int>(data.size())), 1);
+    std::vector<char> pixels = PixelImage::Encode(pSurface);
+    SDL_FreeSurface(pSurface);
+
+    if (pixels.empty())
+    {
+        std::cerr << "Unable to decode " << file << ", packing it as is: " << IMG_GetError() << std::endl;
+        return;
+    }
+    data.swap(pixels);
+}
+
+// Actor XML (an <Actor> root) ships compiled, so the game creates actors without parsing it. The path stays the same.
+// The XML travels along for component types that only initialize from XML.
+static void CompileActor(const std::string& file, std::vector<char>& data)
+{
+    tinyxml2::XMLDocument doc;
+    if (doc.Parse(data.data(), data.size()) != tinyxml2::XML_SUCCESS || doc.RootElement() == nullptr || strcmp(doc.RootElement()->Name(), "Actor") != 0)
+        return;
+
+    std::vector<char> compiled = ActorDefinition::Compile(doc.RootElement());
+    if (compiled.empty())
+    {
+        std::cerr << "Unable to compile " << file << ", packing it as is" << std::endl;
+        return;
+    }
+    data.swap(compiled);
+}
+
+// Resolves "." and ".." segments, "" if it climbs above the root.
+static std::string CollapsePath(const std::string& path)
+{
+    std::vector<std::string> segments;
+    std::istringstream stream(ZlibFile::NormalizePath(path));
+    std::string segment;
+    while (std::getline(stream, segment, '/'))
+    {
+        if (segment.empty() || segment == ".")
+            continue;
+
+        if (segment == "..")
+        {
+            if (segments.empty())
+                return "";
+            segments.pop_back();
+            continue;
+        }
+        segments.push_back(segment);
+    }
+
+    std::string collapsed;
+    for (auto& part : segments)
+    {
+        if (!collapsed.empty())
+            collapsed += '/';
+        collapsed += part;
+    }
+    return collapsed;
+}
+
+// A value names a dependency when it is the path of another packed file, either relative to the
+// referencing file or to the asset root (Level.cpp strips the leading "../" of tileset images).
+static void AddDependencyIfPacked(const std::string& parent, const char* pValue, const std::unordered_set<std::string>& packPaths, std::vector<std::string>& dependencies)
+{
+    if (pValue == nullptr || *pValue == '\0')
+        return;
+
+    std::string value = pValue;
+    const std::string kDirectory = parent.substr(0, parent.find_last_of('/') + 1);
+
+    std::string stripped = value;
+    while (stripped.compare(0, 3, "../") == 0)
+    {
+        stripped.erase(0, 3);
+    }
+
+    for (const std::string& candidate : { CollapsePath(kDirectory + value), CollapsePath(value), CollapsePath(stripped) })
+    {
+        if (!candidate.empty() && candidate != parent && packPaths.find(candidate) != packPaths.end())
+        {
+            if (std::find(dependencies.begin(), dependencies.end(), candidate) == dependencies.end())
+                dependencies.push_back(candidate);
+            return;
+        }
+    }
+}
+
+// Thread safe, the pack paths are only read.
+static std::vector<std::string> ScanDependencies(const std::string& parent, const std::vector<char>& data, const std::unordered_set<std::string>& packPaths)
+{
+    std::vector<std::string> dependencies;
+    tinyxml2::XMLDocument doc;
+    if (doc.Parse(data.data(), data.size()) != tinyxml2::XML_SUCCESS)
+        return dependencies;
+
+    std::vector<const tinyxml2::XMLElement*> elements;
+    elements.push_back(doc.RootElement());
+    while (!elements.empty())
+    {
+        const tinyxml2::XMLElement* pElement = elements.back();
+        elements.pop_back();
+        if (pElement == nullptr)
+            continue;
+
+        for (const tinyxml2::XMLAttribute* pAttribute = pElement->FirstAttribute(); pAttribute; pAttribute = pAttribute->Next())
+        {
+            AddDependencyIfPacked(parent, pAttribute->Value(), packPaths, dependencies);
+        }
+        AddDependencyIfPacked(parent, pElement->GetText(), packPaths, dependencies);
+
+        for (const tinyxml2::XMLElement* pChild = pElement->FirstChildElement(); pChild; pChild = pChild->NextSiblingElement())
+        {
+            elements.push_back(pChild);
+        }
+    }
+    return dependencies;
+}
+
+// Puts the files of the trace first, in the order the game asked for them, so loading reads the pack front to back.
+static void SortByAccessTrace(std::vector<std::string>& files, const std::string& tracePath)
+{
+    std::unordered_map<std::string, size_t> order;
+    for (auto& name : ResourceCache::LoadAccessTrace(tracePath))
+    {
+        order.emplace(ZlibFile::NormalizePath(name), order.size());
+    }
+
+    auto rank = [&order](const std::string& file)
+    {
+        auto iter = order.find(ZlibFile::NormalizePath(file));
+        return (iter != order.end()) ? iter->second : order.size();
+    };
+    std::stable_sort(files.begin(), files.end(), [&rank](const std::string& lhs, const std::string& rhs) { return rank(lhs) < rank(rhs); });
+}
+
+// Usage: ResourcePacker <asset directory> <pack> [-full] [-order <access trace>]
 int main(int argc, char* args[])
 {
-    if (argc < 2)
+    if (argc < 3)
     {
+        std::cerr << "Usage: ResourcePacker <asset directory> <pack> [-full] [-order <access trace>]" << std::endl;
         return 1;
     }
     std::string path = args[1];
+    std::string packPath = args[2];
+    std::string manifestPath = packPath + ".manifest";
+    std::string tracePath;
+    bool fullRebuild = false;
+    for (int i = 3; i < argc; ++i)
+    {
+        std::string option = args[i];
+        if (option == "-full")
+            fullRebuild = true;
+        else if (option == "-order" && i + 1 < argc)
+            tracePath = args[++i];
+    }
 
     auto pSystem = ISystem::Create();
     auto files = pSystem->GetAllFiles(path);
 
+    // Only reorders what gets written, use -full to lay out the whole pack again.
+    if (!tracePath.empty())
+    {
+        SortByAccessTrace(files, tracePath);
+    }
+
+    // Without both the old pack and its manifest there is nothing to be incremental against.
     ZlibFile resources;
-    bool foundFileModified = false;
+    Manifest manifest;
+    if (!fullRebuild)
+    {
+        manifest = LoadManifest(manifestPath);
+    }
+    bool incremental = !manifest.empty() && resources.OpenForUpdate(packPath);
+    if (!incremental)
+    {
+        manifest.clear();
+    }
 
+    std::unordered_set<std::string> packPaths;
     for (auto& file : files)
     {
-        std::string resourcePath = path + "/" + file;
-        std::fstream resourceFile(resourcePath, std::ios_base::in | std::ios_base::binary);
-        if (resourceFile.is_open())
+        packPaths.insert(ZlibFile::NormalizePath(file));
+    }
+
+    // Unchanged inputs keep the dependencies they were packed with, unless files came or went since,
+    // which may change what their references resolve to.
+    bool rescanAll = (manifest.size() != packPaths.size());
+    for (auto& inputPath : packPaths)
+    {
+        rescanAll = rescanAll || manifest.find(inputPath) == manifest.end();
+    }
+
+    // Loads the codec libraries up front, IMG_Init() is not thread safe.
+    IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG);
+
+    std::vector<PackInput> inputs(files.size());
+    ThreadPool workers;
+    workers.Initialize(std::thread::hardware_concurrency());
+
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        PackInput& input = inputs[i];
+        input.m_file = files[i];
+        input.m_path = ZlibFile::NormalizePath(files[i]);
+        input.m_changed = true;
+
+        std::string resourcePath = path + "/" + input.m_file;
+        std::error_code error;
+        input.m_state.m_size = std::filesystem::file_size(resourcePath, error);
+        input.m_state.m_modifiedTime = std::filesystem::last_write_time(resourcePath, error).time_since_epoch().count();
+        input.m_state.m_contentHash = 0;
+
+        // Only worth comparing against when the pack really still has it.
+        auto manifestIter = manifest.find(input.m_path);
+        const ManifestEntry* pKnown = (manifestIter != manifest.end() && resources.FindEntry(input.m_path) != nullptr) ? &manifestIter->second : nullptr;
+
+        // Same size and time stamp, trust it without reading the file.
+        if (pKnown != nullptr && pKnown->m_size == input.m_state.m_size && pKnown->m_modifiedTime == input.m_state.m_modifiedTime)
         {
-            resourceFile.seekg(0, resourceFile.end);
-            std::size_t fileSize = static_cast<size_t>(resourceFile.tellg());
-            resourceFile.seekg(0, resourceFile.beg);
+            input.m_state.m_contentHash = pKnown->m_contentHash;
+            input.m_state.m_dependencies = pKnown->m_dependencies;
+            input.m_changed = false;
+            if (rescanAll && IsXmlFile(input.m_path))
+            {
+                workers.AddJob([&input, &packPaths, resourcePath]()
+                {
+                    std::vector<char> data;
+                    if (ReadWholeFile(resourcePath, data))
+                        input.m_state.m_dependencies = ScanDependencies(input.m_path, data, packPaths);
+                });
+            }
+            continue;
+        }
 
-            std::vector<char> data(fileSize);
-            resourceFile.read(data.data(), fileSize);
-            resources.AddResource(file, std::move(data));
+        workers.AddJob([&input, &packPaths, pKnown, resourcePath]()
+        {
+            std::vector<char> data;
+            if (!ReadWholeFile(resourcePath, data))
+            {
+                std::cerr << "Unable to read " << resourcePath << std::endl;
+                return;
+            }
+
+            // From the XML as written, before an actor is compiled.
+            if (IsXmlFile(input.m_path))
+                input.m_state.m_dependencies = ScanDependencies(input.m_path, data, packPaths);
+
+            // Touched but identical, e.g. after a checkout.
+            input.m_state.m_contentHash = HashResourceData(data.data(), data.size());
+            if (pKnown != nullptr && pKnown->m_contentHash == input.m_state.m_contentHash)
+            {
+                input.m_changed = false;
+                return;
+            }
+
+            if (IsImageFile(input.m_path))
+            {
+                TranscodeImage(input.m_file, data);
+            }
+            else if (IsXmlFile(input.m_path))
+            {
+                CompileActor(input.m_file, data);
+            }
+            if (!data.empty() && data.size() <= ZlibFile::kMaxDictionaryEntrySize && !ZlibFile::GetDictionaryPath(input.m_path).empty())
+            {
+                input.m_uncompressed = std::move(data);
+                return;
+            }
+            input.m_compressed = ZlibFile::CompressResource(input.m_file, std::move(data));
+        });
+    }
+    workers.Wait();
+    IMG_Quit();
+
+    // One dictionary per type, trained on its small changed inputs. An existing pack keeps the one
+    // it has, the entries it retains were compressed against it.
+    std::unordered_map<std::string, std::vector<std::string_view>> samples;
+    for (auto& input : inputs)
+    {
+        if (!input.m_uncompressed.empty())
+            samples[ZlibFile::GetDictionaryPath(input.m_path)].emplace_back(input.m_uncompressed.data(), input.m_uncompressed.size());
+    }
+
+    std::unordered_map<std::string, std::vector<char>> dictionaries;
+    std::unordered_set<std::string> trainedDictionaries;
+    for (auto& type : samples)
+    {
+        std::vector<char>& dictionary = dictionaries[type.first];
+        if (incremental && resources.FindEntry(type.first) != nullptr)
+        {
+            // Copied, a handle into the pack would keep its mapping open while saving.
+            std::shared_ptr<ResourceHandle> pOld = resources.LoadResource(type.first);
+            if (pOld != nullptr)
+                dictionary.assign(pOld->GetData().begin(), pOld->GetData().end());
+        }
+        else if (type.second.size() >= kMinDictionarySamples)
+        {
+            dictionary = TrainDictionary(type.second);
+            trainedDictionaries.insert(type.first);
         }
     }
 
-    //if(foundFileModified)
-        resources.Save(args[2]);
+    for (auto& input : inputs)
+    {
+        if (input.m_uncompressed.empty())
+            continue;
+
+        const std::vector<char>& kDictionary = dictionaries[ZlibFile::GetDictionaryPath(input.m_path)];
+        workers.AddJob([&input, &kDictionary]()
+        {
+            input.m_compressed = ZlibFile::CompressResource(input.m_file, std::move(input.m_uncompressed), std::string_view(kDictionary.data(), kDictionary.size()));
+        });
+    }
+    workers.Wait();
+    workers.Shutdown();
+
+    // Unchanged inputs keep their blobs, a changed one with the same content just points at it.
+    // Duplicates among the changed inputs are merged by AddCompressedResource() itself.
+    std::unordered_map<uint64_t, std::string> keptContent;
+    for (auto& input : inputs)
+    {
+        if (!input.m_changed)
+            keptContent.emplace(input.m_state.m_contentHash, input.m_path);
+    }
+
+    // Added in input order, so the pack layout does not depend on thread timing.
+    bool foundFileModified = false;
+    for (auto& input : inputs)
+    {
+        if (input.m_changed && !input.m_compressed.m_path.empty())
+        {
+            auto keptIter = keptContent.find(input.m_state.m_contentHash);
+            if (keptIter == keptContent.end() || !resources.AddAlias(input.m_path, keptIter->second))
+                resources.AddCompressedResource(std::move(input.m_compressed));
+            foundFileModified = true;
+        }
+    }
+
+    // Only the new dictionaries some entry actually chose. Stored, so loading uses them in place.
+    for (auto& input : inputs)
+    {
+        if (!input.m_changed || input.m_compressed.m_codec != Pack::kCodecZlibDictionary)
+            continue;
+
+        auto trainedIter = trainedDictionaries.find(ZlibFile::GetDictionaryPath(input.m_path));
+        if (trainedIter == trainedDictionaries.end())
+            continue;
+
+        std::vector<char>& dictionary = dictionaries[*trainedIter];
+        ZlibFile::CompressedResource stored;
+        stored.m_path = *trainedIter;
+        stored.m_size = static_cast<uint32_t>(dictionary.size());
+        stored.m_codec = Pack::kCodecStored;
+        stored.m_contentHash = HashResourceData(dictionary.data(), dictionary.size());
+        stored.m_data = std::move(dictionary);
+        resources.AddCompressedResource(std::move(stored));
+        trainedDictionaries.erase(trainedIter);
+    }
+
+    // The graph is put together from the dependencies of every input, and only rewritten when it differs.
+    ResourceDependencyGraph graph;
+    for (auto& input : inputs)
+    {
+        for (auto& dependency : input.m_state.m_dependencies)
+        {
+            graph.AddDependency(input.m_path, dependency);
+        }
+    }
+
+    const std::string kDependencies = graph.Serialize();
+    bool dependenciesChanged = !kDependencies.empty();
+    if (incremental && resources.FindEntry(kDependencyTablePath) != nullptr)
+    {
+        // Scoped, a handle into the pack would keep its mapping open while saving.
+        std::shared_ptr<ResourceHandle> pOld = resources.LoadResource(kDependencyTablePath);
+        dependenciesChanged = (pOld == nullptr || pOld->GetData() != kDependencies);
+    }
+
+    if (dependenciesChanged)
+    {
+        if (!kDependencies.empty())
+            resources.AddResource(kDependencyTablePath, std::vector<char>(kDependencies.begin(), kDependencies.end()));
+        else
+            resources.RemoveResource(kDependencyTablePath);
+        foundFileModified = true;
+    }
+
+    if (incremental)
+    {
+        std::unordered_map<std::string, bool> current;
+        for (auto& input : inputs)
+        {
+            current[input.m_path] = true;
+        }
+        current[kDependencyTablePath] = true;
+
+        for (auto& name : resources.GetResourceNames())
+        {
+            // Dictionaries stay as long as the pack does, retained entries may still need them.
+            if (current.find(name) == current.end() && name.compare(0, strlen(kDictionaryPathPrefix), kDictionaryPathPrefix) != 0)
+            {
+                resources.RemoveResource(name);
+                foundFileModified = true;
+            }
+        }
+    }
+
+    if (incremental && !foundFileModified)
+    {
+        // Time stamps may still have moved, remember them so the files are not hashed again.
+        SaveManifest(manifestPath, inputs);
+        std::cout << packPath << " is up to date" << std::endl;
+        return 0;
+    }
+
+    // The manifest must not describe a pack that was never written.
+    if (!resources.Save(packPath))
+    {
+        std::cerr << "Unable to save " << packPath << std::endl;
+        return 1;
+    }
+    SaveManifest(manifestPath, inputs);
 
     return 0;
 }
@@ -1,20 +1,234 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
 #include "Actors/Actor.h"
 #include "Resources/Resource.h"
 #include "Core/Layers/ApplicationLayer.h"
+#include "Core/Util/ThreadPool.h"
+#include "Events/Events.h"
 
 using namespace Bel;
 using namespace tinyxml2;
 
+/******************************************************************************************
+                                        Component
+******************************************************************************************/
+#if defined(DEBUG)
+static std::unordered_map<IActorComponent::Id, std::string>& GetComponentNames()
+{
+    static std::unordered_map<IActorComponent::Id, std::string> s_names;
+    return s_names;
+}
+#endif
+
+void IActorComponent::RegisterName(std::string_view name)
+{
+#if defined(DEBUG)
+    std::string& registered = GetComponentNames()[HashName(name)];
+    assert((registered.empty() || registered == name) && "Component names hash to the same id");
+    registered = name;
+#else
+    (void)name;
+#endif
+}
+
+SizedSlabAllocator& IActorComponent::GetAllocator()
+{
+    // Leaked on purpose, components held by statics may be freed after it would be destroyed.
+    static SizedSlabAllocator* s_pAllocator = new SizedSlabAllocator();
+    return *s_pAllocator;
+}
+
+std::string_view IActorComponent::GetRegisteredName(Id id)
+{
+#if defined(DEBUG)
+    auto itr = GetComponentNames().find(id);
+    if (itr != GetComponentNames().end())
+        return itr->second;
+#else
+    (void)id;
+#endif
+    return std::string_view();
+}
+
+/******************************************************************************************
+                                      Component Pool
+******************************************************************************************/
+// Where the current update job collects its deferred actions, nullptr outside of one.
+static thread_local std::vector<ComponentPools::Action>* t_pDeferred = nullptr;
+
+void ComponentPool::Add(IActorComponent* pComponent)
+{
+    pComponent->m_poolSlot = static_cast<uint32_t>(m_components.size());
+    m_components.push_back(pComponent);
+}
+
+void ComponentPool::Remove(IActorComponent* pComponent)
+{
+    const uint32_t kSlot = pComponent->m_poolSlot;
+    if (kSlot >= m_components.size() || m_components[kSlot] != pComponent)
+        return;
+
+    // Moving the last one now would make the walk skip it.
+    if (m_walkDepth > 0)
+    {
+        m_components[kSlot] = nullptr;
+        ++m_numHoles;
+        return;
+    }
+
+    m_components[kSlot] = m_components.back();
+    m_components[kSlot]->m_poolSlot = kSlot;
+    m_components.pop_back();
+}
+
+void ComponentPool::UpdateParallel(float delta, ThreadPool& workers)
+{
+    ++m_walkDepth;
+    const size_t kCount = m_components.size();
+    const size_t kNumRanges = std::max<size_t>(1, std::min(workers.GetNumThreads(), kCount / (ComponentPools::kMinParallelSize / 2)));
+
+    std::vector<std::vector<ComponentPools::Action>> deferred(kNumRanges);
+    for (size_t range = 0; range < kNumRanges; ++range)
+    {
+        const size_t kBegin = kCount * range / kNumRanges;
+        const size_t kEnd = kCount * (range + 1) / kNumRanges;
+        workers.AddJob([this, delta, kBegin, kEnd, pDeferred = &deferred[range]]()
+        {
+            t_pDeferred = pDeferred;
+            for (size_t i = kBegin; i < kEnd; ++i)
+            {
+                if (m_components[i] != nullptr)
+                    m_components[i]->Update(delta);
+            }
+            t_pDeferred = nullptr;
+        });
+    }
+    workers.Wait();
+
+    // Destroying here only leaves holes, the walk is still on.
+    for (auto& actions : deferred)
+    {
+        for (auto& action : actions)
+        {
+            action();
+        }
+    }
+
+    if (--m_walkDepth == 0 && m_numHoles > 0)
+        Compact();
+}
+
+void ComponentPool::Compact()
+{
+    size_t count = 0;
+    for (IActorComponent* pComponent : m_components)
+    {
+        if (pComponent == nullptr)
+            continue;
+
+        pComponent->m_poolSlot = static_cast<uint32_t>(count);
+        m_components[count++] = pComponent;
+    }
+    m_components.resize(count);
+    m_numHoles = 0;
+}
+
+void ComponentPools::Add(IActorComponent* pComponent)
+{
+    ComponentPool*& pPool = m_poolsById[pComponent->GetId()];
+    if (pPool == nullptr)
+    {
+        m_pools.emplace_back(pComponent->GetAccess());
+        pPool = &m_pools.back();
+    }
+    pPool->Add(pComponent);
+}
+
+void ComponentPools::Remove(IActorComponent* pComponent)
+{
+    ComponentPool* pPool = GetPool(pComponent->GetId());
+    if (pPool != nullptr)
+    {
+        pPool->Remove(pComponent);
+    }
+}
+
+ComponentPool* ComponentPools::GetPool(IActorComponent::Id id)
+{
+    auto itr = m_poolsById.find(id);
+    return (itr != m_poolsById.end()) ? itr->second : nullptr;
+}
+
+size_t ComponentPools::GetNumComponents() const
+{
+    size_t count = 0;
+    for (auto& pool : m_pools)
+    {
+        count += pool.GetSize();
+    }
+    return count;
+}
+
+void ComponentPools::Update(float delta, ThreadPool* pWorkers)
+{
+    const bool kParallel = (pWorkers != nullptr && pWorkers->IsRunning());
+
+    // By index, pools of types that show up during the walk are updated next frame.
+    // One pool at a time, so a type only ever runs alongside components of its own type.
+    const size_t kCount = m_pools.size();
+    for (size_t i = 0; i < kCount; ++i)
+    {
+        ComponentPool& pool = m_pools[i];
+        if (kParallel && pool.GetAccess() != IActorComponent::Access::kMainThread && pool.GetSize() >= kMinParallelSize)
+        {
+            pool.UpdateParallel(delta, *pWorkers);
+            continue;
+        }
+        pool.ForEach([delta](IActorComponent* pComponent) { pComponent->Update(delta); });
+    }
+}
+
+void ComponentPools::Defer(Action action)
+{
+    if (t_pDeferred != nullptr)
+        t_pDeferred->emplace_back(std::move(action));
+    else
+        action();
+}
+
+void ComponentPools::DeferEvent(EventManager& eventManager, std::unique_ptr<IEvent> pEvent)
+{
+    if (t_pDeferred == nullptr)
+    {
+        eventManager.QueueEvent(std::move(pEvent));
+        return;
+    }
+
+    // std::function has to be copyable, the event is handed over through a shared holder.
+    auto pHolder = std::make_shared<std::unique_ptr<IEvent>>(std::move(pEvent));
+    t_pDeferred->emplace_back([&eventManager, pHolder]() { eventManager.QueueEvent(std::move(*pHolder)); });
+}
+
+void ComponentPools::DeferRelease(std::shared_ptr<ResourceHandle> pHandle)
+{
+    if (t_pDeferred != nullptr)
+        t_pDeferred->emplace_back([pHandle]() mutable { pHandle.reset(); });
+}
+
+/******************************************************************************************
+                                          Actor
+******************************************************************************************/
 IActorComponent* Actor::GetComponent(IActorComponent::Id id)
 {
     if (this == nullptr)
         return nullptr;
 
-    // To Do: Consider to switch from using vector to hash map 
-    auto itr = m_components.find(id);
-    if (itr != m_components.end())
+    for (auto& pComponent : m_components)
     {
-        return itr->second.get();
+        if (pComponent->GetId() == id)
+            return pComponent.get();
     }
     return nullptr;
 }
@@ -24,11 +238,16 @@ bool Actor::Initialize(XMLElement* pData)
     return true;
 }
 
+bool Actor::Initialize(const ActorDefinition::Element* pData)
+{
+    return true;
+}
+
 bool Actor::PostInit()
 {
-    for (auto& component : m_components)
+    for (auto& pComponent : m_components)
     {
-        if (!component.second->PostInit())
+        if (!pComponent->PostInit())
             return false;
     }
     return true;
@@ -36,8 +255,12 @@ bool Actor::PostInit()
 
 void Actor::Destroy()
 {
-    auto gameLayer = ApplicationLayer::GetInstance()->GetGameLayer();
-    gameLayer->DestroyActor(m_id);
+    // Deferred when called from a parallel update, the layer's actor map is not thread safe.
+    ComponentPools::Defer([id = m_id]()
+    {
+        auto gameLayer = ApplicationLayer::GetInstance()->GetGameLayer();
+        gameLayer->DestroyActor(id);
+    });
 }
 
 void Actor::Update(float delta)
@@ -45,9 +268,9 @@ void Actor::Update(float delta)
     if (this == nullptr)
         return;
 
-    for (auto& component : m_components)
+    for (auto& pComponent : m_components)
     {
-        component.second->Update(delta);
+        pComponent->Update(delta);
     }
 }
 
@@ -56,29 +279,65 @@ void Actor::Render(IGraphics* pGraphics)
     if (this == nullptr)
         return;
 
-    for (auto& component : m_components)
+    for (auto& pComponent : m_components)
     {
-        component.second->Render(pGraphics);
+        pComponent->Render(pGraphics);
     }
 }
 
 void Actor::AddComponent(std::unique_ptr<IActorComponent> pComponent)
 {
-    if (pComponent != nullptr)
+    if (pComponent == nullptr)
+        return;
+
+    if (m_pPools != nullptr)
+        m_pPools->Add(pComponent.get());
+
+    // One per type, a new one replaces the old.
+    for (auto& pExisting : m_components)
     {
-        m_components[pComponent->GetId()] = std::move(pComponent);
+        if (pExisting->GetId() == pComponent->GetId())
+        {
+            if (m_pPools != nullptr)
+                m_pPools->Remove(pExisting.get());
+
+            pExisting = std::move(pComponent);
+            return;
+        }
     }
+    m_components.emplace_back(std::move(pComponent));
 }
 
 bool Actor::HasComponent(IActorComponent::Id id)
 {
-    auto itr = m_components.find(id);
-    if (itr != m_components.end())
+    return GetComponent(id) != nullptr;
+}
+
+void Actor::RemoveComponents()
+{
+    if (m_pPools != nullptr)
     {
-        return true;
+        for (auto& pComponent : m_components)
+        {
+            m_pPools->Remove(pComponent.get());
+        }
     }
+    m_components.clear();
+}
+
+void Actor::SetComponentPools(ComponentPools* pPools)
+{
+    if (pPools == m_pPools)
+        return;
 
-    return false;
+    for (auto& pComponent : m_components)
+    {
+        if (m_pPools != nullptr)
+            m_pPools->Remove(pComponent.get());
+        if (pPools != nullptr)
+            pPools->Add(pComponent.get());
+    }
+    m_pPools = pPools;
 }
 
 bool Actor::IsName(const char* pName)
@@ -91,9 +350,9 @@ bool Actor::IsName(const char* pName)
 
 void Actor::RegisterWithScript()
 {
-    for (auto& pair : m_components)
+    for (auto& pComponent : m_components)
     {
-        pair.second->RegisterWithScript();
+        pComponent->RegisterWithScript();
     }
 }
 
@@ -101,7 +360,7 @@ std::shared_ptr<Actor> ActorFactory::CreateActor(tinyxml2::XMLDocument& doc, con
 {
     Logging& log = ApplicationLayer::GetInstance()->GetLogging();
 
-    std::shared_ptr<Actor> pActor(new Actor(GetNextActorId()));
+    std::shared_ptr<Actor> pActor = std::allocate_shared<Actor>(SlabStlAllocator<Actor>(&GetActorAllocator()), GetNextActorId());
 
     tinyxml2::XMLElement* pRoot = doc.FirstChildElement();
     if (!pActor->Initialize(pRoot))
@@ -130,7 +389,13 @@ std::shared_ptr<Actor> ActorFactory::CreateActor(tinyxml2::XMLDocument& doc, con
 
 std::shared_ptr<Actor> ActorFactory::CreateActorWithEmpty()
 {
-    return  std::make_shared<Actor>(GetNextActorId());
+    return std::allocate_shared<Actor>(SlabStlAllocator<Actor>(&GetActorAllocator()), GetNextActorId());
+}
+
+SizedSlabAllocator& ActorFactory::GetActorAllocator()
+{
+    static SizedSlabAllocator* s_pAllocator = new SizedSlabAllocator();
+    return *s_pAllocator;
 }
 
 std::shared_ptr<Actor> ActorFactory::CreateActorByFileName(const std::string_view& fileName)
@@ -150,32 +415,179 @@ std::shared_ptr<Actor> ActorFactory::CreateActorByFileName(const std::string_vie
     return CreateActor(doc, error);
 }
 
-std::shared_ptr<Actor> Bel::ActorFactory::CreateActorByResource(std::shared_ptr<ResourceHandle> pResource)
+std::shared_ptr<Actor> Bel::ActorFactory::CreateActorByResource(std::shared_ptr<ResourceHandle> pResource, const ActorOverride& override)
 {
-    tinyxml2::XMLDocument doc;
-    XMLError error = doc.Parse(pResource->GetData().data(), pResource->GetData().size());
-    Logging& log = ApplicationLayer::GetInstance()->GetLogging();
+    Prefab* pPrefab = (pResource != nullptr) ? FindPrefab(*pResource) : nullptr;
+    if (pPrefab == nullptr)
+        return nullptr;
 
-    if (error != XML_SUCCESS)
+    return Instantiate(*pPrefab, override);
+}
+
+ActorFactory::Prefab* ActorFactory::FindPrefab(const ResourceHandle& resource)
+{
+    auto itr = m_prefabs.find(resource.GetId().GetHash());
+    if (itr != m_prefabs.end())
+        return itr->second.get();
+
+    auto pPrefab = std::make_unique<Prefab>();
+    pPrefab->m_name = resource.GetName();
+    if (!LoadPrefab(*pPrefab, resource))
+        return nullptr;
+
+    return m_prefabs.emplace(resource.GetId().GetHash(), std::move(pPrefab)).first->second.get();
+}
+
+bool ActorFactory::LoadPrefab(Prefab& prefab, const ResourceHandle& resource)
+{
+    const std::string_view kData = resource.GetData();
+
+    if (ActorDefinition::IsActorDefinition(kData.data(), kData.size()))
+    {
+        prefab.m_compiled.resize((kData.size() + sizeof(uint32_t) - 1) / sizeof(uint32_t));
+        memcpy(prefab.m_compiled.data(), kData.data(), kData.size());
+
+        prefab.m_compiledSize = kData.size();
+        prefab.m_pCompiledRoot = ActorDefinition::GetRoot(reinterpret_cast<const char*>(prefab.m_compiled.data()), kData.size());
+        if (prefab.m_pCompiledRoot == nullptr || !prefab.m_prototype.Initialize(prefab.m_pCompiledRoot))
+        {
+            LOG_WARNING("Unable to load compiled actor: ", false);
+            LOG_WARNING(resource.GetName().c_str());
+            return false;
+        }
+
+        // Compiled and XML children come in the same order. The XML is only parsed once a type
+        // turns out to initialize from XML alone, the factory can't tell that from a failure.
+        XMLElement* pSource = nullptr;
+        for (const ActorDefinition::Element* pElement = prefab.m_pCompiledRoot->FirstChildElement(); pElement; pElement = pElement->NextSiblingElement())
+        {
+            if (pSource != nullptr)
+                pSource = pSource->NextSiblingElement();
+
+            std::unique_ptr<IActorComponent> pPrototype = CreateComponent(pElement, &prefab.m_prototype);
+            if (pPrototype != nullptr)
+            {
+                prefab.AddPrototype(std::move(pPrototype), nullptr, pElement);
+                continue;
+            }
+
+            if (pSource == nullptr)
+            {
+                pSource = FindSourceElement(prefab, pElement);
+                if (pSource == nullptr)
+                {
+                    LOG_ERROR("Unable to parse the source of compiled actor: ", false);
+                    LOG_ERROR(resource.GetName().c_str());
+                    return false;
+                }
+            }
+
+            prefab.AddPrototype(CreateComponent(pSource, &prefab.m_prototype), pSource, nullptr);
+        }
+        return true;
+    }
+
+    XMLError error = prefab.m_doc.Parse(kData.data(), kData.size());
+    if (error != XML_SUCCESS || prefab.m_doc.FirstChildElement() == nullptr || !prefab.m_prototype.Initialize(prefab.m_doc.FirstChildElement()))
     {
+        Logging& log = ApplicationLayer::GetInstance()->GetLogging();
         log.Log(Logging::SeverityLevel::kLevelWarn, "Unable to load file: ", false);
-        log.Log(Logging::SeverityLevel::kLevelWarn, pResource->GetName().c_str());
+        log.Log(Logging::SeverityLevel::kLevelWarn, resource.GetName().c_str());
         log.Log(Logging::SeverityLevel::kLevelWarn, tinyxml2::XMLDocument::ErrorIDToName(error));
 
+        return false;
+    }
+
+    for (XMLElement* pElement = prefab.m_doc.FirstChildElement()->FirstChildElement(); pElement;
+        pElement = pElement->NextSiblingElement())
+    {
+        prefab.AddPrototype(CreateComponent(pElement, &prefab.m_prototype), pElement, nullptr);
+    }
+    return true;
+}
+
+void ActorFactory::Prefab::AddPrototype(std::unique_ptr<IActorComponent> pPrototype, XMLElement* pData, const ActorDefinition::Element* pCompiled)
+{
+    if (pPrototype == nullptr)
+        return;
+
+    // A later element of a type replaces the earlier one, as it does on an actor.
+    const IActorComponent::Id kId = pPrototype->GetId();
+    m_prototype.AddComponent(std::move(pPrototype));
+    for (auto& component : m_components)
+    {
+        if (component.m_id == kId)
+        {
+            component = { kId, pData, pCompiled };
+            return;
+        }
+    }
+    m_components.push_back({ kId, pData, pCompiled });
+}
+
+XMLElement* ActorFactory::FindSourceElement(Prefab& prefab, const ActorDefinition::Element* pElement)
+{
+    // Parsed once, components initialized from it keep pointing into the document.
+    if (prefab.m_doc.FirstChildElement() == nullptr)
+    {
+        const std::string_view kSource = ActorDefinition::GetSource(reinterpret_cast<const char*>(prefab.m_compiled.data()), prefab.m_compiledSize);
+        if (kSource.empty() || prefab.m_doc.Parse(kSource.data(), kSource.size()) != XML_SUCCESS || prefab.m_doc.FirstChildElement() == nullptr)
+            return nullptr;
+    }
+
+    XMLElement* pSource = prefab.m_doc.FirstChildElement()->FirstChildElement();
+    for (const ActorDefinition::Element* pChild = prefab.m_pCompiledRoot->FirstChildElement(); pSource != nullptr && pChild != pElement; pChild = pChild->NextSiblingElement())
+    {
+        pSource = pSource->NextSiblingElement();
+    }
+    return pSource;
+}
+
+std::shared_ptr<Actor> ActorFactory::Instantiate(Prefab& prefab, const ActorOverride& override)
+{
+    std::shared_ptr<Actor> pActor = std::allocate_shared<Actor>(SlabStlAllocator<Actor>(&GetActorAllocator()), GetNextActorId());
+
+    const bool kInitialized = (prefab.m_pCompiledRoot != nullptr)
+        ? pActor->Initialize(prefab.m_pCompiledRoot)
+        : pActor->Initialize(prefab.m_doc.FirstChildElement());
+    if (!kInitialized)
+    {
+        LOG_WARNING("Unable to initialize actor: ", false);
+        LOG_WARNING(prefab.m_name.c_str());
         return nullptr;
     }
 
-    return CreateActor(doc, error);
+    for (auto& component : prefab.m_components)
+    {
+        std::unique_ptr<IActorComponent> pComponent = prefab.m_prototype.GetComponent(component.m_id)->Clone(pActor.get());
+        if (pComponent == nullptr)
+        {
+            pComponent = (component.m_pCompiled != nullptr) ? CreateComponent(component.m_pCompiled, pActor.get()) : CreateComponent(component.m_pData, pActor.get());
+        }
+        pActor->AddComponent(std::move(pComponent));
+    }
+
+    if (override)
+        override(pActor.get());
+
+    if (!pActor->PostInit())
+    {
+        LOG_WARNING("Unable to post init actor: ", false);
+        LOG_WARNING(prefab.m_name.c_str());
+        return nullptr;
+    }
+
+    return pActor;
 }
 
 std::unique_ptr<IActorComponent> ActorFactory::CreateComponent(XMLElement* pData, Actor* pOwner)
 {
     const char* pName = pData->Name();
     std::unique_ptr<IActorComponent> pComponent;
-    auto createItr = m_actorComponentCreatorMap.find(pName);
+    auto createItr = m_actorComponentCreatorMap.find(IActorComponent::HashName(pName));
     if (createItr != m_actorComponentCreatorMap.end())
     {
-        pComponent = std::move(createItr->second(pOwner, pName));
+        pComponent = std::move(createItr->second.m_function(pOwner, pName));
     }
     else
     {
@@ -191,4 +603,23 @@ std::unique_ptr<IActorComponent> ActorFactory::CreateComponent(XMLElement* pData
     }
 
     return pComponent;
-}
\ No newline at end of file
+}
+
+std::unique_ptr<IActorComponent> ActorFactory::CreateComponent(const ActorDefinition::Element* pData, Actor* pOwner)
+{
+    auto createItr = m_actorComponentCreatorMap.find(pData->GetNameHash());
+    if (createItr == m_actorComponentCreatorMap.end())
+    {
+        LOG_FATAL("Unable to find creator for compiled component : ", false);
+        LOG_FATAL(std::to_string(pData->GetNameHash()).c_str());
+
+        return nullptr;
+    }
+
+    // Failing may only mean the type doesn't load compiled definitions, the caller falls back to the XML.
+    std::unique_ptr<IActorComponent> pComponent = createItr->second.m_function(pOwner, createItr->second.m_name.c_str());
+    if (pComponent != nullptr && !pComponent->Initialize(pData))
+        return nullptr;
+
+    return pComponent;
+}
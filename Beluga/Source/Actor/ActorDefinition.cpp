@@ -0,0 +1,278 @@
+#include <cstring>
+
+#include "Actors/ActorDefinition.h"
+#include "Parshing/tinyxml2.h"
+
+using namespace Bel;
+using namespace Bel::ActorDefinition;
+
+/******************************************************************************************
+                                         Element
+******************************************************************************************/
+const Element* Element::FirstChildElement(const char* pName) const
+{
+    if (m_children >= m_size)
+        return nullptr;
+
+    const Element* pChild = reinterpret_cast<const Element*>(GetBytes() + m_children);
+    if (pName == nullptr || pChild->m_name == HashName(pName))
+        return pChild;
+
+    return pChild->NextSiblingElement(pName);
+}
+
+const Element* Element::NextSiblingElement(const char* pName) const
+{
+    const uint32_t kName = (pName != nullptr) ? HashName(pName) : 0;
+    for (const Element* pSibling = this; !pSibling->m_isLast;)
+    {
+        pSibling = reinterpret_cast<const Element*>(pSibling->GetBytes() + pSibling->m_size);
+        if (pName == nullptr || pSibling->m_name == kName)
+            return pSibling;
+    }
+    return nullptr;
+}
+
+const Value* Element::FindValue(uint32_t name) const
+{
+    const Value* pValues = reinterpret_cast<const Value*>(this + 1);
+    for (uint16_t i = 0; i < m_numValues; ++i)
+    {
+        if (pValues[i].m_name == name)
+            return &pValues[i];
+    }
+    return nullptr;
+}
+
+const char* Element::Attribute(const char* pName) const
+{
+    const Value* pValue = FindValue(HashName(pName));
+    return (pValue != nullptr) ? GetBytes() + pValue->m_text : nullptr;
+}
+
+int Element::IntAttribute(const char* pName, int defaultValue) const
+{
+    const Value* pValue = FindValue(HashName(pName));
+    return (pValue != nullptr && (pValue->m_flags & Value::kIsInt)) ? pValue->m_int : defaultValue;
+}
+
+float Element::FloatAttribute(const char* pName, float defaultValue) const
+{
+    const Value* pValue = FindValue(HashName(pName));
+    return (pValue != nullptr && (pValue->m_flags & Value::kIsFloat)) ? pValue->m_float : defaultValue;
+}
+
+bool Element::BoolAttribute(const char* pName, bool defaultValue) const
+{
+    const Value* pValue = FindValue(HashName(pName));
+    return (pValue != nullptr && (pValue->m_flags & Value::kIsBool)) ? (pValue->m_bool != 0) : defaultValue;
+}
+
+const char* Element::GetText() const
+{
+    const Value* pValue = FindValue(kTextName);
+    return (pValue != nullptr) ? GetBytes() + pValue->m_text : nullptr;
+}
+
+int Element::IntText(int defaultValue) const
+{
+    const Value* pValue = FindValue(kTextName);
+    return (pValue != nullptr && (pValue->m_flags & Value::kIsInt)) ? pValue->m_int : defaultValue;
+}
+
+float Element::FloatText(float defaultValue) const
+{
+    const Value* pValue = FindValue(kTextName);
+    return (pValue != nullptr && (pValue->m_flags & Value::kIsFloat)) ? pValue->m_float : defaultValue;
+}
+
+bool Element::BoolText(bool defaultValue) const
+{
+    const Value* pValue = FindValue(kTextName);
+    return (pValue != nullptr && (pValue->m_flags & Value::kIsBool)) ? (pValue->m_bool != 0) : defaultValue;
+}
+
+/******************************************************************************************
+                                         Loading
+******************************************************************************************/
+// Everything an element points at has to lie within the size bytes it was given.
+static bool IsValid(const Element* pElement, size_t size)
+{
+    if (size < sizeof(Element) || pElement->m_size > size || pElement->m_size % 4 != 0)
+        return false;
+
+    const size_t kValuesEnd = sizeof(Element) + pElement->m_numValues * sizeof(Value);
+    if (kValuesEnd > pElement->m_children || pElement->m_children > pElement->m_size || pElement->m_children % 4 != 0)
+        return false;
+
+    // Texts sit between the values and the children, each ends before the children start.
+    const char* pBytes = pElement->GetBytes();
+    const Value* pValues = reinterpret_cast<const Value*>(pElement + 1);
+    for (uint16_t i = 0; i < pElement->m_numValues; ++i)
+    {
+        const uint32_t kText = pValues[i].m_text;
+        if (kText < kValuesEnd || kText >= pElement->m_children || memchr(pBytes + kText, '\0', pElement->m_children - kText) == nullptr)
+            return false;
+    }
+
+    size_t offset = pElement->m_children;
+    while (offset < pElement->m_size)
+    {
+        const Element* pChild = reinterpret_cast<const Element*>(pBytes + offset);
+        if (!IsValid(pChild, pElement->m_size - offset))
+            return false;
+
+        // The last child has to end its parent, no other may.
+        offset += pChild->m_size;
+        if ((pChild->m_isLast != 0) != (offset == pElement->m_size))
+            return false;
+    }
+    return true;
+}
+
+bool ActorDefinition::IsActorDefinition(const char* pData, size_t size)
+{
+    if (pData == nullptr || size < sizeof(Header))
+        return false;
+
+    Header header;
+    memcpy(&header, pData, sizeof(Header));
+    return header.m_magic == kMagic;
+}
+
+const Element* ActorDefinition::GetRoot(const char* pData, size_t size)
+{
+    if (!IsActorDefinition(pData, size) || reinterpret_cast<uintptr_t>(pData) % 4 != 0)
+        return nullptr;
+
+    const Header* pHeader = reinterpret_cast<const Header*>(pData);
+    if (pHeader->m_version != kVersion || pHeader->m_size < sizeof(Header) || pHeader->m_size > size || size - pHeader->m_size != pHeader->m_sourceSize)
+        return nullptr;
+
+    const Element* pRoot = reinterpret_cast<const Element*>(pData + sizeof(Header));
+    if (!IsValid(pRoot, pHeader->m_size - sizeof(Header)) || pRoot->m_isLast == 0)
+        return nullptr;
+
+    return pRoot;
+}
+
+std::string_view ActorDefinition::GetSource(const char* pData, size_t size)
+{
+    if (GetRoot(pData, size) == nullptr)
+        return std::string_view();
+
+    const Header* pHeader = reinterpret_cast<const Header*>(pData);
+    return std::string_view(pData + pHeader->m_size, pHeader->m_sourceSize);
+}
+
+/******************************************************************************************
+                                        Compiling
+******************************************************************************************/
+static void Pad(std::vector<char>& data)
+{
+    data.resize((data.size() + 3) & ~size_t(3), '\0');
+}
+
+// Parsed with tinyxml2's own conversions, so reading the numbers back gives what the XML would.
+static Value MakeValue(uint32_t name, const char* pText)
+{
+    Value value = {};
+    value.m_name = name;
+
+    int intValue = 0;
+    float floatValue = 0;
+    bool boolValue = false;
+    if (tinyxml2::XMLUtil::ToInt(pText, &intValue))
+    {
+        value.m_int = intValue;
+        value.m_flags |= Value::kIsInt;
+    }
+    if (tinyxml2::XMLUtil::ToFloat(pText, &floatValue))
+    {
+        value.m_float = floatValue;
+        value.m_flags |= Value::kIsFloat;
+    }
+    if (tinyxml2::XMLUtil::ToBool(pText, &boolValue))
+    {
+        value.m_bool = boolValue ? 1 : 0;
+        value.m_flags |= Value::kIsBool;
+    }
+    return value;
+}
+
+static bool CompileElement(const tinyxml2::XMLElement* pSource, bool isLast, std::vector<char>& data)
+{
+    std::vector<Value> values;
+    std::vector<const char*> texts;
+    for (const tinyxml2::XMLAttribute* pAttribute = pSource->FirstAttribute(); pAttribute; pAttribute = pAttribute->Next())
+    {
+        const uint32_t kName = HashName(pAttribute->Name());
+        if (kName == kTextName)
+            return false;
+
+        values.push_back(MakeValue(kName, pAttribute->Value()));
+        texts.push_back(pAttribute->Value());
+    }
+    if (pSource->GetText() != nullptr)
+    {
+        values.push_back(MakeValue(kTextName, pSource->GetText()));
+        texts.push_back(pSource->GetText());
+    }
+    if (values.size() > UINT16_MAX)
+        return false;
+
+    const size_t kStart = data.size();
+    data.resize(kStart + sizeof(Element) + values.size() * sizeof(Value));
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        values[i].m_text = static_cast<uint32_t>(data.size() - kStart);
+        data.insert(data.end(), texts[i], texts[i] + strlen(texts[i]) + 1);
+    }
+    Pad(data);
+    memcpy(data.data() + kStart + sizeof(Element), values.data(), values.size() * sizeof(Value));
+
+    Element element = {};
+    element.m_name = HashName(pSource->Name());
+    element.m_numValues = static_cast<uint16_t>(values.size());
+    element.m_isLast = isLast ? 1 : 0;
+    element.m_children = static_cast<uint32_t>(data.size() - kStart);
+
+    for (const tinyxml2::XMLElement* pChild = pSource->FirstChildElement(); pChild; pChild = pChild->NextSiblingElement())
+    {
+        if (!CompileElement(pChild, pChild->NextSiblingElement() == nullptr, data))
+            return false;
+    }
+
+    if (data.size() - kStart > UINT32_MAX)
+        return false;
+
+    element.m_size = static_cast<uint32_t>(data.size() - kStart);
+    memcpy(data.data() + kStart, &element, sizeof(Element));
+    return true;
+}
+
+std::vector<char> ActorDefinition::Compile(const tinyxml2::XMLElement* pRoot)
+{
+    if (pRoot == nullptr)
+        return std::vector<char>();
+
+    std::vector<char> data(sizeof(Header));
+    if (!CompileElement(pRoot, true, data))
+        return std::vector<char>();
+
+    // Printed compact, the source is only ever parsed again.
+    tinyxml2::XMLPrinter printer(nullptr, true);
+    pRoot->Accept(&printer);
+    const size_t kSourceSize = static_cast<size_t>(printer.CStrSize() - 1);
+    if (data.size() + kSourceSize > UINT32_MAX)
+        return std::vector<char>();
+
+    Header header = {};
+    header.m_magic = kMagic;
+    header.m_version = kVersion;
+    header.m_size = static_cast<uint32_t>(data.size());
+    header.m_sourceSize = static_cast<uint32_t>(kSourceSize);
+    memcpy(data.data(), &header, sizeof(Header));
+    data.insert(data.end(), printer.CStr(), printer.CStr() + kSourceSize);
+    return data;
+}
@@ -14,8 +14,6 @@ public:
 private:
     bool m_initialized;
     
-    // This was the key
-    std::vector<char> m_musicData;
     std::unique_ptr<Mix_Music, decltype(&Mix_FreeMusic)> m_pMusic;
     SoundMap m_sounds;
 
@@ -89,12 +87,9 @@ public:
         // With resource cache
         if (pCache != nullptr)
         {
-            auto pResource = pCache->GetHandle(&Resource(pFileName));
-            m_musicData.clear();
-            m_musicData = pResource->GetData();
-
-            SDL_RWops* pRwops = SDL_RWFromMem(m_musicData.data(), static_cast<int>(m_musicData.size()));
-            Mix_Music* pMusic = Mix_LoadMUS_RW(pRwops, 0);
+            // Streamed, the mixer owns the RWops and decodes while it plays.
+            SDL_RWops* pRwops = CreateResourceRWops(pCache->OpenStream(&Resource(pFileName)));
+            Mix_Music* pMusic = (pRwops != nullptr) ? Mix_LoadMUS_RW(pRwops, 1) : nullptr;
 
             m_pMusic = std::unique_ptr<Mix_Music, decltype(&Mix_FreeMusic)>(pMusic, &Mix_FreeMusic);
         }
@@ -146,7 +141,7 @@ public:
 
             if (soundIter == m_sounds.end())
             {
-                SDL_RWops* pRwops = SDL_RWFromMem(pResource->GetData().data(), static_cast<int>(pResource->GetData().size()));
+                SDL_RWops* pRwops = SDL_RWFromConstMem(pResource->GetData().data(), static_cast<int>(pResource->GetData().size()));
                 pChunk = Mix_LoadWAV_RW(pRwops, 0);
                 fileName = pResource->GetName();
                 soundIter = m_sounds.emplace(fileName.data(), std::unique_ptr<Mix_Chunk, decltype(&Mix_FreeChunk)>(pChunk, &Mix_FreeChunk)).first;
@@ -197,12 +192,9 @@ public:
         // With resource cache
         if (pCache != nullptr)
         {
-            auto pResource = pCache->GetHandle(&Resource(pFileName));
-            m_musicData.clear();
-            m_musicData = pResource->GetData();
-
-            SDL_RWops* pRwops = SDL_RWFromMem(m_musicData.data(), static_cast<int>(m_musicData.size()));
-            Mix_Music* pMusic = Mix_LoadMUS_RW(pRwops, 0);
+            // Streamed, the mixer owns the RWops and decodes while it plays.
+            SDL_RWops* pRwops = CreateResourceRWops(pCache->OpenStream(&Resource(pFileName)));
+            Mix_Music* pMusic = (pRwops != nullptr) ? Mix_LoadMUS_RW(pRwops, 1) : nullptr;
 
             m_pMusic = std::unique_ptr<Mix_Music, decltype(&Mix_FreeMusic)>(pMusic, &Mix_FreeMusic);
         }
@@ -313,7 +305,7 @@ private:
         {
             //Mix_Chunk* pChunk = Mix_LoadWAV(pFileName);
 
-            SDL_RWops* pRwops = SDL_RWFromMem(pResource->GetData().data(), static_cast<int>(pResource->GetData().size()));
+            SDL_RWops* pRwops = SDL_RWFromConstMem(pResource->GetData().data(), static_cast<int>(pResource->GetData().size()));
             Mix_Chunk* pChunk = Mix_LoadWAV_RW(pRwops, 0);
 
             if (pChunk != nullptr)
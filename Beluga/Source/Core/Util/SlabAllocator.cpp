@@ -0,0 +1,110 @@
+#include <algorithm>
+
+#include "Core/Util/SlabAllocator.h"
+
+using namespace Bel;
+
+/******************************************************************************************
+                                      Slab Allocator
+******************************************************************************************/
+SlabAllocator::SlabAllocator(size_t slotSize, size_t slotsPerSlab)
+    : m_slotsPerSlab(std::max<size_t>(slotsPerSlab, 1))
+    , m_pFree(nullptr)
+{
+    // Room for the free list link, and every slot aligned like operator new would.
+    constexpr size_t kAlignment = alignof(std::max_align_t);
+    m_slotSize = (std::max(slotSize, sizeof(void*)) + kAlignment - 1) & ~(kAlignment - 1);
+    m_stats.m_slotSize = m_slotSize;
+}
+
+void* SlabAllocator::Allocate()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_pFree == nullptr)
+        AddSlab();
+
+    void* pSlot = m_pFree;
+    m_pFree = *static_cast<void**>(pSlot);
+
+    ++m_stats.m_numAllocations;
+    m_stats.m_peakInUse = std::max(m_stats.m_peakInUse, ++m_stats.m_numInUse);
+    return pSlot;
+}
+
+void SlabAllocator::Free(void* pSlot)
+{
+    if (pSlot == nullptr)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    *static_cast<void**>(pSlot) = m_pFree;
+    m_pFree = pSlot;
+    --m_stats.m_numInUse;
+}
+
+SlabAllocatorStats SlabAllocator::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void SlabAllocator::AddSlab()
+{
+    // new char[] is aligned for any type of its size, which covers max_align_t.
+    m_slabs.emplace_back(new char[m_slotSize * m_slotsPerSlab]);
+    char* pSlab = m_slabs.back().get();
+
+    // Linked back to front, so slots are handed out in address order.
+    for (size_t i = m_slotsPerSlab; i-- > 0;)
+    {
+        void* pSlot = pSlab + i * m_slotSize;
+        *static_cast<void**>(pSlot) = m_pFree;
+        m_pFree = pSlot;
+    }
+
+    ++m_stats.m_numSlabs;
+    ++m_stats.m_numSlabAllocations;
+    m_stats.m_numSlots += m_slotsPerSlab;
+}
+
+/******************************************************************************************
+                                   Sized Slab Allocator
+******************************************************************************************/
+SlabAllocator* SizedSlabAllocator::GetAllocator(size_t size)
+{
+    const size_t kClass = (std::max<size_t>(size, 1) - 1) / kGranularity;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::unique_ptr<SlabAllocator>& pAllocator = m_pAllocators[kClass];
+    if (pAllocator == nullptr)
+        pAllocator = std::make_unique<SlabAllocator>((kClass + 1) * kGranularity);
+    return pAllocator.get();
+}
+
+void* SizedSlabAllocator::Allocate(size_t size)
+{
+    if (size > kMaxSlotSize)
+        return ::operator new(size);
+
+    return GetAllocator(size)->Allocate();
+}
+
+void SizedSlabAllocator::Free(void* pMemory, size_t size)
+{
+    if (size > kMaxSlotSize)
+        ::operator delete(pMemory);
+    else if (pMemory != nullptr)
+        GetAllocator(size)->Free(pMemory);
+}
+
+std::vector<SlabAllocatorStats> SizedSlabAllocator::GetStats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<SlabAllocatorStats> stats;
+    for (auto& pAllocator : m_pAllocators)
+    {
+        if (pAllocator != nullptr)
+            stats.push_back(pAllocator->GetStats());
+    }
+    return stats;
+}
@@ -0,0 +1,102 @@
+#include "Core/Util/ThreadPool.h"
+
+using namespace Bel;
+
+ThreadPool::ThreadPool()
+    : m_numActiveJobs(0)
+    , m_exit(false)
+{
+}
+
+ThreadPool::~ThreadPool()
+{
+    Shutdown();
+}
+
+bool ThreadPool::Initialize(size_t numThreads)
+{
+    if (IsRunning())
+        return true;
+
+    if (numThreads == 0)
+    {
+        const unsigned int kHardwareThreads = std::thread::hardware_concurrency();
+        numThreads = (kHardwareThreads > 1) ? (kHardwareThreads - 1) : 1;
+    }
+
+    m_exit = false;
+    m_workers.reserve(numThreads);
+    for (size_t i = 0; i < numThreads; ++i)
+    {
+        m_workers.emplace_back(&ThreadPool::ProcessJobs, this);
+    }
+
+    return true;
+}
+
+void ThreadPool::Shutdown()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_exit = true;
+        m_condVar.notify_all();
+    }
+
+    for (auto& worker : m_workers)
+    {
+        if (worker.joinable())
+            worker.join();
+    }
+    m_workers.clear();
+}
+
+void ThreadPool::AddJob(Job job)
+{
+    if (!IsRunning())
+    {
+        // No worker to hand it to, so run it in place.
+        job();
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_jobs.push(std::move(job));
+    }
+    m_condVar.notify_one();
+}
+
+void ThreadPool::Wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idleCondVar.wait(lock, [this]() { return m_jobs.empty() && m_numActiveJobs == 0; });
+}
+
+void ThreadPool::ProcessJobs()
+{
+    while (true)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condVar.wait(lock, [this]() { return m_exit || !m_jobs.empty(); });
+
+            // Drain the queue before leaving so that nobody waits on a dropped job.
+            if (m_jobs.empty())
+                return;
+
+            job = std::move(m_jobs.front());
+            m_jobs.pop();
+            ++m_numActiveJobs;
+        }
+
+        job();
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            --m_numActiveJobs;
+            if (m_jobs.empty() && m_numActiveJobs == 0)
+                m_idleCondVar.notify_all();
+        }
+    }
+}
@@ -3,6 +3,7 @@
 #include <SDL.h>
 
 #include "Graphics/Graphics.h"
+#include "Graphics/PixelImage.h"
 
 using namespace Bel;
 
@@ -235,8 +236,14 @@ public:
 
         auto pResCache = ApplicationLayer::GetInstance()->GetGameLayer()->GetResourceCache();
         auto pResource = pResCache->GetHandle(&Resource(pFileName));
+        std::string_view data = pResource->GetData();
 
-        return LoadTexture(IMG_Load_RW(SDL_RWFromMem(pResource->GetData().data(), static_cast<int>(pResource->GetData().size())), 0), pFileName);
+        // Packed images are already pixels, anything else goes through SDL_image.
+        if (PixelImage::IsPixelImage(data.data(), data.size()))
+        {
+            return LoadTexture(PixelImage::Decode(data.data(), data.size()), pFileName);
+        }
+        return LoadTexture(IMG_Load_RW(SDL_RWFromConstMem(data.data(), static_cast<int>(data.size())), 1), pFileName);
     }
     
     virtual std::shared_ptr<ITexture2D> LoadTextureDirectly(const char* pFileName) override
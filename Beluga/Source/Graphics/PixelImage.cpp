@@ -0,0 +1,79 @@
+#include <string.h>
+#include <memory>
+#include <SDL.h>
+
+#include "Graphics/PixelImage.h"
+
+using namespace Bel;
+
+// SDL_CreateTextureFromSurface() uploads this one without converting on the common renderers.
+static constexpr uint32_t kNativeFormat = SDL_PIXELFORMAT_ARGB8888;
+
+bool PixelImage::IsPixelImage(const char* pData, size_t size)
+{
+    if (size < sizeof(Header))
+        return false;
+
+    uint32_t magic;
+    memcpy(&magic, pData, sizeof(magic));
+    return magic == kMagic;
+}
+
+std::vector<char> PixelImage::Encode(SDL_Surface* pSurface)
+{
+    if (pSurface == nullptr)
+        return {};
+
+    std::unique_ptr<SDL_Surface, decltype(&SDL_FreeSurface)> pNative(SDL_ConvertSurfaceFormat(pSurface, kNativeFormat, 0), &SDL_FreeSurface);
+    if (pNative == nullptr || SDL_LockSurface(pNative.get()) != 0)
+        return {};
+
+    Header header;
+    header.m_magic          = kMagic;
+    header.m_version        = kVersion;
+    header.m_bytesPerPixel  = pNative->format->BytesPerPixel;
+    header.m_format         = kNativeFormat;
+    header.m_width          = static_cast<uint32_t>(pNative->w);
+    header.m_height         = static_cast<uint32_t>(pNative->h);
+    header.m_pitch          = header.m_width * header.m_bytesPerPixel;
+
+    std::vector<char> data(sizeof(Header) + static_cast<size_t>(header.m_pitch) * header.m_height);
+    memcpy(data.data(), &header, sizeof(Header));
+
+    // The surface may pad its rows, the image never does.
+    const char* pSrc = static_cast<const char*>(pNative->pixels);
+    char* pDest = data.data() + sizeof(Header);
+    for (uint32_t y = 0; y < header.m_height; ++y)
+    {
+        memcpy(pDest, pSrc, header.m_pitch);
+        pSrc += pNative->pitch;
+        pDest += header.m_pitch;
+    }
+
+    SDL_UnlockSurface(pNative.get());
+    return data;
+}
+
+SDL_Surface* PixelImage::Decode(const char* pData, size_t size)
+{
+    if (!IsPixelImage(pData, size))
+    {
+        SDL_SetError("Not a pixel image");
+        return nullptr;
+    }
+
+    Header header;
+    memcpy(&header, pData, sizeof(Header));
+    if (header.m_version != kVersion || header.m_bytesPerPixel != SDL_BYTESPERPIXEL(header.m_format)
+        || header.m_pitch != header.m_width * header.m_bytesPerPixel
+        || size - sizeof(Header) < static_cast<uint64_t>(header.m_pitch) * header.m_height)
+    {
+        SDL_SetError("Corrupt pixel image");
+        return nullptr;
+    }
+
+    // SDL never writes through the pointer while creating a texture from the surface.
+    void* pPixels = const_cast<char*>(pData + sizeof(Header));
+    return SDL_CreateRGBSurfaceWithFormatFrom(pPixels, static_cast<int>(header.m_width), static_cast<int>(header.m_height),
+        header.m_bytesPerPixel * 8, static_cast<int>(header.m_pitch), header.m_format);
+}
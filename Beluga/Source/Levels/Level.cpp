@@ -224,7 +224,7 @@ std::shared_ptr<Actor> Level::LoadTiles(ResourceCache* pResCache, std::string fi
         return nullptr;
     }
 
-    auto pActor = std::make_shared<Actor>(ApplicationLayer::GetInstance()->GetGameLayer()->GetActorFactory().GetNextActorId());
+    auto pActor = ApplicationLayer::GetInstance()->GetGameLayer()->GetActorFactory().CreateActorWithEmpty();
     size_t tileSize = m_layers[0].GetTiles().size();
 
     auto pTileComp = std::make_unique<TileSetComponent>(pActor.get(), "TileSetComponent");
@@ -356,18 +356,21 @@ void Level::ParseObject(ResourceCache* pResCache, XMLElement* pObject, XMLElemen
 
     auto& actorFactory = ApplicationLayer::GetInstance()->GetGameLayer()->GetActorFactory();
 
-    auto pResource = pResCache->GetHandle(&Resource(xml));
-    auto pActor = actorFactory.CreateActorByResource(pResource);
-    pActor->SetName(name);
-
     float ratio = m_tileData.begin()->second.GetRenderingRatio();
 
-    auto pTransform = pActor->GetComponent(kTransformId);
-    if (pTransform != nullptr)
+    // Every object of the same type is cloned from one prefab, only name and position differ.
+    auto pResource = pResCache->GetHandle(&Resource(xml));
+    auto pActor = actorFactory.CreateActorByResource(pResource, [&](Actor* pInstance)
     {
-        TransformComponent* pComponent = static_cast<TransformComponent*>(pTransform);
-        pComponent->SetPosition(pObject->FloatAttribute("x") * ratio, pObject->FloatAttribute("y") * ratio);
-    }
+        pInstance->SetName(name);
+
+        auto pTransform = pInstance->GetComponent(kTransformId);
+        if (pTransform != nullptr)
+        {
+            TransformComponent* pComponent = static_cast<TransformComponent*>(pTransform);
+            pComponent->SetPosition(pObject->FloatAttribute("x") * ratio, pObject->FloatAttribute("y") * ratio);
+        }
+    });
 
     auto pStaticBody = pActor->GetComponent(kStaticBodyId);
     if (pStaticBody != nullptr)
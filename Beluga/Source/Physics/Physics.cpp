@@ -139,6 +139,17 @@ namespace Lua
  *                      TransformComponent
  ***************************************************************/
 bool TransformComponent::Initialize(tinyxml2::XMLElement* pData)
+{
+    return InitializeFrom(pData);
+}
+
+bool TransformComponent::Initialize(const ActorDefinition::Element* pData)
+{
+    return InitializeFrom(pData);
+}
+
+template <class Element>
+bool TransformComponent::InitializeFrom(const Element* pData)
 {
     auto pElement = pData->FirstChildElement("Position");
     if (pElement != nullptr)
@@ -229,6 +240,10 @@ public:
 
     virtual ~Box2DStaticBody()
     {
+        // A prefab prototype never got a body, and may outlive the physics manager.
+        if (m_pBody == nullptr)
+            return;
+
         auto game = ApplicationLayer::GetInstance()->GetGameLayer();
         if (game != nullptr)
         {
@@ -239,15 +254,34 @@ public:
         {
             m_pBody->DestroyFixture(m_pFixture);
         }
-        if (m_pBody != nullptr)
-        {
-            m_pParentWorld->DestroyBody(m_pBody);
-        }
+        m_pParentWorld->DestroyBody(m_pBody);
     }
 
     const b2Fixture* GetFixture() { return m_pFixture; }
 
+    // Only the settings are copied, the body is created by PostInit() of the clone.
+    virtual std::unique_ptr<IActorComponent> Clone(Actor* pOwner) const override
+    {
+        auto pClone = std::make_unique<Box2DStaticBody>(*this);
+        pClone->SetOwner(pOwner);
+        pClone->m_pBody         = nullptr;
+        pClone->m_pFixture      = nullptr;
+        pClone->m_pTransform    = nullptr;
+        return pClone;
+    }
+
     virtual bool Initialize(tinyxml2::XMLElement* pData) override
+    {
+        return InitializeFrom(pData);
+    }
+
+    virtual bool Initialize(const ActorDefinition::Element* pData) override
+    {
+        return InitializeFrom(pData);
+    }
+
+    template <class Element>
+    bool InitializeFrom(const Element* pData)
     {
         auto pElement = pData->FirstChildElement("Dimensions");
         if (pElement != nullptr)
@@ -383,19 +417,31 @@ public:
     virtual ~Box2DDynamicBody()
     {
 
+        // A prefab prototype never got a body.
+        if (m_pBody == nullptr)
+            return;
+
         auto game = ApplicationLayer::GetInstance()->GetGameLayer();
         if (game != nullptr)
         {
             game->GetPhysicsManager().UnregisterDynamicBody(this);
         }
-        if (m_pBody != nullptr)
-        {
-            m_pParentWorld->DestroyBody(m_pBody);
-        }
+        m_pParentWorld->DestroyBody(m_pBody);
     }
     
     // other functions
     virtual bool Initialize(tinyxml2::XMLElement* pData) override
+    {
+        return InitializeFrom(pData);
+    }
+
+    virtual bool Initialize(const ActorDefinition::Element* pData) override
+    {
+        return InitializeFrom(pData);
+    }
+
+    template <class Element>
+    bool InitializeFrom(const Element* pData)
     {
         auto pElement = pData->FirstChildElement("Dimensions");
         if (pElement != nullptr)
@@ -428,7 +474,7 @@ public:
             m_gravityScale = pElement->FloatText();
         }
 
-        for (tinyxml2::XMLElement* pFixtureData = pData->FirstChildElement(); pFixtureData; pFixtureData = pFixtureData->NextSiblingElement())
+        for (auto pFixtureData = pData->FirstChildElement(); pFixtureData; pFixtureData = pFixtureData->NextSiblingElement())
         {
             pElement = pFixtureData->FirstChildElement("Type");
             if (pElement != nullptr)
@@ -506,6 +552,9 @@ public:
         return true;
     }
 
+    // Only reads its own body and moves its own transform, the world steps elsewhere.
+    virtual Access GetAccess() const override { return Access::kOwnActor; }
+
     virtual void Update(float delta) override
     {
         auto& pos = m_pBody->GetPosition();
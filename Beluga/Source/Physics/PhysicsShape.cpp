@@ -69,7 +69,8 @@ public:
     }
 
     virtual ~Box2DPhysicsShape() override {}
-    virtual void Initialize(XMLElement* pData) override {}
+    virtual void Initialize(const XMLElement* pData) override {}
+    virtual void Initialize(const ActorDefinition::Element* pData) override {}
     virtual void SetThisToFixture(IFixtureDef* pFixture) override {};
 
     virtual float GetDensity()  override { return m_density; }
@@ -116,7 +117,11 @@ public:
 
     virtual ~Box2DBoxShape() override {}
 
-    virtual void Initialize(XMLElement* pData) override final
+    virtual void Initialize(const XMLElement* pData) override final { InitializeFrom(pData); }
+    virtual void Initialize(const ActorDefinition::Element* pData) override final { InitializeFrom(pData); }
+
+    template <class Element>
+    void InitializeFrom(const Element* pData)
     {
         auto pElement = pData->FirstChildElement("Dimensions");
         if (pElement != nullptr)
@@ -187,7 +192,11 @@ public:
     }
     virtual ~Box2DCircleShape() override {}
 
-    virtual void Initialize(XMLElement* pData) override final
+    virtual void Initialize(const XMLElement* pData) override final { InitializeFrom(pData); }
+    virtual void Initialize(const ActorDefinition::Element* pData) override final { InitializeFrom(pData); }
+
+    template <class Element>
+    void InitializeFrom(const Element* pData)
     {
         auto pElement = pData->FirstChildElement("Radius");
         if (pElement != nullptr)
@@ -257,7 +266,11 @@ public:
     }
     virtual ~Box2DPolygonShape() override {}
 
-    virtual void Initialize(XMLElement* pData) override final
+    virtual void Initialize(const XMLElement* pData) override final { InitializeFrom(pData); }
+    virtual void Initialize(const ActorDefinition::Element* pData) override final { InitializeFrom(pData); }
+
+    template <class Element>
+    void InitializeFrom(const Element* pData)
     {
         auto pElement = pData->FirstChildElement("Radius");
         if (pElement != nullptr)
@@ -273,7 +286,7 @@ public:
         if (pElement != nullptr)
         {
             std::vector<b2Vec2> vertices;
-            for (XMLElement* pVertexElem = pElement->FirstChildElement(); pVertexElem; pVertexElem = pVertexElem->NextSiblingElement())
+            for (auto pVertexElem = pElement->FirstChildElement(); pVertexElem; pVertexElem = pVertexElem->NextSiblingElement())
             {
                 vertices.emplace_back(pVertexElem->FloatAttribute("x") / IPhysicsManager::GetPPM(), pVertexElem->FloatAttribute("y") / IPhysicsManager::GetPPM());
             }
@@ -323,7 +336,11 @@ public:
     }
     virtual ~Box2DChainShape() override {}
 
-    virtual void Initialize(XMLElement* pData) override final
+    virtual void Initialize(const XMLElement* pData) override final { InitializeFrom(pData); }
+    virtual void Initialize(const ActorDefinition::Element* pData) override final { InitializeFrom(pData); }
+
+    template <class Element>
+    void InitializeFrom(const Element* pData)
     {
         auto pElement = pData->FirstChildElement("Radius");
         if (pElement != nullptr)
@@ -340,7 +357,7 @@ public:
         std::vector<b2Vec2> vertices;
         if (pElement != nullptr)
         {
-            for (XMLElement* pVertexElem = pElement->FirstChildElement(); pVertexElem; pVertexElem = pVertexElem->NextSiblingElement())
+            for (auto pVertexElem = pElement->FirstChildElement(); pVertexElem; pVertexElem = pVertexElem->NextSiblingElement())
             {
                 vertices.emplace_back(pVertexElem->FloatAttribute("x") / IPhysicsManager::GetPPM(), pVertexElem->FloatAttribute("y") / IPhysicsManager::GetPPM());
             }
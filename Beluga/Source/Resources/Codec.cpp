@@ -0,0 +1,576 @@
+#include <string.h>
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Resources/Codec.h"
+#include "Resources/Resource.h"
+
+#define ZLIB_WINAPI
+#include "zlib.h"
+
+using namespace Bel;
+
+/******************************************************************************************
+                                        Stored
+******************************************************************************************/
+uint16_t StoredCodec::GetId() const
+{
+    return Pack::kCodecStored;
+}
+
+bool StoredCodec::Compress(const char* pSrc, size_t srcSize, std::vector<char>& out) const
+{
+    out.assign(pSrc, pSrc + srcSize);
+    return true;
+}
+
+bool StoredCodec::Decompress(const char* pSrc, size_t srcSize, char* pDest, size_t destSize) const
+{
+    if (srcSize != destSize)
+        return false;
+
+    memcpy(pDest, pSrc, srcSize);
+    return true;
+}
+
+/******************************************************************************************
+                                        Zlib
+******************************************************************************************/
+namespace
+{
+    /// Class Description
+    ///
+    /// inflateInit() allocates more state than a small entry takes to decode, so every thread
+    /// keeps one inflater per header kind and only resets it between entries.
+    class ReusableInflate
+    {
+    private:
+        z_stream m_stream;
+        int m_windowBits;
+        bool m_ready;
+
+    public:
+        explicit ReusableInflate(int windowBits) : m_windowBits(windowBits)
+        {
+            memset(&m_stream, 0, sizeof(m_stream));
+            m_ready = (inflateInit2(&m_stream, m_windowBits) == Z_OK);
+        }
+        ReusableInflate(const ReusableInflate& src) = delete;
+        ReusableInflate& operator=(const ReusableInflate& rhs) = delete;
+        ~ReusableInflate() { inflateEnd(&m_stream); }
+
+        // nullptr if zlib could not be set up.
+        z_stream* Reset(const char* pSrc, size_t srcSize, char* pDest, size_t destSize)
+        {
+            if (!m_ready || inflateReset(&m_stream) != Z_OK)
+                return nullptr;
+
+            m_stream.avail_in   = static_cast<uint32_t>(srcSize);
+            m_stream.next_in    = reinterpret_cast<Bytef*>(const_cast<char*>(pSrc));   // zlib never writes to the input.
+            m_stream.avail_out  = static_cast<uint32_t>(destSize);
+            m_stream.next_out   = reinterpret_cast<Bytef*>(pDest);
+            return &m_stream;
+        }
+    };
+}
+
+uint16_t ZlibCodec::GetId() const
+{
+    return Pack::kCodecZlib;
+}
+
+bool ZlibCodec::Compress(const char* pSrc, size_t srcSize, std::vector<char>& out) const
+{
+    out.resize(srcSize);
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.avail_in     = static_cast<uint32_t>(srcSize);
+    stream.next_in      = reinterpret_cast<Bytef*>(const_cast<char*>(pSrc));   // zlib never writes to the input.
+    stream.avail_out    = static_cast<uint32_t>(out.size());
+    stream.next_out     = reinterpret_cast<Bytef*>(out.data());
+
+    int result = deflateInit(&stream, Z_DEFAULT_COMPRESSION);
+    if (result != Z_OK)
+    {
+        return false;
+    }
+
+    result = deflate(&stream, Z_FINISH);
+    const bool kSmaller = (result == Z_STREAM_END && stream.total_out < srcSize && stream.avail_in == 0);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    return kSmaller;
+}
+
+bool ZlibCodec::Decompress(const char* pSrc, size_t srcSize, char* pDest, size_t destSize) const
+{
+    thread_local ReusableInflate t_inflate(MAX_WBITS);
+    z_stream* pStream = t_inflate.Reset(pSrc, srcSize, pDest, destSize);
+    return (pStream != nullptr && inflate(pStream, Z_FINISH) == Z_STREAM_END);
+}
+
+/******************************************************************************************
+                                        LZ
+******************************************************************************************/
+namespace
+{
+    constexpr size_t kMinMatch = 4;
+    constexpr size_t kLastLiterals = 5;         // The tail is always literals, matches stop before it.
+    constexpr size_t kMaxOffset = 0xFFFF;
+    constexpr uint32_t kHashBits = 16;
+    constexpr uint32_t kSkipTrigger = 6;        // Misses in a row before the scan starts to skip ahead.
+
+    inline uint32_t Read32(const uint8_t* p)
+    {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    inline uint32_t HashSequence(uint32_t sequence)
+    {
+        return (sequence * 2654435761u) >> (32 - kHashBits);
+    }
+
+    inline void WriteLength(std::vector<char>& out, size_t length)
+    {
+        while (length >= 255)
+        {
+            out.push_back(static_cast<char>(255));
+            length -= 255;
+        }
+        out.push_back(static_cast<char>(length));
+    }
+
+    void WriteSequence(std::vector<char>& out, const uint8_t* pLiterals, size_t literalLength, size_t offset, size_t matchLength)
+    {
+        const size_t kMatchCode = (matchLength > 0) ? matchLength - kMinMatch : 0;
+        const uint8_t kToken = static_cast<uint8_t>(((literalLength < 15 ? literalLength : 15) << 4) | (kMatchCode < 15 ? kMatchCode : 15));
+        out.push_back(static_cast<char>(kToken));
+
+        if (literalLength >= 15)
+            WriteLength(out, literalLength - 15);
+        out.insert(out.end(), pLiterals, pLiterals + literalLength);
+
+        if (matchLength == 0)
+            return;
+
+        out.push_back(static_cast<char>(offset & 0xFF));
+        out.push_back(static_cast<char>(offset >> 8));
+        if (kMatchCode >= 15)
+            WriteLength(out, kMatchCode - 15);
+    }
+
+    // Reads the extension bytes of a length that saturated its nibble.
+    inline bool ReadLength(const uint8_t*& pSrc, const uint8_t* pSrcEnd, size_t& length)
+    {
+        uint8_t byte;
+        do
+        {
+            if (pSrc >= pSrcEnd)
+                return false;
+            byte = *pSrc++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+}
+
+uint16_t LzCodec::GetId() const
+{
+    return Pack::kCodecLz;
+}
+
+bool LzCodec::Compress(const char* pSrc, size_t srcSize, std::vector<char>& out) const
+{
+    out.clear();
+    out.reserve(srcSize + srcSize / 255 + 16);
+
+    const uint8_t* pBase = reinterpret_cast<const uint8_t*>(pSrc);
+    const uint8_t* pEnd = pBase + srcSize;
+    const uint8_t* pAnchor = pBase;
+
+    if (srcSize > kMinMatch + kLastLiterals)
+    {
+        const uint8_t* pMatchLimit = pEnd - kLastLiterals;
+        std::vector<uint32_t> table(1 << kHashBits, 0);
+
+        const uint8_t* pCurrent = pBase;
+        uint32_t misses = 0;
+        while (pCurrent + kMinMatch <= pMatchLimit)
+        {
+            const uint32_t kSequence = Read32(pCurrent);
+            uint32_t& slot = table[HashSequence(kSequence)];
+            const uint8_t* pCandidate = pBase + slot;
+            slot = static_cast<uint32_t>(pCurrent - pBase);
+
+            if (pCandidate >= pCurrent || static_cast<size_t>(pCurrent - pCandidate) > kMaxOffset || Read32(pCandidate) != kSequence)
+            {
+                // Incompressible data is scanned faster the longer nothing is found.
+                pCurrent += 1 + (misses++ >> kSkipTrigger);
+                continue;
+            }
+
+            size_t length = kMinMatch;
+            while (pCurrent + length < pMatchLimit && pCandidate[length] == pCurrent[length])
+            {
+                ++length;
+            }
+
+            WriteSequence(out, pAnchor, pCurrent - pAnchor, pCurrent - pCandidate, length);
+            pCurrent += length;
+            pAnchor = pCurrent;
+            misses = 0;
+        }
+    }
+
+    WriteSequence(out, pAnchor, pEnd - pAnchor, 0, 0);
+    return out.size() < srcSize;
+}
+
+bool LzCodec::Decompress(const char* pSrc, size_t srcSize, char* pDest, size_t destSize) const
+{
+    const uint8_t* pIn = reinterpret_cast<const uint8_t*>(pSrc);
+    const uint8_t* pInEnd = pIn + srcSize;
+    uint8_t* pOut = reinterpret_cast<uint8_t*>(pDest);
+    uint8_t* pOutEnd = pOut + destSize;
+
+    while (pIn < pInEnd)
+    {
+        const uint8_t kToken = *pIn++;
+
+        size_t literalLength = kToken >> 4;
+        if (literalLength == 15 && !ReadLength(pIn, pInEnd, literalLength))
+            return false;
+
+        if (literalLength > static_cast<size_t>(pInEnd - pIn) || literalLength > static_cast<size_t>(pOutEnd - pOut))
+            return false;
+
+        memcpy(pOut, pIn, literalLength);
+        pIn += literalLength;
+        pOut += literalLength;
+
+        // The last sequence has no match.
+        if (pIn == pInEnd)
+            break;
+
+        if (pInEnd - pIn < 2)
+            return false;
+        const size_t kOffset = pIn[0] | (pIn[1] << 8);
+        pIn += 2;
+
+        size_t matchLength = kToken & 0x0F;
+        if (matchLength == 15 && !ReadLength(pIn, pInEnd, matchLength))
+            return false;
+        matchLength += kMinMatch;
+
+        if (kOffset == 0 || kOffset > static_cast<size_t>(pOut - reinterpret_cast<uint8_t*>(pDest)) || matchLength > static_cast<size_t>(pOutEnd - pOut))
+            return false;
+
+        const uint8_t* pMatch = pOut - kOffset;
+        if (kOffset >= matchLength)
+        {
+            memcpy(pOut, pMatch, matchLength);
+            pOut += matchLength;
+        }
+        else
+        {
+            // Overlapping copy repeats the last kOffset bytes, has to go forward one byte at a time.
+            for (size_t i = 0; i < matchLength; ++i)
+            {
+                *pOut++ = *pMatch++;
+            }
+        }
+    }
+
+    return pOut == pOutEnd;
+}
+
+/******************************************************************************************
+                                    Zlib + Dictionary
+******************************************************************************************/
+uint16_t ZlibDictionaryCodec::GetId() const
+{
+    return Pack::kCodecZlibDictionary;
+}
+
+bool ZlibDictionaryCodec::Compress(const char* pSrc, size_t srcSize, std::vector<char>& out) const
+{
+    out.resize(srcSize);
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.avail_in     = static_cast<uint32_t>(srcSize);
+    stream.next_in      = reinterpret_cast<Bytef*>(const_cast<char*>(pSrc));
+    stream.avail_out    = static_cast<uint32_t>(out.size());
+    stream.next_out     = reinterpret_cast<Bytef*>(out.data());
+
+    // Raw deflate, the zlib header and checksum would cost more than some of these entries save.
+    int result = deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    if (result != Z_OK)
+    {
+        return false;
+    }
+
+    if (!m_dictionary.empty())
+        result = deflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(m_dictionary.data()), static_cast<uInt>(m_dictionary.size()));
+
+    if (result == Z_OK)
+        result = deflate(&stream, Z_FINISH);
+    const bool kSmaller = (result == Z_STREAM_END && stream.total_out < srcSize && stream.avail_in == 0);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    return kSmaller;
+}
+
+bool ZlibDictionaryCodec::Decompress(const char* pSrc, size_t srcSize, char* pDest, size_t destSize) const
+{
+    thread_local ReusableInflate t_inflate(-MAX_WBITS);
+    z_stream* pStream = t_inflate.Reset(pSrc, srcSize, pDest, destSize);
+    if (pStream == nullptr)
+        return false;
+
+    // A raw inflater takes the dictionary up front instead of asking for it with Z_NEED_DICT.
+    if (!m_dictionary.empty()
+        && inflateSetDictionary(pStream, reinterpret_cast<const Bytef*>(m_dictionary.data()), static_cast<uInt>(m_dictionary.size())) != Z_OK)
+    {
+        return false;
+    }
+
+    return (inflate(pStream, Z_FINISH) == Z_STREAM_END);
+}
+
+namespace
+{
+    constexpr size_t kTrainingMatch = 8;        // Shortest run worth a dictionary byte, deflate needs at least 3.
+    constexpr size_t kTrainingSegment = 64;     // Dictionary content is picked in runs of this size...
+    constexpr size_t kTrainingStep = 32;        // ...starting this far apart in each sample.
+
+    inline uint64_t Read64(const char* p)
+    {
+        uint64_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    struct TrainingSegment
+    {
+        std::string_view m_bytes;
+        uint64_t m_score;
+
+        bool operator<(const TrainingSegment& rhs) const { return m_score < rhs.m_score; }
+    };
+
+    // How many samples share each of the segment's runs, counting a run once.
+    uint64_t ScoreSegment(std::string_view segment, const std::unordered_map<uint64_t, uint32_t>& sampleCounts)
+    {
+        std::unordered_set<uint64_t> seen;
+        uint64_t score = 0;
+        for (size_t i = 0; i + kTrainingMatch <= segment.size(); ++i)
+        {
+            const uint64_t kRun = Read64(segment.data() + i);
+            auto itr = sampleCounts.find(kRun);
+            if (itr != sampleCounts.end() && itr->second > 1 && seen.insert(kRun).second)
+                score += itr->second;
+        }
+        return score;
+    }
+}
+
+std::vector<char> Bel::TrainDictionary(const std::vector<std::string_view>& samples, size_t capacity)
+{
+    // Runs only help when another entry has them too, so count samples rather than occurrences.
+    std::unordered_map<uint64_t, uint32_t> sampleCounts;
+    for (std::string_view sample : samples)
+    {
+        std::unordered_set<uint64_t> seen;
+        for (size_t i = 0; i + kTrainingMatch <= sample.size(); ++i)
+        {
+            seen.insert(Read64(sample.data() + i));
+        }
+        for (uint64_t run : seen)
+        {
+            ++sampleCounts[run];
+        }
+    }
+
+    std::priority_queue<TrainingSegment> candidates;
+    for (std::string_view sample : samples)
+    {
+        for (size_t start = 0; start + kTrainingMatch <= sample.size(); start += kTrainingStep)
+        {
+            const std::string_view kBytes = sample.substr(start, kTrainingSegment);
+            const uint64_t kScore = ScoreSegment(kBytes, sampleCounts);
+            if (kScore > 0)
+                candidates.push({ kBytes, kScore });
+        }
+    }
+
+    // Greedy: take the best segment, then stop counting the runs it covers. Scores only ever drop,
+    // so a popped segment whose fresh score still beats the next one is the real best.
+    std::vector<std::string_view> picked;
+    size_t size = 0;
+    while (!candidates.empty() && size < capacity)
+    {
+        TrainingSegment best = candidates.top();
+        candidates.pop();
+
+        best.m_score = ScoreSegment(best.m_bytes, sampleCounts);
+        if (best.m_score == 0)
+            continue;
+        if (!candidates.empty() && best.m_score < candidates.top().m_score)
+        {
+            candidates.push(best);
+            continue;
+        }
+
+        for (size_t i = 0; i + kTrainingMatch <= best.m_bytes.size(); ++i)
+        {
+            sampleCounts.erase(Read64(best.m_bytes.data() + i));
+        }
+        picked.push_back(best.m_bytes);
+        size += best.m_bytes.size();
+    }
+
+    // Best last, it ends up nearest to the data.
+    std::vector<char> dictionary;
+    dictionary.reserve(size);
+    for (auto itr = picked.rbegin(); itr != picked.rend(); ++itr)
+    {
+        dictionary.insert(dictionary.end(), itr->begin(), itr->end());
+    }
+    if (dictionary.size() > capacity)
+        dictionary.erase(dictionary.begin(), dictionary.begin() + (dictionary.size() - capacity));
+
+    return dictionary;
+}
+
+/******************************************************************************************
+                                        Blocks
+******************************************************************************************/
+bool BlockCodec::Index::Read(const char* pSrc, size_t srcSize, uint64_t size)
+{
+    Header header;
+    if (srcSize < sizeof(Header))
+        return false;
+    memcpy(&header, pSrc, sizeof(Header));
+
+    const uint64_t kTableSize = static_cast<uint64_t>(header.m_numBlocks) * sizeof(uint32_t);
+    if (header.m_blockSize == 0 || kTableSize > srcSize - sizeof(Header)
+        || header.m_numBlocks != (size + header.m_blockSize - 1) / header.m_blockSize)
+    {
+        return false;
+    }
+
+    m_pEnds     = pSrc + sizeof(Header);
+    m_pBlocks   = m_pEnds + kTableSize;
+    m_size      = size;
+    m_blockSize = header.m_blockSize;
+    m_numBlocks = header.m_numBlocks;
+
+    // Ends only grow and stay inside the data, so no block can read past it.
+    const uint64_t kDataSize = srcSize - sizeof(Header) - kTableSize;
+    uint32_t previous = 0;
+    for (uint32_t i = 0; i < m_numBlocks; ++i)
+    {
+        uint32_t end;
+        memcpy(&end, m_pEnds + i * sizeof(uint32_t), sizeof(uint32_t));
+        if (end < previous || end > kDataSize)
+            return false;
+        previous = end;
+    }
+    return true;
+}
+
+size_t BlockCodec::Index::GetDecodedSize(uint32_t block) const
+{
+    return static_cast<size_t>(std::min<uint64_t>(m_blockSize, m_size - GetBlockStart(block)));
+}
+
+void BlockCodec::Index::GetCompressed(uint32_t block, const char*& pData, size_t& size) const
+{
+    // The table can sit at any alignment inside the pack.
+    uint32_t begin = 0;
+    uint32_t end;
+    if (block > 0)
+        memcpy(&begin, m_pEnds + (block - 1) * sizeof(uint32_t), sizeof(uint32_t));
+    memcpy(&end, m_pEnds + block * sizeof(uint32_t), sizeof(uint32_t));
+
+    pData = m_pBlocks + begin;
+    size = end - begin;
+}
+
+bool BlockCodec::Compress(const char* pSrc, size_t srcSize, std::vector<char>& out) const
+{
+    Header header;
+    header.m_blockSize = m_blockSize;
+    header.m_numBlocks = static_cast<uint32_t>((srcSize + m_blockSize - 1) / m_blockSize);
+
+    const size_t kTableSize = header.m_numBlocks * sizeof(uint32_t);
+    out.assign(sizeof(Header) + kTableSize, 0);
+    memcpy(out.data(), &header, sizeof(Header));
+
+    std::vector<char> block;
+    for (uint32_t i = 0; i < header.m_numBlocks; ++i)
+    {
+        const char* pBlock = pSrc + static_cast<size_t>(i) * m_blockSize;
+        const size_t kSize = std::min<size_t>(m_blockSize, srcSize - static_cast<size_t>(i) * m_blockSize);
+        if (m_inner.Compress(pBlock, kSize, block))
+            out.insert(out.end(), block.begin(), block.end());
+        else
+            out.insert(out.end(), pBlock, pBlock + kSize);
+
+        const uint32_t kEnd = static_cast<uint32_t>(out.size() - sizeof(Header) - kTableSize);
+        memcpy(out.data() + sizeof(Header) + i * sizeof(uint32_t), &kEnd, sizeof(uint32_t));
+    }
+
+    return out.size() < srcSize;
+}
+
+bool BlockCodec::Decompress(const char* pSrc, size_t srcSize, char* pDest, size_t destSize) const
+{
+    Index index;
+    if (!index.Read(pSrc, srcSize, destSize))
+        return false;
+
+    for (uint32_t i = 0; i < index.GetNumBlocks(); ++i)
+    {
+        if (!DecompressBlock(index, i, pDest + index.GetBlockStart(i)))
+            return false;
+    }
+    return true;
+}
+
+bool BlockCodec::DecompressBlock(const Index& index, uint32_t block, char* pDest) const
+{
+    const char* pData;
+    size_t size;
+    index.GetCompressed(block, pData, size);
+
+    const size_t kDecodedSize = index.GetDecodedSize(block);
+    if (size == kDecodedSize)
+    {
+        memcpy(pDest, pData, size);
+        return true;
+    }
+    return m_inner.Decompress(pData, size, pDest, kDecodedSize);
+}
+
+/******************************************************************************************
+                                        Registry
+******************************************************************************************/
+const ICodec* Bel::GetCodec(uint16_t id)
+{
+    static const StoredCodec s_stored;
+    static const ZlibCodec s_zlib;
+    static const LzCodec s_lz;
+    static const ZlibDictionaryCodec s_zlibDictionary;
+    static const ICodec* const s_codecs[Pack::kCodecCount] = { &s_stored, &s_zlib, &s_lz, &s_zlibDictionary };
+
+    return (id < Pack::kCodecCount) ? s_codecs[id] : nullptr;
+}
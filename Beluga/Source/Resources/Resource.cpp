@@ -1,8 +1,21 @@
 #include <algorithm>
+#include <cassert>
 #include <optional>
+#include <iostream>
+#include <filesystem>
+#include <chrono>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include "Resources/Resource.h"
+#include "Resources/Codec.h"
 #include "Core/Layers/ApplicationLayer.h"
+#include "Scripting/Scripting.h"
 
 #define ZLIB_WINAPI
 #include "zlib.h"
@@ -10,94 +23,568 @@
 using namespace Bel;
 using namespace tinyxml2;
 
+namespace Lua
+{
+    static void PushRanking(lua_State* pState, const ResourceCache::ResourceRanking& ranking)
+    {
+        lua_createtable(pState, static_cast<int>(ranking.size()), 0);
+        for (size_t i = 0; i < ranking.size(); ++i)
+        {
+            lua_createtable(pState, 0, 2);
+            lua_pushstring(pState, ranking[i].first.c_str());
+            lua_setfield(pState, -2, "name");
+            lua_pushnumber(pState, static_cast<double>(ranking[i].second));
+            lua_setfield(pState, -2, "value");
+            lua_rawseti(pState, -2, static_cast<lua_Integer>(i + 1));
+        }
+    }
+
+    static int ResourceCacheGetStats(lua_State* pState)
+    {
+        ResourceCache* pCache = reinterpret_cast<ResourceCache*>(lua_touserdata(pState, 1));
+        const ResourceCacheStats kStats = pCache->GetStats();
+        lua_pop(pState, 1);
+
+        lua_createtable(pState, 0, 8);
+        lua_pushnumber(pState, static_cast<double>(kStats.m_hits));
+        lua_setfield(pState, -2, "hits");
+        lua_pushnumber(pState, static_cast<double>(kStats.m_misses));
+        lua_setfield(pState, -2, "misses");
+        lua_pushnumber(pState, static_cast<double>(kStats.m_evictions));
+        lua_setfield(pState, -2, "evictions");
+        lua_pushnumber(pState, static_cast<double>(kStats.m_bytesResident));
+        lua_setfield(pState, -2, "bytesResident");
+        lua_pushnumber(pState, static_cast<double>(kStats.m_peakBytesResident));
+        lua_setfield(pState, -2, "peakBytesResident");
+        lua_pushnumber(pState, static_cast<double>(kStats.m_file.m_bytesRead));
+        lua_setfield(pState, -2, "bytesRead");
+        lua_pushnumber(pState, static_cast<double>(kStats.m_file.m_bytesInflated));
+        lua_setfield(pState, -2, "bytesInflated");
+        lua_pushnumber(pState, kStats.m_file.m_decodeMicroseconds / 1000.0);
+        lua_setfield(pState, -2, "decodeMilliseconds");
+        return 1;
+    }
+
+    static int ResourceCacheGetHottest(lua_State* pState)
+    {
+        ResourceCache* pCache = reinterpret_cast<ResourceCache*>(lua_touserdata(pState, 1));
+        size_t count = static_cast<size_t>(luaL_checkinteger(pState, 2));
+        lua_pop(pState, 2);
+
+        PushRanking(pState, pCache->GetHottest(count));
+        return 1;
+    }
+
+    static int ResourceCacheGetLargest(lua_State* pState)
+    {
+        ResourceCache* pCache = reinterpret_cast<ResourceCache*>(lua_touserdata(pState, 1));
+        size_t count = static_cast<size_t>(luaL_checkinteger(pState, 2));
+        lua_pop(pState, 2);
+
+        PushRanking(pState, pCache->GetLargest(count));
+        return 1;
+    }
+
+    static int ResourceCacheDumpStats(lua_State* pState)
+    {
+        ResourceCache* pCache = reinterpret_cast<ResourceCache*>(lua_touserdata(pState, 1));
+        std::string path = luaL_checkstring(pState, 2);
+        lua_pop(pState, 2);
+
+        lua_pushboolean(pState, pCache->DumpStats(path));
+        return 1;
+    }
+}
+
 /******************************************************************************************
                                         XML files
 ******************************************************************************************/
-void ZlibFile::AddResource(std::string path, std::vector<char> data)
+std::string ZlibFile::NormalizePath(std::string path)
 {
     std::transform(path.begin(), path.end(), path.begin(), ::tolower);
     std::replace(path.begin(), path.end(), '\\', '/');
+    return path;
+}
+
+// Codecs are weighed by what an entry costs at load time: reading its bytes plus decoding them.
+static constexpr double kReadSecondsPerByte = 1.0 / (100.0 * 1024.0 * 1024.0);
+
+// Below this decoding is too quick to time reliably, the smallest output wins.
+static constexpr size_t kMeasureDecodeMinSize = 64 * 1024;
+
+static double MeasureDecodeSeconds(const ICodec& codec, const std::vector<char>& compressed, std::vector<char>& scratch)
+{
+    const auto kStart = std::chrono::high_resolution_clock::now();
+    if (!codec.Decompress(compressed.data(), compressed.size(), scratch.data(), scratch.size()))
+    {
+        return -1.0;
+    }
+    return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - kStart).count();
+}
+
+std::string ZlibFile::GetDictionaryPath(const std::string& path)
+{
+    const std::string kNormalized = NormalizePath(path);
+    const size_t kDot = kNormalized.find_last_of("./");
+    if (kDot == std::string::npos || kNormalized[kDot] != '.' || kDot + 1 == kNormalized.size())
+        return std::string();
+
+    return kDictionaryPathPrefix + kNormalized.substr(kDot + 1);
+}
+
+ZlibFile::CompressedResource ZlibFile::CompressResource(std::string path, std::vector<char> data, std::string_view dictionary)
+{
+    CompressedResource resource;
+    resource.m_path = NormalizePath(std::move(path));
+    resource.m_size = static_cast<uint32_t>(data.size());
+    resource.m_codec = Pack::kCodecStored;
+    resource.m_contentHash = HashResourceData(data.data(), data.size());
+
+    const bool kMeasure = (data.size() >= kMeasureDecodeMinSize);
+    double bestCost = data.size() * kReadSecondsPerByte;
+    size_t bestSize = data.size();
+    std::vector<char> compressed;
+    std::vector<char> scratch(kMeasure ? data.size() : 0);
+
+    // Small entries are mostly the boilerplate their type shares, which the dictionary already holds.
+    const ZlibDictionaryCodec kDictionaryCodec(dictionary);
+    const bool kTryDictionary = (!dictionary.empty() && data.size() <= kMaxDictionaryEntrySize);
+    // Large ones are split into blocks, which costs a little ratio but lets them decode on every core and by range.
+    const bool kBlocked = (data.size() >= kMinBlockedEntrySize);
+    const BlockCodec kBlockedZlib(*GetCodec(Pack::kCodecZlib));
+    const BlockCodec kBlockedLz(*GetCodec(Pack::kCodecLz));
+
+    const ICodec* const kCandidates[] = 
+    {
+        kBlocked ? &kBlockedZlib : GetCodec(Pack::kCodecZlib),
+        kBlocked ? &kBlockedLz : GetCodec(Pack::kCodecLz),
+        kTryDictionary ? &kDictionaryCodec : nullptr 
+    };
+
+    // Zlib first, it keeps ties.
+    for (const ICodec* pCodec : kCandidates)
+    {
+        if (pCodec == nullptr || !pCodec->Compress(data.data(), data.size(), compressed))
+            continue;
+
+        if (kMeasure)
+        {
+            const double kDecodeSeconds = MeasureDecodeSeconds(*pCodec, compressed, scratch);
+            const double kCost = compressed.size() * kReadSecondsPerByte + kDecodeSeconds;
+            if (kDecodeSeconds < 0.0 || kCost >= bestCost)
+                continue;
+            bestCost = kCost;
+        }
+        else if (compressed.size() >= bestSize)
+        {
+            continue;
+        }
+
+        bestSize = compressed.size();
+        resource.m_codec = pCodec->GetId();
+        resource.m_flags = kBlocked ? Pack::kFlagBlocks : 0;
+        resource.m_data.swap(compressed);
+    }
+
+    if (resource.m_codec == Pack::kCodecStored)
+    {
+        // Compressed size is bigger, so just use uncompressed
+        resource.m_data = std::move(data);
+    }
+    return resource;
+}
+
+void ZlibFile::AddResource(std::string path, std::vector<char> data)
+{
+    AddCompressedResource(CompressResource(std::move(path), std::move(data)));
+}
+
+// A dictionary blob only decodes for paths that look up the same dictionary, i.e. have the same extension.
+static bool CanShareBlob(uint16_t codec, const std::string& blobPath, const std::string& path)
+{
+    return codec != Pack::kCodecZlibDictionary || ZlibFile::GetDictionaryPath(blobPath) == ZlibFile::GetDictionaryPath(path);
+}
+
+void ZlibFile::AddCompressedResource(CompressedResource resource)
+{
+    // Byte identical to something added before, e.g. the same tileset under two paths.
+    auto blobIter = m_addedBlobs.find(resource.m_contentHash);
+    if (blobIter != m_addedBlobs.end() && blobIter->second.m_info.m_size == resource.m_size
+        && CanShareBlob(blobIter->second.m_info.m_codec, blobIter->second.m_path, resource.m_path))
+    {
+        m_info[resource.m_path] = blobIter->second.m_info;
+        return;
+    }
 
     ResourceInfo info;
-    info.m_size = static_cast<uint32_t>(data.size());
+    info.m_size = resource.m_size;
     info.m_offset = m_currentOffset;
+    info.m_compressed = static_cast<uint32_t>(resource.m_data.size());
+    info.m_codec = resource.m_codec;
+    info.m_flags = resource.m_flags;
+    info.m_retained = false;
 
+    m_currentOffset += info.m_compressed;
+    m_info[resource.m_path] = info;
+    m_addedBlobs.emplace(resource.m_contentHash, AddedBlob{ info, resource.m_path });
+    m_pendingData.push_back(std::move(resource.m_data));
+}
 
-    std::vector<char> compressedData;
-    compressedData.resize(data.size());
+bool ZlibFile::AddAlias(const std::string& path, const std::string& target)
+{
+    auto iter = m_info.find(NormalizePath(target));
+    if (iter == m_info.end() || !CanShareBlob(iter->second.m_codec, iter->first, path))
+        return false;
 
-    z_stream stream;
-    memset(&stream, 0, sizeof(stream));
-    stream.avail_in = static_cast<uint32_t>(data.size());               // How much data are we gonna depress
-    stream.next_in = reinterpret_cast<uint8_t*>(data.data());           // Where the pointer to that data ia
-    stream.avail_out = static_cast<uint32_t>(compressedData.size());    // How much space we have available to write out into
-    stream.next_out = reinterpret_cast<uint8_t*>(compressedData.data());// The actual pointer
+    // Copied, so replacing or removing target later leaves the alias alone.
+    ResourceInfo info = iter->second;
+    m_info[NormalizePath(path)] = info;
+    return true;
+}
+
+bool ZlibFile::RemoveResource(const std::string& path)
+{
+    return m_info.erase(NormalizePath(path)) > 0;
+}
 
-    int result = deflateInit(&stream, Z_DEFAULT_COMPRESSION);
-    if (result != Z_OK)
+std::vector<std::string> ZlibFile::GetResourceNames() const
+{
+    std::vector<std::string> names;
+    if (m_pEntries != nullptr && !m_updating)
     {
-        return;
+        names.reserve(m_numEntries);
+        for (uint32_t i = 0; i < m_numEntries; ++i)
+        {
+            names.emplace_back(GetEntryName(m_pEntries[i]));
+        }
+        return names;
     }
 
-    result = deflate(&stream, Z_FINISH);
+    names.reserve(m_info.size());
+    for (auto& info : m_info)
+    {
+        names.push_back(info.first);
+    }
+    return names;
+}
+
+bool ZlibFile::OpenForUpdate(const std::string& path, float compactRatio)
+{
+    Reset();
+    if (!LoadMapped(path))
+        return false;
+
+    // Every entry starts out retained, new data goes right after the existing one.
+    for (uint32_t i = 0; i < m_numEntries; ++i)
+    {
+        const Pack::Entry& entry = m_pEntries[i];
+
+        ResourceInfo info;
+        info.m_compressed   = entry.m_compressed;
+        info.m_size         = entry.m_size;
+        info.m_offset       = entry.m_offset;
+        info.m_codec        = entry.m_codec;
+        info.m_flags        = entry.m_flags;
+        info.m_retained     = true;
+        m_info[GetEntryName(entry)] = info;
+    }
+
+    m_currentOffset = m_packSize;
+    m_compactRatio = compactRatio;
+    m_updating = true;
+    return true;
+}
+
+uint64_t ZlibFile::GetDeadBytes() const
+{
+    if (!m_updating)
+        return 0;
+
+    // Aliases share a blob, count each one once.
+    std::unordered_map<uint64_t, uint32_t> liveBlobs;
+    for (auto& info : m_info)
+    {
+        if (info.second.m_retained)
+        {
+            uint32_t& compressed = liveBlobs[info.second.m_offset];
+            compressed = std::max(compressed, info.second.m_compressed);
+        }
+    }
 
-    if (result == Z_STREAM_END && stream.total_out < data.size() && stream.avail_in == 0)
+    uint64_t live = 0;
+    for (auto& blob : liveBlobs)
     {
-        compressedData.resize(stream.total_out);
+        live += blob.second;
     }
+    return m_dataSize - live;
+}
+
+// The packer and the tests save packs without an application to log to.
+static void LogPackError(const std::string& message)
+{
+    if (ApplicationLayer::GetInstance() != nullptr)
+        LOG_ERROR(message);
     else
+        std::cerr << message << std::endl;
+}
+
+bool ZlibFile::Save(const std::string& path)
+{
+    // A table that can't be written must not cost the old pack, or leave data without one.
+    if (!CheckPathHashes())
+        return false;
+
+    if (m_updating)
     {
-        // Compressed size is bigger, so just use uncompressed
-        compressedData = std::move(data);
+        const bool kResult = SaveUpdate(path);
+        Reset();
+        return kResult;
     }
-    deflateEnd(&stream);
 
-    info.m_compressed = static_cast<uint32_t>(compressedData.size());
-    m_currentOffset += info.m_compressed;
-    m_info[path] = info;
-    m_pendingData.push_back(std::move(compressedData));
+    bool result = false;
+    std::fstream file(path, std::ios_base::out | std::ios_base::binary);
+    if (file.is_open())
+    {
+        for (auto& data : m_pendingData)
+        {
+            file.write(data.data(), data.size());
+        }
+        result = WriteTable(file, m_currentOffset);
+        file.close();
+        result = result && !file.fail();
+    }
+    Reset();
+
+    if (!result)
+        LogPackError("Unable to write resource pack: " + path);
+    return result;
 }
 
-void ZlibFile::Save(const std::string& path)
+bool ZlibFile::SaveUpdate(const std::string& path)
 {
-    tinyxml2::XMLDocument doc;
-    XMLElement* pRoot = doc.NewElement("ResourceFile");
-    doc.InsertFirstChild(pRoot);
+    const uint64_t kDeadBytes = GetDeadBytes();
+
+    if (kDeadBytes <= static_cast<uint64_t>(m_dataSize * m_compactRatio))
+    {
+        // Append: nothing up to the old footer is touched, the added data, the new table and its footer
+        // follow it. Until the new footer is complete the old one is what the pack ends with, so a failed
+        // write is undone by cutting the file back.
+        // Handles still pointing into the pack keep the old mapping open, which Windows won't resize.
+        m_pMapping.reset();
+        m_pEntries = nullptr;
+
+        std::fstream file(path, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+        if (!file.is_open())
+        {
+            LogPackError("Unable to open resource pack for update: " + path);
+            return false;
+        }
+
+        file.seekp(m_packSize);
+        for (auto& data : m_pendingData)
+        {
+            file.write(data.data(), data.size());
+        }
+
+        bool result = WriteTable(file, m_currentOffset);
+        file.close();
+        result = result && !file.fail();
+        if (!result)
+        {
+            std::error_code error;
+            std::filesystem::resize_file(path, m_packSize, error);
+            LogPackError("Unable to append to resource pack: " + path);
+        }
+        return result;
+    }
+
+    // Compact: copy the live data into a fresh pack, in their current order.
+    std::string tempPath = path + ".tmp";
+    std::fstream file(tempPath, std::ios_base::out | std::ios_base::binary);
+    if (!file.is_open())
+    {
+        LogPackError("Unable to create " + tempPath);
+        return false;
+    }
 
+    std::vector<ResourceInfo*> retained;
     for (auto& info : m_info)
     {
-        XMLElement* pElement = doc.NewElement("Resource");
-        pElement->SetAttribute("Path", info.first.c_str());
-        pElement->SetAttribute("Compressed", info.second.m_compressed);
-        pElement->SetAttribute("Size", info.second.m_size);
-        pElement->SetAttribute("Offset", info.second.m_offset);
-        pRoot->InsertEndChild(pElement);
+        if (info.second.m_retained)
+            retained.push_back(&info.second);
     }
+    // An empty entry can sit at the same offset as the blob after it, the blob has to come first.
+    std::sort(retained.begin(), retained.end(), [](const ResourceInfo* pLhs, const ResourceInfo* pRhs) 
+    {
+        return (pLhs->m_offset != pRhs->m_offset) ? pLhs->m_offset < pRhs->m_offset : pLhs->m_compressed > pRhs->m_compressed;
+    });
 
-    XMLPrinter print;
-    doc.Print(&print);
+    // Several entries may share a blob, so map old offsets rather than entries.
+    std::unordered_map<uint64_t, uint64_t> newOffsets;
+    uint64_t offset = 0;
+    for (ResourceInfo* pInfo : retained)
+    {
+        auto result = newOffsets.emplace(pInfo->m_offset, offset);
+        if (result.second)
+        {
+            file.write(m_pMapping->GetData() + pInfo->m_offset, pInfo->m_compressed);
+            offset += pInfo->m_compressed;
+        }
+        pInfo->m_offset = result.first->second;
+    }
 
-    m_file.open(path, std::ios_base::out | std::ios_base::binary);
-    if (m_file.is_open())
+    for (auto& info : m_info)
     {
-        for (auto& data : m_pendingData)
+        if (!info.second.m_retained)
+            info.second.m_offset = info.second.m_offset - m_packSize + offset;
+    }
+    for (auto& data : m_pendingData)
+    {
+        file.write(data.data(), data.size());
+        offset += data.size();
+    }
+
+    bool result = WriteTable(file, offset);
+    file.close();
+    result = result && !file.fail();
+
+    m_pMapping.reset();
+    m_pEntries = nullptr;
+
+    // The old pack is only replaced by a complete one.
+    std::error_code error;
+    if (result)
+        std::filesystem::rename(tempPath, path, error);
+    if (!result || error)
+    {
+        std::filesystem::remove(tempPath, error);
+        LogPackError("Unable to compact resource pack: " + path);
+        return false;
+    }
+    return true;
+}
+
+bool ZlibFile::CheckPathHashes() const
+{
+    std::unordered_map<uint64_t, const std::string*> paths;
+    paths.reserve(m_info.size());
+    for (auto& info : m_info)
+    {
+        auto result = paths.emplace(HashResourcePath(info.first), &info.first);
+        if (!result.second)
         {
-            m_file.write(data.data(), data.size());
+            LogPackError("Resource path hash collision: " + info.first + ", " + *result.first->second);
+            return false;
         }
-        m_file.write(print.CStr(), print.CStrSize());
+    }
+    return true;
+}
 
-        // write out the size of our header
-        int size = print.CStrSize();
-        m_file.write(reinterpret_cast<char*>(&size), sizeof(int));
+bool ZlibFile::WriteTable(std::ostream& out, uint64_t tocOffset)
+{
+    std::vector<Pack::Entry> entries;
+    std::string names;
+    entries.reserve(m_info.size());
 
-        m_pendingData.clear();
-        m_info.clear();
-        m_currentOffset = 0;
+    for (auto& info : m_info)
+    {
+        Pack::Entry entry;
+        entry.m_hash        = HashResourcePath(info.first);
+        entry.m_offset      = info.second.m_offset;
+        entry.m_compressed  = info.second.m_compressed;
+        entry.m_size        = info.second.m_size;
+        entry.m_nameOffset  = static_cast<uint32_t>(names.size());
+        entry.m_codec       = info.second.m_codec;
+        entry.m_flags       = info.second.m_flags;
+        entries.push_back(entry);
+
+        names.append(info.first);
+        names.push_back('\0');
     }
-    m_file.close();
+
+    // Sorted by hash so that lookups are a binary search over the mapped table. Save() made sure
+    // the hashes are unique.
+    std::sort(entries.begin(), entries.end(), [](const Pack::Entry& lhs, const Pack::Entry& rhs) { return lhs.m_hash < rhs.m_hash; });
+
+    Pack::Footer footer;
+    footer.m_tocOffset      = tocOffset;
+    footer.m_namesOffset    = footer.m_tocOffset + entries.size() * sizeof(Pack::Entry);
+    footer.m_namesSize      = static_cast<uint32_t>(names.size());
+    footer.m_numEntries     = static_cast<uint32_t>(entries.size());
+    footer.m_version        = Pack::kVersion;
+    footer.m_magic          = Pack::kMagic;
+
+    out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Pack::Entry));
+    out.write(names.data(), names.size());
+    out.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+
+    return out.good();
+}
+
+void ZlibFile::Reset()
+{
+    m_pMapping.reset();
+    m_pEntries = nullptr;
+    m_pNames = nullptr;
+    m_numEntries = 0;
+    m_dataSize = 0;
+    m_packSize = 0;
+    m_updating = false;
+
+    m_pendingData.clear();
+    m_info.clear();
+    m_addedBlobs.clear();
+    m_currentOffset = 0;
 }
 
 bool ZlibFile::Load(const std::string& path)
+{
+    if (LoadMapped(path))
+        return true;
+
+    return LoadLegacy(path);
+}
+
+bool ZlibFile::LoadMapped(const std::string& path)
+{
+    m_pMapping = std::make_shared<MappedFile>();
+    if (!m_pMapping->Open(path))
+    {
+        m_pMapping.reset();
+        return false;
+    }
+
+    const char* pBase = m_pMapping->GetData();
+    const size_t kSize = m_pMapping->GetSize();
+
+    if (kSize < sizeof(Pack::Footer))
+    {
+        m_pMapping.reset();
+        return false;
+    }
+
+    Pack::Footer footer;
+    memcpy(&footer, pBase + kSize - sizeof(footer), sizeof(footer));
+
+    // Not a version 2 pack, leave it to the XML header path.
+    if (footer.m_magic != Pack::kMagic || footer.m_version != Pack::kVersion
+        || footer.m_tocOffset + static_cast<uint64_t>(footer.m_numEntries) * sizeof(Pack::Entry) > footer.m_namesOffset
+        || footer.m_namesOffset + footer.m_namesSize + sizeof(footer) > kSize)
+    {
+        m_pMapping.reset();
+        return false;
+    }
+
+    m_pEntries      = reinterpret_cast<const Pack::Entry*>(pBase + footer.m_tocOffset);
+    m_numEntries    = footer.m_numEntries;
+    m_pNames        = pBase + footer.m_namesOffset;
+    m_dataSize      = footer.m_tocOffset;
+    m_packSize      = kSize;
+
+    return true;
+}
+
+bool ZlibFile::LoadLegacy(const std::string& path)
 {
     m_file.open(path, std::ios_base::in | std::ios_base::binary);
     if (m_file.is_open())
@@ -132,6 +619,9 @@ bool ZlibFile::Load(const std::string& path)
                     info.m_compressed   = pElement->UnsignedAttribute("Compressed");
                     info.m_size         = pElement->UnsignedAttribute("Size");
                     info.m_offset       = pElement->UnsignedAttribute("Offset");
+                    info.m_codec        = (info.m_compressed == info.m_size) ? Pack::kCodecStored : Pack::kCodecZlib;
+                    info.m_flags        = 0;
+                    info.m_retained     = false;
                     std::string path    = pElement->Attribute("Path");
                     if (!path.empty())
                     {
@@ -145,521 +635,1422 @@ bool ZlibFile::Load(const std::string& path)
     return false;
 }
 
-std::shared_ptr<ResourceHandle> ZlibFile::LoadResource(std::string path)
+const Pack::Entry* ZlibFile::FindEntry(ResourceId id) const
 {
-    if (!m_file.is_open())
-    {
+    if (m_pEntries == nullptr)
+        return nullptr;
+
+    const uint64_t kHash = id.GetHash();
+    const Pack::Entry* pEnd = m_pEntries + m_numEntries;
+    const Pack::Entry* pEntry = std::lower_bound(m_pEntries, pEnd, kHash, 
+        [](const Pack::Entry& entry, uint64_t hash) { return entry.m_hash < hash; });
+
+    if (pEntry == pEnd || pEntry->m_hash != kHash)
         return nullptr;
+
+    return pEntry;
+}
+
+uint64_t ZlibFile::GetContentId(ResourceId id) const
+{
+    const Pack::Entry* pEntry = FindEntry(id);
+    if (pEntry == nullptr || pEntry->m_compressed == 0)
+        return 0;
+
+    // Aliases were written with the same offset. Never 0, so it can't be mistaken for unknown.
+    return pEntry->m_offset + 1;
+}
+
+ResourceFileStats ZlibFile::GetStats() const
+{
+    ResourceFileStats stats;
+    stats.m_bytesRead           = m_bytesRead;
+    stats.m_bytesInflated       = m_bytesInflated;
+    stats.m_decodeMicroseconds  = m_decodeMicroseconds;
+    return stats;
+}
+
+bool ZlibFile::Decode(const ICodec& codec, const char* pSrc, size_t srcSize, char* pDest, size_t destSize)
+{
+    const auto kStart = std::chrono::steady_clock::now();
+    const bool kResult = codec.Decompress(pSrc, srcSize, pDest, destSize);
+    m_decodeMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - kStart).count();
+
+    if (kResult)
+        m_bytesInflated += destSize;
+    return kResult;
+}
+
+bool ZlibFile::DecodeBlocks(const BlockCodec& codec, const BlockCodec::Index& index, uint32_t first, uint32_t last, char* pDest)
+{
+    // Shared with the helpers, one that only starts after the decode finished must still find it.
+    struct BlockJob
+    {
+        std::atomic<uint32_t> m_next;
+        std::atomic<uint32_t> m_numDone;
+        std::atomic<bool> m_failed;
+
+        // Signalled by whoever finishes the last block.
+        std::mutex m_mutex;
+        std::condition_variable m_done;
+    };
+    auto pJob = std::make_shared<BlockJob>();
+    pJob->m_next = first;
+    pJob->m_numDone = 0;
+    pJob->m_failed = false;
+
+    // Helpers claim blocks until none are left, so a late one never touches the arguments.
+    const uint32_t kNumBlocks = last - first;
+    auto decode = [this, pJob, &codec, &index, first, last, kNumBlocks, pDest]()
+    {
+        for (uint32_t block = pJob->m_next++; block < last; block = pJob->m_next++)
+        {
+            if (!pJob->m_failed)
+            {
+                char* pBlockDest = pDest + (index.GetBlockStart(block) - index.GetBlockStart(first));
+                const auto kStart = std::chrono::steady_clock::now();
+                const bool kResult = codec.DecompressBlock(index, block, pBlockDest);
+                m_decodeMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - kStart).count();
+
+                if (kResult)
+                    m_bytesInflated += index.GetDecodedSize(block);
+                else
+                    pJob->m_failed = true;
+            }
+
+            if (++pJob->m_numDone == kNumBlocks)
+            {
+                std::lock_guard<std::mutex> lock(pJob->m_mutex);
+                pJob->m_done.notify_all();
+            }
+        }
+    };
+
+    // Helpers only come from the pool the owner lent, never a pool of our own per file.
+    ThreadPool* pThreads = m_pBlockThreads;
+    if (kNumBlocks > 1 && pThreads != nullptr && pThreads->IsRunning())
+    {
+        const size_t kNumHelpers = std::min<size_t>(kNumBlocks - 1, pThreads->GetNumThreads());
+        for (size_t i = 0; i < kNumHelpers; ++i)
+        {
+            pThreads->AddJob(decode);
+        }
     }
 
-    std::transform(path.begin(), path.end(), path.begin(), std::tolower);
-    std::replace(path.begin(), path.end(), '\\', '/');
+    // The loading thread works too, so a busy pool only makes this slower, never stuck. It then
+    // sleeps until the helpers that claimed the remaining blocks are through with them.
+    decode();
+    std::unique_lock<std::mutex> lock(pJob->m_mutex);
+    pJob->m_done.wait(lock, [&pJob, kNumBlocks]() { return pJob->m_numDone == kNumBlocks; });
+    return !pJob->m_failed;
+}
 
-    auto itr = m_info.find(path);
-    if (itr == m_info.end())
+std::string_view ZlibFile::FindDictionary(const Pack::Entry& entry) const
+{
+    const Pack::Entry* pDictionary = FindEntry(GetDictionaryPath(GetEntryName(entry)));
+    if (pDictionary == nullptr || pDictionary->m_codec != Pack::kCodecStored
+        || pDictionary->m_offset + pDictionary->m_size > m_pMapping->GetSize())
     {
-        return nullptr;
+        return std::string_view();
     }
 
-    std::vector<char> compressed(itr->second.m_compressed);
-    m_file.seekg(itr->second.m_offset);
-    m_file.read(compressed.data(), compressed.size());
+    // Stored, so the dictionary is used straight from the mapping with no per-entry copy.
+    return std::string_view(m_pMapping->GetData() + pDictionary->m_offset, pDictionary->m_size);
+}
 
-    if (itr->second.m_size == itr->second.m_compressed)
+std::shared_ptr<ResourceHandle> ZlibFile::LoadResource(std::string path)
+{
+    if (m_pEntries == nullptr)
     {
-        return std::make_shared<ResourceHandle>(Resource(path), move(compressed), m_pCache);
+        return LoadLegacyResource(std::move(path));
     }
+    return LoadResource(Resource(path));
+}
 
-    std::vector<char> data(itr->second.m_size);
+std::shared_ptr<ResourceHandle> ZlibFile::LoadResource(const Resource& resource)
+{
+    if (m_pEntries == nullptr)
+    {
+        return LoadLegacyResource(resource.GetName());
+    }
 
-    z_stream stream;
-    memset(&stream, 0, sizeof(stream));
-    stream.avail_in     = static_cast<uint32_t>(compressed.size());
-    stream.next_in      = reinterpret_cast<uint8_t*>(compressed.data());
-    stream.avail_out    = static_cast<uint32_t>(data.size());
-    stream.next_out     = reinterpret_cast<uint8_t*>(data.data());
-    int result = inflateInit(&stream);
-    if (result != Z_OK)
+    const Pack::Entry* pEntry = FindEntry(resource.GetId());
+    if (pEntry == nullptr || pEntry->m_offset + pEntry->m_compressed > m_pMapping->GetSize())
     {
         return nullptr;
     }
 
-    result = inflate(&stream, Z_FINISH);
-    if (result != Z_STREAM_END)
+    const char* pSrc = m_pMapping->GetData() + pEntry->m_offset;
+
+    m_bytesRead += pEntry->m_compressed;
+    if (pEntry->m_codec == Pack::kCodecStored)
     {
-        return nullptr;
+        // Never copied, the handle points into the mapping and keeps it alive.
+        return std::make_shared<ResourceHandle>(resource, std::string_view(pSrc, pEntry->m_size), m_pMapping, m_pCache);
+    }
+
+    const ICodec* pCodec = GetCodec(pEntry->m_codec);
+    if (pEntry->m_flags & Pack::kFlagBlocks)
+    {
+        BlockCodec::Index index;
+        std::vector<char> data(pEntry->m_size);
+        if (pCodec == nullptr || !index.Read(pSrc, pEntry->m_compressed, pEntry->m_size)
+            || !DecodeBlocks(BlockCodec(*pCodec), index, 0, index.GetNumBlocks(), data.data()))
+        {
+            return nullptr;
+        }
+        return std::make_shared<ResourceHandle>(resource, std::move(data), m_pCache);
+    }
+
+    ZlibDictionaryCodec dictionaryCodec;
+    if (pEntry->m_codec == Pack::kCodecZlibDictionary)
+    {
+        const std::string_view kDictionary = FindDictionary(*pEntry);
+        if (kDictionary.data() == nullptr)
+        {
+            return nullptr;
+        }
+        dictionaryCodec = ZlibDictionaryCodec(kDictionary);
+        pCodec = &dictionaryCodec;
+    }
+
+    std::vector<char> data(pEntry->m_size);
+    if (pCodec == nullptr || !Decode(*pCodec, pSrc, pEntry->m_compressed, data.data(), data.size()))
+    {
+        return nullptr;
+    }
+
+    return std::make_shared<ResourceHandle>(resource, std::move(data), m_pCache);
+}
+
+std::unique_ptr<IResourceStream> ZlibFile::OpenStream(std::string path, size_t windowSize)
+{
+    const Pack::Entry* pEntry = (m_pEntries != nullptr) ? FindEntry(path) : nullptr;
+    if (pEntry != nullptr && pEntry->m_offset + pEntry->m_compressed <= m_pMapping->GetSize())
+    {
+        const char* pSrc = m_pMapping->GetData() + pEntry->m_offset;
+        if (pEntry->m_codec == Pack::kCodecStored)
+        {
+            m_bytesRead += pEntry->m_compressed;
+            return std::make_unique<MemoryResourceStream>(pSrc, pEntry->m_size, m_pMapping);
+        }
+        if (pEntry->m_flags & Pack::kFlagBlocks)
+        {
+            const ICodec* pCodec = GetCodec(pEntry->m_codec);
+            auto pStream = (pCodec != nullptr) ? std::make_unique<BlockResourceStream>(pSrc, pEntry->m_compressed, pEntry->m_size, *pCodec, m_pMapping) : nullptr;
+            if (pStream == nullptr || !pStream->IsValid())
+                return nullptr;
+
+            m_bytesRead += pEntry->m_compressed;
+            m_bytesInflated += pEntry->m_size;
+            return pStream;
+        }
+        if (pEntry->m_codec == Pack::kCodecZlib)
+        {
+            m_bytesRead += pEntry->m_compressed;
+            m_bytesInflated += pEntry->m_size;
+            return std::make_unique<InflateResourceStream>(pSrc, pEntry->m_compressed, pEntry->m_size, m_pMapping, windowSize);
+        }
+    }
+
+    // Other codecs and version 1 packs are decoded whole, the stream then owns the data.
+    std::shared_ptr<ResourceHandle> pHandle = LoadResource(std::move(path));
+    if (pHandle == nullptr)
+    {
+        return nullptr;
+    }
+    return std::make_unique<MemoryResourceStream>(pHandle->GetData().data(), pHandle->GetData().size(), pHandle);
+}
+
+bool ZlibFile::ReadRange(const std::string& path, uint64_t offset, char* pDest, size_t size)
+{
+    const Pack::Entry* pEntry = (m_pEntries != nullptr) ? FindEntry(path) : nullptr;
+    if (pEntry != nullptr && (pEntry->m_flags & Pack::kFlagBlocks) && pEntry->m_offset + pEntry->m_compressed <= m_pMapping->GetSize())
+    {
+        const ICodec* pCodec = GetCodec(pEntry->m_codec);
+        const char* pSrc = m_pMapping->GetData() + pEntry->m_offset;
+        BlockCodec::Index index;
+        if (pCodec == nullptr || offset + size > pEntry->m_size || !index.Read(pSrc, pEntry->m_compressed, pEntry->m_size))
+            return false;
+        if (size == 0)
+            return true;
+
+        const uint32_t kFirst = static_cast<uint32_t>(offset / index.GetBlockSize());
+        const uint32_t kLast = static_cast<uint32_t>((offset + size - 1) / index.GetBlockSize()) + 1;
+        for (uint32_t block = kFirst; block < kLast; ++block)
+        {
+            const char* pBlock;
+            size_t compressed;
+            index.GetCompressed(block, pBlock, compressed);
+            m_bytesRead += compressed;
+        }
+
+        // Whole blocks are decoded, only the range is copied out of them.
+        std::vector<char> blocks(static_cast<size_t>(std::min<uint64_t>(pEntry->m_size, index.GetBlockStart(kLast)) - index.GetBlockStart(kFirst)));
+        if (!DecodeBlocks(BlockCodec(*pCodec), index, kFirst, kLast, blocks.data()))
+            return false;
+
+        memcpy(pDest, blocks.data() + (offset - index.GetBlockStart(kFirst)), size);
+        return true;
+    }
+
+    std::shared_ptr<ResourceHandle> pHandle = LoadResource(path);
+    if (pHandle == nullptr || offset + size > pHandle->GetSize())
+        return false;
+
+    memcpy(pDest, pHandle->GetData().data() + offset, size);
+    return true;
+}
+
+std::shared_ptr<ResourceHandle> ZlibFile::LoadLegacyResource(std::string path)
+{
+    if (!m_file.is_open())
+    {
+        return nullptr;
+    }
+
+    std::transform(path.begin(), path.end(), path.begin(), std::tolower);
+    std::replace(path.begin(), path.end(), '\\', '/');
+
+    auto itr = m_info.find(path);
+    if (itr == m_info.end())
+    {
+        return nullptr;
+    }
+
+    std::vector<char> compressed(itr->second.m_compressed);
+    {
+        // Only the read is serialized, inflating runs in parallel on the loader threads.
+        std::lock_guard<std::mutex> lock(m_fileMutex);
+        m_file.seekg(itr->second.m_offset);
+        m_file.read(compressed.data(), compressed.size());
+    }
+    m_bytesRead += compressed.size();
+
+    if (itr->second.m_size == itr->second.m_compressed)
+    {
+        return std::make_shared<ResourceHandle>(Resource(path), move(compressed), m_pCache);
+    }
+
+    std::vector<char> data(itr->second.m_size);
+    if (!Decode(ZlibCodec(), compressed.data(), compressed.size(), data.data(), data.size()))
+    {
+        return nullptr;
+    }
+
+    return std::make_shared<ResourceHandle>(Resource(path), std::move(data), m_pCache);
+}
+
+/******************************************************************************************
+                                        Mapped file
+******************************************************************************************/
+MappedFile::MappedFile()
+    : m_pData(nullptr)
+    , m_size(0)
+#if defined(_WIN32)
+    , m_file(INVALID_HANDLE_VALUE)
+    , m_mapping(nullptr)
+#else
+    , m_file(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#if defined(_WIN32)
+bool MappedFile::Open(const std::string& path)
+{
+    Close();
+
+    m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+    {
+        Close();
+        return false;
+    }
+
+    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping == nullptr)
+    {
+        Close();
+        return false;
+    }
+
+    m_pData = reinterpret_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (m_pData == nullptr)
+    {
+        Close();
+        return false;
+    }
+
+    m_size = static_cast<size_t>(size.QuadPart);
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (m_pData != nullptr)
+        UnmapViewOfFile(m_pData);
+    if (m_mapping != nullptr)
+        CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE)
+        CloseHandle(m_file);
+
+    m_pData = nullptr;
+    m_size = 0;
+    m_mapping = nullptr;
+    m_file = INVALID_HANDLE_VALUE;
+}
+#else
+bool MappedFile::Open(const std::string& path)
+{
+    Close();
+
+    m_file = open(path.c_str(), O_RDONLY);
+    if (m_file < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(m_file, &info) != 0 || info.st_size == 0)
+    {
+        Close();
+        return false;
+    }
+
+    void* pData = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, m_file, 0);
+    if (pData == MAP_FAILED)
+    {
+        Close();
+        return false;
+    }
+
+    m_pData = reinterpret_cast<const char*>(pData);
+    m_size = static_cast<size_t>(info.st_size);
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (m_pData != nullptr)
+        munmap(const_cast<char*>(m_pData), m_size);
+    if (m_file >= 0)
+        close(m_file);
+
+    m_pData = nullptr;
+    m_size = 0;
+    m_file = -1;
+}
+#endif
+
+/******************************************************************************************
+                                        Zip files
+******************************************************************************************/
+// Largest read ReadLargeFile() does at a time.
+static constexpr size_t kZipChunkSize = 128 * 1024;
+
+// Beyond this many idle buffers the rest are freed, a burst of loads shouldn't pin its peak memory.
+static constexpr size_t kMaxPooledZipBuffers = 8;
+
+ZipFile::ZipFile()
+    : m_numEntries(0)
+{
+}
+
+ZipFile::~ZipFile()
+{
+    End();
+}
+
+bool ZipFile::Initialize(const std::string& fileName)
+{
+    End();
+    m_fileName = fileName;
+
+    FILE* pFile = AcquireFile();
+    if (pFile == nullptr)
+        return false;
+
+    const bool kResult = ReadDirectory(pFile);
+    ReleaseFile(pFile);
+
+    if (!kResult)
+        End();
+    return kResult;
+}
+
+bool ZipFile::ReadDirectory(FILE* pFile)
+{
+    // The end record sits in front of an archive comment of up to 64 KB, search the tail for it.
+    fseek(pFile, 0, SEEK_END);
+    const long kFileSize = ftell(pFile);
+    const long kTailSize = std::min<long>(kFileSize, sizeof(ZipDirHeader) + 0xFFFF);
+    if (kTailSize < static_cast<long>(sizeof(ZipDirHeader)))
+        return false;
+
+    std::vector<char> tail(kTailSize);
+    fseek(pFile, kFileSize - kTailSize, SEEK_SET);
+    if (fread(tail.data(), tail.size(), 1, pFile) != 1)
+        return false;
+
+    ZipDirHeader dirHeader;
+    memset(&dirHeader, 0, sizeof(dirHeader));
+    for (long offset = kTailSize - static_cast<long>(sizeof(ZipDirHeader)); offset >= 0; --offset)
+    {
+        memcpy(&dirHeader, tail.data() + offset, sizeof(dirHeader));
+        if (dirHeader.m_signature == ZipDirHeader::SIGNATURE && offset + sizeof(ZipDirHeader) + dirHeader.m_cmntLen <= static_cast<size_t>(kTailSize))
+            break;
+        dirHeader.m_signature = 0;
+    }
+
+    if (dirHeader.m_signature != ZipDirHeader::SIGNATURE || static_cast<long>(dirHeader.m_dirOffset) + static_cast<long>(dirHeader.m_dirSize) > kFileSize)
+        return false;
+
+    m_dirData.resize(dirHeader.m_dirSize);
+    fseek(pFile, dirHeader.m_dirOffset, SEEK_SET);
+    if (!m_dirData.empty() && fread(m_dirData.data(), m_dirData.size(), 1, pFile) != 1)
+        return false;
+
+    size_t capacity = 2;
+    while (capacity < static_cast<size_t>(dirHeader.m_dirEntries) * 2)
+    {
+        capacity <<= 1;
+    }
+    m_index.assign(capacity, { 0, -1 });
+    m_dirs.reserve(dirHeader.m_dirEntries);
+
+    size_t position = 0;
+    for (int i = 0; i < dirHeader.m_dirEntries; ++i)
+    {
+        if (position + sizeof(ZipDirFileHeader) > m_dirData.size())
+            return false;
+
+        // Check the directory entry integrity.
+        ZipDirFileHeader* pFileHeader = reinterpret_cast<ZipDirFileHeader*>(m_dirData.data() + position);
+        position += sizeof(ZipDirFileHeader) + pFileHeader->m_fNameLen + pFileHeader->m_extraLen + pFileHeader->m_cmntLen;
+        if (pFileHeader->m_signature != ZipDirFileHeader::SIGNATURE || position > m_dirData.size())
+            return false;
+
+        m_dirs.push_back(pFileHeader);
+
+        // A name that shows up twice resolves to the later entry, like unzip does.
+        const uint64_t kHash = HashResourcePath(pFileHeader->GetName(), pFileHeader->m_fNameLen);
+        size_t slot = kHash & (capacity - 1);
+        while (m_index[slot].m_entry >= 0 && m_index[slot].m_hash != kHash)
+        {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        m_index[slot] = { kHash, i };
+    }
+
+    m_numEntries = dirHeader.m_dirEntries;
+    return true;
+}
+
+int ZipFile::Find(ResourceId id) const
+{
+    if (m_index.empty())
+        return -1;
+
+    const uint64_t kHash = id.GetHash();
+    const size_t kMask = m_index.size() - 1;
+    for (size_t slot = kHash & kMask; m_index[slot].m_entry >= 0; slot = (slot + 1) & kMask)
+    {
+        if (m_index[slot].m_hash == kHash)
+            return m_index[slot].m_entry;
+    }
+    return -1;
+}
+
+int ZipFile::GetFileLength(int i) const
+{
+    if (i < 0 || i >= m_numEntries)
+        return -1;
+    else
+        return m_dirs[i]->m_uncompSize;
+}
+
+void ZipFile::End()
+{
+    std::lock_guard<std::mutex> lock(m_poolMutex);
+    for (FILE* pFile : m_freeFiles)
+    {
+        fclose(pFile);
+    }
+    m_freeFiles.clear();
+    m_freeBuffers.clear();
+
+    m_index.clear();
+    m_dirs.clear();
+    m_dirData.clear();
+    m_numEntries = 0;
+}
+
+std::string ZipFile::GetFileName(int i) const
+{
+    std::string fileName = "";
+    if (i >= 0 && i < m_numEntries)
+    {
+        fileName.assign(m_dirs[i]->GetName(), m_dirs[i]->m_fNameLen);
+    }
+
+    return fileName;
+}
+
+FILE* ZipFile::AcquireFile()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_poolMutex);
+        if (!m_freeFiles.empty())
+        {
+            FILE* pFile = m_freeFiles.back();
+            m_freeFiles.pop_back();
+            return pFile;
+        }
+    }
+
+    // A handle per concurrent reader, seeks on one never disturb another.
+    FILE* pFile = nullptr;
+    fopen_s(&pFile, m_fileName.c_str(), "rb");
+    return pFile;
+}
+
+void ZipFile::ReleaseFile(FILE* pFile)
+{
+    std::lock_guard<std::mutex> lock(m_poolMutex);
+    m_freeFiles.push_back(pFile);
+}
+
+std::vector<char> ZipFile::AcquireBuffer(size_t size)
+{
+    std::vector<char> buffer;
+    {
+        std::lock_guard<std::mutex> lock(m_poolMutex);
+        if (!m_freeBuffers.empty())
+        {
+            buffer = std::move(m_freeBuffers.back());
+            m_freeBuffers.pop_back();
+        }
+    }
+
+    // Keeps its capacity, so after warming up this rarely allocates.
+    buffer.resize(size);
+    return buffer;
+}
+
+void ZipFile::ReleaseBuffer(std::vector<char> buffer)
+{
+    std::lock_guard<std::mutex> lock(m_poolMutex);
+    if (m_freeBuffers.size() < kMaxPooledZipBuffers)
+        m_freeBuffers.push_back(std::move(buffer));
+}
+
+bool ZipFile::SeekToData(FILE* pFile, int i) const
+{
+    fseek(pFile, m_dirs[i]->m_hdrOffset, SEEK_SET);
+
+    ZipLocalHeader header;
+    memset(&header, 0, sizeof(header));
+    if (fread(&header, sizeof(header), 1, pFile) != 1 || header.m_signature != ZipLocalHeader::SIGNATURE)
+        return false;
+
+    // Skip the name and extra fields. Sizes come from the directory, the local ones may be left 0
+    // when the archive was written as a stream.
+    return fseek(pFile, header.m_fNameLen + header.m_extraLen, SEEK_CUR) == 0;
+}
+
+bool ZipFile::ReadFile(int i, void* pBuffer)
+{
+    /**************************************
+         Uncompress a file
+    ***************************************/
+
+    if (pBuffer == nullptr || i < 0 || i >= m_numEntries)
+    {
+        return false;
+    }
+
+    const ZipDirFileHeader& entry = *m_dirs[i];
+    FILE* pFile = AcquireFile();
+    if (pFile == nullptr)
+        return false;
+
+    bool toReturn = false;
+    if (!SeekToData(pFile, i))
+    {
+        toReturn = false;
+    }
+    else if (entry.m_compression == Z_NO_COMPRESSION)
+    {
+        toReturn = (entry.m_uncompSize == 0 || fread(pBuffer, entry.m_uncompSize, 1, pFile) == 1);
+    }
+    else if (entry.m_compression == Z_DEFLATED)
+    {
+        std::vector<char> compressed = AcquireBuffer(entry.m_compSize);
+        if (compressed.empty() || fread(compressed.data(), compressed.size(), 1, pFile) == 1)
+        {
+            z_stream stream;
+            memset(&stream, 0, sizeof(stream));
+            stream.avail_in = static_cast<uint32_t>(compressed.size());
+            stream.next_in = reinterpret_cast<uint8_t*>(compressed.data());
+            stream.avail_out = static_cast<uint32_t>(entry.m_uncompSize);
+            stream.next_out = reinterpret_cast<uint8_t*>(pBuffer);
+
+            // wbits < 0 => no zlib header inside the data.
+            if (inflateInit2(&stream, -MAX_WBITS) == Z_OK)
+            {
+                toReturn = (inflate(&stream, Z_FINISH) == Z_STREAM_END);
+                inflateEnd(&stream);
+            }
+        }
+        ReleaseBuffer(std::move(compressed));
+    }
+
+    ReleaseFile(pFile);
+    return toReturn;
+}
+
+bool ZipFile::ReadLargeFile(int i, void* pBuffer, void(*ProgressCallback)(int, bool&))
+{
+    if (pBuffer == nullptr || i < 0 || i >= m_numEntries)
+    {
+        return false;
+    }
+
+    const ZipDirFileHeader& entry = *m_dirs[i];
+    if (entry.m_compression != Z_DEFLATED)
+    {
+        // Nothing to inflate, there is no point in reading it in steps.
+        return ReadFile(i, pBuffer);
+    }
+
+    FILE* pFile = AcquireFile();
+    if (pFile == nullptr)
+        return false;
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.next_out = reinterpret_cast<uint8_t*>(pBuffer);
+    stream.avail_out = static_cast<uint32_t>(entry.m_uncompSize);
+
+    bool toReturn = false;
+    if (SeekToData(pFile, i) && inflateInit2(&stream, -MAX_WBITS) == Z_OK)
+    {
+        // Only one chunk of the compressed data is ever in memory.
+        std::vector<char> chunk = AcquireBuffer(std::min<size_t>(entry.m_compSize, kZipChunkSize));
+        size_t read = 0;
+        bool cancel = false;
+        int err = Z_OK;
+
+        while (err == Z_OK && read < entry.m_compSize && !cancel)
+        {
+            const size_t kCount = std::min<size_t>(entry.m_compSize - read, chunk.size());
+            if (fread(chunk.data(), kCount, 1, pFile) != 1)
+                break;
+            read += kCount;
+
+            stream.next_in = reinterpret_cast<uint8_t*>(chunk.data());
+            stream.avail_in = static_cast<uint32_t>(kCount);
+            err = inflate(&stream, Z_SYNC_FLUSH);
+
+            if (ProgressCallback != nullptr)
+                ProgressCallback(static_cast<int>(read * 100 / entry.m_compSize), cancel);
+        }
+
+        toReturn = (err == Z_STREAM_END && !cancel);
+        inflateEnd(&stream);
+        ReleaseBuffer(std::move(chunk));
+    }
+
+    ReleaseFile(pFile);
+    return toReturn;
+}
+
+/******************************************************************************************
+                                      Resource Handle
+******************************************************************************************/
+ResourceHandle::ResourceHandle(const Resource& resource, std::vector<char> data)
+    : m_resource(resource)
+    , m_data(std::move(data))
+    , m_view(m_data.data(), m_data.size())
+    , m_pViewOwner(nullptr)
+    , m_extra(nullptr)
+    , m_pResCache(nullptr)
+    , m_pLruPrev(nullptr)
+    , m_pLruNext(nullptr)
+    , m_chargedSize(0)
+    , m_pinCount(0)
+    , m_isCached(false)
+{
+}
+
+ResourceHandle::ResourceHandle(const Resource& resource, std::vector<char> data, ResourceCache* pResourceCache)
+    : m_resource(resource)
+    , m_data(std::move(data))
+    , m_view(m_data.data(), m_data.size())
+    , m_pViewOwner(nullptr)
+    , m_extra(nullptr)
+    , m_pResCache(pResourceCache)
+    , m_pLruPrev(nullptr)
+    , m_pLruNext(nullptr)
+    , m_chargedSize(0)
+    , m_pinCount(0)
+    , m_isCached(false)
+{
+}
+
+ResourceHandle::ResourceHandle(const Resource& resource, std::string_view view, std::shared_ptr<const void> pOwner, ResourceCache* pResourceCache)
+    : m_resource(resource)
+    , m_view(view)
+    , m_pViewOwner(std::move(pOwner))
+    , m_extra(nullptr)
+    , m_pResCache(pResourceCache)
+    , m_pLruPrev(nullptr)
+    , m_pLruNext(nullptr)
+    , m_chargedSize(0)
+    , m_pinCount(0)
+    , m_isCached(false)
+{
+}
+
+ResourceHandle::~ResourceHandle()
+{
+    // The cache credits m_chargedSize back when it lets go of the handle,
+    // so a handle outliving its cache never touches it.
+}
+
+/******************************************************************************************
+                                      Resource Cache
+******************************************************************************************/
+ResourceCache::ResourceCache(const unsigned int sizeInMb, IResourceFile* pResFile)
+    : m_pLruHead(nullptr)
+    , m_pLruTail(nullptr)
+    , m_pFile(pResFile)
+    , m_cacheSize(static_cast<size_t>(sizeInMb) * kCacheSize * kCacheSize)
+    , m_allocated(0)
+    , m_mainThread(std::this_thread::get_id())
+    , m_recording(false)
+    , m_numPrefetching(0)
+    , m_numHits(0)
+    , m_numMisses(0)
+    , m_numEvictions(0)
+    , m_peakAllocated(0)
+{
+}
+
+ResourceCache::~ResourceCache()
+{
+    // Workers still reference m_pFile, so stop them before anything is released.
+    m_loaderThreads.Shutdown();
+    m_pFile->SetWorkerThreads(nullptr);
+
+    if (!m_statsDumpPath.empty())
+        DumpStats(m_statsDumpPath);
+
+    Flush();
+}
+
+bool ResourceCache::Initialize(size_t numLoaderThreads)
+{
+    bool ret = false;
+    m_pFile->SetResourceCache(this);
+    if (m_pFile->Open())
+    {
+        // Packs built by ResourcePacker carry their dependency graph.
+        std::shared_ptr<ResourceHandle> pDependencies = m_pFile->LoadResource(kDependencyTablePath);
+        if (pDependencies != nullptr)
+        {
+            m_dependencyGraph.Deserialize(pDependencies->GetData());
+        }
+
+        RegisterLoader(std::make_shared<DefaultResourceLoader>());
+        ret = m_loaderThreads.Initialize(numLoaderThreads);
+
+        // Blocked entries split their decode over the loaders rather than starting threads per file.
+        m_pFile->SetWorkerThreads(&m_loaderThreads);
+    }
+
+    return ret;
+}
+
+void ResourceCache::RegisterLoader(std::shared_ptr<IResourceLoader> pLoader)
+{
+    m_resourceLoaders.Register(std::move(pLoader));
+}
+
+std::shared_ptr<ResourceHandle> ResourceCache::GetHandle(Resource* pResource)
+{
+    if (m_recording)
+        RecordAccess(pResource->GetName());
+
+    std::shared_ptr<ResourceHandle> pHandle(Find(pResource));
+    RecordRequest(*pResource, pHandle != nullptr);
+    if (pHandle == nullptr)
+        return Load(pResource);
+
+    return HandOut(pHandle);
+}
+
+std::shared_ptr<IResourceLoader> ResourceCache::FindLoader(const std::string& name)
+{
+    return m_resourceLoaders.Find(name);
+}
+
+std::unique_ptr<IResourceStream> ResourceCache::OpenStream(Resource* pResource)
+{
+    if (m_recording)
+        RecordAccess(pResource->GetName());
+
+    std::shared_ptr<ResourceHandle> pHandle(Find(pResource));
+    RecordRequest(*pResource, pHandle != nullptr);
+    if (pHandle != nullptr)
+    {
+        pHandle = HandOut(pHandle);
+        return std::make_unique<MemoryResourceStream>(pHandle->GetData().data(), pHandle->GetData().size(), pHandle);
+    }
+
+    std::unique_ptr<IResourceStream> pStream = m_pFile->OpenStream(pResource->GetName());
+    if (pStream == nullptr)
+    {
+        LOG_ERROR("Unable to open resource stream: ", false);
+        LOG_ERROR(pResource->GetName());
+    }
+    return pStream;
+}
+
+std::shared_ptr<ResourceHandle> ResourceCache::Load(Resource* pResource)
+{
+    //unsigned int rawSize = m_pFile->(*pResource);
+    std::shared_ptr<ResourceHandle> pHandle = FindAlias(*pResource);
+    if (pHandle == nullptr)
+    {
+        const auto kStart = std::chrono::steady_clock::now();
+        pHandle = m_pFile->LoadResource(*pResource);
+        RecordLoad(*pResource, pHandle.get(), 
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - kStart).count());
+    }
+
+    if (pHandle == nullptr)
+    {
+        LOG_ERROR("Unable to load resource: ", false);
+        LOG_ERROR(pResource->GetName());
+        return nullptr;
+    }
+
+    return Insert(pHandle, pResource->GetId());
+}
+
+std::shared_ptr<ResourceHandle> ResourceCache::FindAlias(const Resource& resource)
+{
+    const uint64_t kContentId = m_pFile->GetContentId(resource.GetId());
+    if (kContentId == 0)
+        return nullptr;
+
+    auto iter = m_contentHandles.find(kContentId);
+    std::shared_ptr<ResourceHandle> pShared = (iter != m_contentHandles.end()) ? iter->second.lock() : nullptr;
+    if (pShared == nullptr)
+        return nullptr;
+
+    // A view of the decoded data, so it is neither decoded nor charged twice. The lease keeps
+    // the shared handle from being evicted while the alias lives.
+    std::shared_ptr<ResourceHandle> pAlias = std::make_shared<ResourceHandle>(resource, pShared->GetData(), HandOut(pShared), this);
+    pAlias->SetExtra(pShared->GetExtra());
+    return pAlias;
+}
+
+std::shared_ptr<ResourceHandle> ResourceCache::Insert(std::shared_ptr<ResourceHandle> pHandle, ResourceId id)
+{
+    // A synchronous GetHandle() may have beaten an async load of the same path.
+    ResourceHandleMap::iterator iter = m_resources.find(id);
+    if (iter != m_resources.end())
+        return HandOut(iter->second);
+
+    std::shared_ptr<IResourceLoader> pLoader = FindLoader(pHandle->GetName());
+    if (!pLoader)
+    {
+        LOG_ERROR("Default resource loader not found!");
+        return nullptr;
+    }
+
+    // Aliases of this path find the handle here, even if it ends up not cached.
+    const uint64_t kContentId = m_pFile->GetContentId(id);
+    if (kContentId != 0)
+    {
+        std::weak_ptr<ResourceHandle>& pShared = m_contentHandles[kContentId];
+        if (pShared.expired())
+            pShared = pHandle;
+    }
+
+    // Views into a mapped pack cost no heap, only what the handle owns is charged.
+    const size_t kSize = pHandle->GetMemorySize();
+    if (!MakeRoom(kSize))
+    {
+        // Everything left is in use. Hand the data out anyway, but keep the budget.
+        LOG_WARNING("Resource cache out of memory, not caching: ", false);
+        LOG_WARNING(pHandle->GetName());
+        return pHandle;
     }
 
-    return std::make_shared<ResourceHandle>(Resource(path), std::move(data), m_pCache);
-}
-
-/******************************************************************************************
-                                        Zip files
-******************************************************************************************/
-ZipFile::ZipFile()
-    : m_numEntries(0)
-    , m_pFile(nullptr)
-    , m_dirData(nullptr)
-{
+    pHandle->m_chargedSize = kSize;
+    pHandle->m_isCached = true;
+    m_allocated += kSize;
+    m_peakAllocated = std::max(m_peakAllocated, m_allocated);
 
+    // Joins the LRU list once the caller lets go of it.
+    m_resources.emplace(id, pHandle);
+    return HandOut(pHandle);
 }
 
-ZipFile::~ZipFile()
+void ResourceCache::GetHandleAsync(Resource* pResource, AsyncLoadCallback callback)
 {
-    End();
-    fclose(m_pFile);
+    if (m_recording)
+        RecordAccess(pResource->GetName());
+
+    RecordRequest(*pResource, m_resources.find(pResource->GetId()) != m_resources.end());
+    RequestLoad(*pResource, std::move(callback));
 }
 
-bool ZipFile::Initialize(const std::string& fileName)
+void ResourceCache::RequestLoad(const Resource& resource, AsyncLoadCallback callback)
 {
-    End();
-    fopen_s(&m_pFile, fileName.c_str(), "rb");
-    if (!m_pFile)
-        return false;
-
-    ZipDirHeader dirHeader;
-
-    fseek(m_pFile, -static_cast<int>(sizeof(dirHeader)), SEEK_END);
-    long headerOffset = ftell(m_pFile);
-    memset(&dirHeader, 0, sizeof(dirHeader));
-
-    if (dirHeader.m_signature != ZipDirHeader::SIGNATURE)
-        return false;
+    // Already in flight, just wait for the same load.
+    PendingLoadMap::iterator pendingIter = m_pendingLoads.find(resource.GetId());
+    if (pendingIter != m_pendingLoads.end())
+    {
+        pendingIter->second.emplace_back(std::move(callback));
+        return;
+    }
 
-    // Go to the beginning of the directory.
-    fseek(m_pFile, headerOffset - dirHeader.m_dirSize, SEEK_SET);
+    m_pendingLoads[resource.GetId()].emplace_back(std::move(callback));
 
-    // Allocate the data buffer, and read the whole thing.
-    m_dirData.resize(dirHeader.m_dirSize + dirHeader.m_dirEntries * sizeof(m_dirs), '\0');
+    ResourceHandleMap::iterator iter = m_resources.find(resource.GetId());
+    std::shared_ptr<ResourceHandle> pHandle = (iter != m_resources.end()) ? iter->second : nullptr;
+    if (pHandle == nullptr)
+    {
+        pHandle = FindAlias(resource);
+    }
 
-    if (m_dirData.size() == 0)
-        return false;
+    if (pHandle != nullptr)
+    {
+        std::lock_guard<std::mutex> lock(m_completedMutex);
+        m_completedLoads.push_back({ resource, pHandle, 0, false });
+        return;
+    }
 
-    fread(&m_dirData[0], dirHeader.m_dirSize, 1, m_pFile);
+    m_loaderThreads.AddJob([this, resource]()
+    {
+        const auto kStart = std::chrono::steady_clock::now();
+        std::shared_ptr<ResourceHandle> pLoaded = m_pFile->LoadResource(resource);
+        const uint64_t kMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - kStart).count();
 
-    char* pFileHeader = &m_dirData[0];
+        std::lock_guard<std::mutex> lock(m_completedMutex);
+        m_completedLoads.push_back({ resource, pLoaded, kMicroseconds, true });
+    });
+}
 
-    //m_dirs = reinter
+void ResourceCache::ProcessAsyncLoads()
+{
+    IssuePrefetches();
 
-    bool success = true;
+    if (m_pendingLoads.empty())
+        return;
 
-    for (int i = 0; i < dirHeader.m_dirEntries && success; ++i)
+    CompletedLoadList completed;
     {
-        ZipDirFileHeader& fileHeader = *reinterpret_cast<ZipDirFileHeader*>(pFileHeader);
+        std::lock_guard<std::mutex> lock(m_completedMutex);
+        completed.swap(m_completedLoads);
+    }
 
-        m_dirs[i] = &fileHeader;
+    for (auto& load : completed)
+    {
+        if (load.m_fromFile)
+            RecordLoad(load.m_resource, load.m_pHandle.get(), load.m_microseconds);
 
-        // Check the directory entry integrity.
-        if (fileHeader.m_signature != ZipDirFileHeader::SIGNATURE)
+        std::shared_ptr<ResourceHandle> pHandle = load.m_pHandle;
+        if (pHandle != nullptr)
         {
-            success = false;
+            pHandle = Insert(pHandle, load.m_resource.GetId());
         }
         else
         {
-            pFileHeader += sizeof(fileHeader);
+            LOG_ERROR("Unable to load resource: ", false);
+            LOG_ERROR(load.m_resource.GetName());
+        }
 
-            // Convert slashes to backlashes.
-            for (int j = 0; j < fileHeader.m_fNameLen; ++j)
-            {
-                if (pFileHeader[j] == '/')
-                    pFileHeader[j] = '\\';
-            }
+        PendingLoadMap::iterator pendingIter = m_pendingLoads.find(load.m_resource.GetId());
+        if (pendingIter == m_pendingLoads.end())
+            continue;
 
-            char fileName[_MAX_PATH]; // 260
-            memcpy(fileName, pFileHeader, fileHeader.m_fNameLen);
-            fileName[fileHeader.m_fNameLen] = 0;
-            _strlwr_s(fileName, _MAX_PATH);
-            std::string path = fileName;
-            m_contentsMap[path] = i;
+        // Callbacks may request more resources, so take them out of the map first.
+        std::vector<AsyncLoadCallback> callbacks = std::move(pendingIter->second);
+        m_pendingLoads.erase(pendingIter);
 
-            // Skip etc.
-            pFileHeader += fileHeader.m_fNameLen + fileHeader.m_extraLen + fileHeader.m_cmntLen;
+        for (auto& callback : callbacks)
+        {
+            if (callback)
+                callback(pHandle);
         }
     }
-    if (!success)
-    {
-        m_dirData.clear();
-    }
-    else
-    {
-        m_numEntries = dirHeader.m_totalDirEntries;
-    }
-
-    return success;
-}
-
-int ZipFile::Find(const std::string& path) const
-{
-    std::string lowerCase = path;
-    std::transform(lowerCase.begin(), lowerCase.end(), lowerCase.begin(), std::tolower);
-    auto it = m_contentsMap.find(lowerCase);
-    if (it == m_contentsMap.end())
-        return -1;
-
-    return it->second;
-}
-
-int ZipFile::GetFileLength(int i) const
-{
-    if (i < 0 || i >= m_numEntries)
-        return -1;
-    else
-        return m_dirs[i]->m_uncompSize;
 }
 
-void ZipFile::End()
+void ResourceCache::StartRecording()
 {
-    m_contentsMap.clear();
-    m_dirs.clear();
-    m_numEntries = 0;
+    m_accessTrace.clear();
+    m_tracedNames.clear();
+    m_recording = true;
 }
 
-std::string ZipFile::GetFileName(int i) const
+void ResourceCache::RecordAccess(const std::string& name)
 {
-    std::string fileName = "";
-    if (i > 0 && i < m_numEntries)
+    if (m_tracedNames.insert(name).second)
     {
-        char dest[_MAX_PATH];
-        memcpy(dest, m_dirs[i]->GetName(), m_dirs[i]->m_fNameLen);
-        dest[m_dirs[i]->m_fNameLen] = '\0';
-        fileName = dest;
+        m_accessTrace.push_back(name);
     }
-
-    return fileName;
 }
 
-bool ZipFile::ReadFile(int i, void* pBuffer)
+bool ResourceCache::SaveAccessTrace(const std::string& path) const
 {
-    /**************************************
-         Uncompress a file
-    ***************************************/
-
-    if (pBuffer == nullptr || i < 0 || i >= m_numEntries)
-    {
-        return false;
-    }
-
-    fseek(m_pFile, m_dirs[i]->m_hdrOffset, SEEK_SET);
-    ZipLocalHeader header;
-
-    memset(&header, 0, sizeof(header));
-    fread(&header, sizeof(header), 1, m_pFile);
-    if (header.m_signature != ZipLocalHeader::SIGNATURE)
+    std::ofstream file(path, std::ios_base::out | std::ios_base::trunc);
+    if (!file.is_open())
         return false;
 
-    // Skip extra fields
-    fseek(m_pFile, header.m_fNameLen + header.m_extraLen, SEEK_CUR);
-
-    if (header.m_compression == Z_NO_COMPRESSION)
+    for (auto& name : m_accessTrace)
     {
-        fread(pBuffer, header.m_cSize, 1, m_pFile);
-        return true;
+        file << name << '\n';
     }
-    else if (header.m_compression != Z_DEFLATED)
+    return file.good();
+}
+
+std::vector<std::string> ResourceCache::LoadAccessTrace(const std::string& path)
+{
+    std::vector<std::string> trace;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line))
     {
-        return false;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!line.empty())
+            trace.push_back(line);
     }
+    return trace;
+}
 
-    // Alloc compressed data buffer and read the whole stream
-    char* pCompData = new char[header.m_cSize];
-    if (!pCompData)
+bool ResourceCache::Prefetch(const std::string& tracePath)
+{
+    std::vector<std::string> trace = LoadAccessTrace(tracePath);
+    if (trace.empty())
         return false;
 
-    memset(pCompData, 0, header.m_cSize);
-    fread(pCompData, header.m_cSize, 1, m_pFile);
-
-    bool toReturn = true;
-
-    z_stream stream;
-    int err;
+    m_prefetchQueue.insert(m_prefetchQueue.end(), trace.begin(), trace.end());
+    IssuePrefetches();
+    return true;
+}
 
-    stream.avail_in = static_cast<uint32_t>(header.m_cSize);               // How much data are we gonna depress
-    stream.next_in = reinterpret_cast<uint8_t*>(pCompData);
-    stream.next_out = reinterpret_cast<uint8_t*>(pBuffer);
-    stream.avail_out = static_cast<uint32_t>(header.m_ucSize);
-    stream.zalloc = (alloc_func)0;
-    stream.zfree = (free_func)0;
+void ResourceCache::IssuePrefetches()
+{
+    // Enough to keep every loader thread busy without flooding the completed list.
+    const size_t kMaxInFlight = std::max<size_t>(m_loaderThreads.GetNumThreads(), 1) * 2;
 
-    // Inflation.
-    err = inflateInit2(&stream, -MAX_WBITS);
-    if (err == Z_OK)
+    while (!m_prefetchQueue.empty() && m_numPrefetching < kMaxInFlight)
     {
-        err = inflate(&stream, Z_FINISH);
-        inflateEnd(&stream);
-        if (err == Z_STREAM_END)
-            err = Z_OK;
-        inflateEnd(&stream);
-    }
+        // Anything more would only evict what was prefetched before it.
+        if (m_allocated >= m_cacheSize)
+        {
+            m_prefetchQueue.clear();
+            return;
+        }
 
-    if (err != Z_OK)
-        toReturn = false;
+        const Resource kResource(m_prefetchQueue.front());
+        m_prefetchQueue.pop_front();
+        if (m_resources.find(kResource.GetId()) != m_resources.end() || m_pendingLoads.find(kResource.GetId()) != m_pendingLoads.end())
+            continue;
 
-    delete[] pCompData;
-    return toReturn;
+        ++m_numPrefetching;
+        RequestLoad(kResource, [this](std::shared_ptr<ResourceHandle>) { --m_numPrefetching; });
+    }
 }
 
-bool ZipFile::ReadLargeFile(int i, void* pBuffer, void(*ProgressCallback)(int, bool&))
+void ResourceCache::LoadGroup(const std::string& root, GroupLoadCallback callback)
 {
-    if (pBuffer == nullptr || i < 0 || i >= m_numEntries)
+    const std::string kRoot = ZlibFile::NormalizePath(root);
+
+    ResourceGroupMap::iterator iter = m_groups.find(kRoot);
+    if (iter != m_groups.end())
     {
-        return false;
+        if (iter->second.m_numPending == 0)
+        {
+            if (callback)
+                callback(!iter->second.m_failed);
+        }
+        else if (callback)
+        {
+            iter->second.m_callbacks.emplace_back(std::move(callback));
+        }
+        return;
     }
 
-    fseek(m_pFile, m_dirs[i]->m_hdrOffset, SEEK_SET);
-    ZipLocalHeader header;
-
-    memset(&header, 0, sizeof(header));
-    fread(&header, sizeof(header), 1, m_pFile);
-    if (header.m_signature != ZipLocalHeader::SIGNATURE)
-        return false;
+    std::vector<std::string> members = m_dependencyGraph.GetGroup(kRoot);
 
-    fseek(m_pFile, header.m_fNameLen + header.m_extraLen, SEEK_CUR);
+    ResourceGroup& group = m_groups[kRoot];
+    group.m_numPending = members.size();
+    group.m_failed = false;
+    group.m_handles.reserve(members.size());
+    if (callback)
+        group.m_callbacks.emplace_back(std::move(callback));
 
-    if (header.m_compression == Z_NO_COMPRESSION)
+    for (auto& member : members)
     {
-        fread(pBuffer, header.m_cSize, 1, m_pFile);
-        return true;
+        RequestLoad(Resource(member), [this, kRoot](std::shared_ptr<ResourceHandle> pHandle) { OnGroupMemberLoaded(kRoot, std::move(pHandle)); });
     }
-    else if (header.m_compression != Z_DEFLATED)
-        return false;
+}
 
-    char* pCompData = new char[header.m_compression];
-    if (!pCompData)
-        return false;
+void ResourceCache::OnGroupMemberLoaded(const std::string& root, std::shared_ptr<ResourceHandle> pHandle)
+{
+    // Released before it finished, the member just stays in the cache like any other load.
+    ResourceGroupMap::iterator iter = m_groups.find(root);
+    if (iter == m_groups.end())
+        return;
 
-    memset(pCompData, 0, header.m_cSize);
-    fread(pCompData, header.m_cSize, 1, m_pFile);
+    ResourceGroup& group = iter->second;
+    if (pHandle != nullptr)
+        group.m_handles.emplace_back(std::move(pHandle));
+    else
+        group.m_failed = true;
 
-    bool toReturn = true;
+    if (--group.m_numPending > 0)
+        return;
 
-    z_stream stream;
-    int err;
+    std::vector<GroupLoadCallback> callbacks = std::move(group.m_callbacks);
+    const bool kSuccess = !group.m_failed;
+    for (auto& callback : callbacks)
+    {
+        callback(kSuccess);
+    }
+}
 
-    stream.next_in = reinterpret_cast<uint8_t*>(pCompData);
-    stream.avail_in = static_cast<uint32_t>(header.m_cSize);
-    stream.next_out = reinterpret_cast<uint8_t*>(pBuffer);
-    stream.avail_out = (128 * 1024); //  read 128k at a time h.ucSize;
-    stream.zalloc = (alloc_func)0;
-    stream.zfree = (free_func)0;
+void ResourceCache::ReleaseGroup(const std::string& root)
+{
+    ResourceGroupMap::iterator iter = m_groups.find(ZlibFile::NormalizePath(root));
+    if (iter == m_groups.end())
+        return;
 
-    // Perform inflation
-    // wbits < 0 => no zlib header inside the data.
-    err = inflateInit2(&stream, -MAX_WBITS);
-    if (err == Z_OK)
+    std::vector<ResourceId> ids;
+    ids.reserve(iter->second.m_handles.size());
+    for (auto& pHandle : iter->second.m_handles)
     {
-        uInt count = 0;
-        bool cancel = false;
+        ids.push_back(pHandle->GetId());
+    }
+    m_groups.erase(iter);
 
-        while (stream.total_in < static_cast<uInt>(header.m_cSize) && !cancel)
+    // Whatever another group, a pin or a live user still holds stays.
+    for (ResourceId id : ids)
+    {
+        ResourceHandleMap::iterator resourceIter = m_resources.find(id);
+        if (resourceIter != m_resources.end() && IsEvictable(resourceIter->second.get()))
         {
-            err = inflate(&stream, Z_SYNC_FLUSH);
-            if (err == Z_STREAM_END)
-            {
-                err = Z_OK;
-                break;
-            }
-            else if (err != Z_OK)
-            {
-                break;
-            }
-
-            stream.avail_out = (128 * 1024);
-            stream.next_out += stream.total_out;
-
-            ProgressCallback(count * 1000 / header.m_cSize, cancel);
+            Free(resourceIter->second);
         }
-        inflateEnd(&stream);
     }
-
-    if (err != Z_OK)
-        toReturn = false;
-
-    delete[] pCompData;
-    return toReturn;
 }
 
-/******************************************************************************************
-                                      Resource Handle
-******************************************************************************************/
-ResourceHandle::ResourceHandle(const Resource& resource, std::vector<char> data)
-    : m_resource(resource)
-    , m_data(data)
-    , m_extra(nullptr)
-    , m_pResCache(nullptr)
+bool ResourceCache::IsGroupLoaded(const std::string& root) const
 {
+    ResourceGroupMap::const_iterator iter = m_groups.find(ZlibFile::NormalizePath(root));
+    return iter != m_groups.end() && iter->second.m_numPending == 0;
 }
 
-ResourceHandle::ResourceHandle(const Resource& resource, std::vector<char> data, ResourceCache* pResourceCache)
-    : m_resource(resource)
-    , m_data(data)
-    , m_extra(nullptr)
-    , m_pResCache(pResourceCache)
+void LoadLatencyHistogram::Add(uint64_t microseconds)
 {
-}
+    size_t bucket = 0;
+    while (bucket + 1 < kNumBuckets && (microseconds >> (bucket + 1)) != 0)
+    {
+        ++bucket;
+    }
 
-ResourceHandle::~ResourceHandle()
-{
-//    m_pResCache->MemoryHasBeenFreed(m_data.size());
-//    m_data.clear();
+    ++m_counts[bucket];
+    ++m_numLoads;
+    m_totalMicroseconds += microseconds;
+    m_maxMicroseconds = std::max(m_maxMicroseconds, microseconds);
 }
 
-/******************************************************************************************
-                                      Resource Cache
-******************************************************************************************/
-ResourceCache::ResourceCache(const unsigned int sizeInMb, IResourceFile* pResFile)
-    : m_cacheSize(sizeInMb * kCacheSize * kCacheSize)
-    , m_pFile(pResFile)
-    , m_allocated(0)
+void ResourceCache::RecordRequest(const Resource& resource, bool hit)
 {
-}
+    ResourceUsage& usage = m_usage[resource.GetId()];
+    if (usage.m_numRequests++ == 0)
+        usage.m_name = resource.GetName();
 
-ResourceCache::~ResourceCache()
-{
-    while (!m_lru.empty())
-    {
-        FreeOneResource();
-    }
+    if (hit)
+        ++m_numHits;
+    else
+        ++m_numMisses;
 }
 
-bool ResourceCache::Initialize()
+void ResourceCache::RecordLoad(const Resource& resource, const ResourceHandle* pHandle, uint64_t microseconds)
 {
-    bool ret = false;
-    m_pFile->SetResourceCache(this);
-    if (m_pFile->Open())
-    {
-        RegisterLoader(std::make_shared<DefaultResourceLoader>());
-        ret = true;
-    }
+    std::shared_ptr<IResourceLoader> pLoader = FindLoader(resource.GetName());
+    m_loadLatencies[pLoader != nullptr ? pLoader->GetPattern() : std::string()].Add(microseconds);
 
-    return ret;
+    if (pHandle == nullptr)
+        return;
+
+    // Prefetches and groups load without a request.
+    ResourceUsage& usage = m_usage[resource.GetId()];
+    if (usage.m_name.empty())
+        usage.m_name = resource.GetName();
+    usage.m_size = pHandle->GetSize();
 }
 
-void ResourceCache::RegisterLoader(std::shared_ptr<IResourceLoader> pLoader)
+ResourceCacheStats ResourceCache::GetStats() const
 {
-    m_resourceLoaders.push_front(pLoader);
+    ResourceCacheStats stats;
+    stats.m_hits                = m_numHits;
+    stats.m_misses              = m_numMisses;
+    stats.m_evictions           = m_numEvictions;
+    stats.m_bytesResident       = m_allocated;
+    stats.m_peakBytesResident   = m_peakAllocated;
+    stats.m_file                = m_pFile->GetStats();
+    return stats;
 }
 
-std::shared_ptr<ResourceHandle> ResourceCache::GetHandle(Resource* pResource)
+// Ties are broken by name, so that reports compare across runs.
+static ResourceCache::ResourceRanking KeepHighest(ResourceCache::ResourceRanking ranking, size_t count)
 {
-    std::shared_ptr<ResourceHandle> pHandle(Find(pResource));
-    if (pHandle == nullptr)
+    count = std::min(count, ranking.size());
+    std::partial_sort(ranking.begin(), ranking.begin() + count, ranking.end(), [](const auto& lhs, const auto& rhs)
     {
-        pHandle = Load(pResource);
-    }
-    else
-    {
-        Update(pHandle);
-    }
-    return pHandle;
+        return (lhs.second != rhs.second) ? lhs.second > rhs.second : lhs.first < rhs.first;
+    });
+    ranking.resize(count);
+    return ranking;
 }
 
-bool WildcardMatch(const char* pStr, const char* pPattern)
+ResourceCache::ResourceRanking ResourceCache::GetHottest(size_t count) const
 {
-    const size_t kLhsSize = strlen(pStr);
-    const size_t kRhsSize = strlen(pPattern);
-
-    if (kLhsSize == 0)
-        return (kRhsSize == 0);
-
-    std::vector<std::vector<bool>> lookUp;
-    lookUp.resize(kLhsSize + 1);
-    for (auto& temp : lookUp)
-    {
-        temp.resize(kRhsSize + 1);
-    }
-
-    lookUp[0][0] = true;
-
-    for (size_t i = 1; i <= kRhsSize; ++i)
+    ResourceRanking ranking;
+    ranking.reserve(m_usage.size());
+    for (auto& usage : m_usage)
     {
-        if (pPattern[i - 1] == '*')
-        {
-            lookUp[0][i] = lookUp[0][i - 1];
-        }
+        ranking.emplace_back(usage.second.m_name, usage.second.m_numRequests);
     }
+    return KeepHighest(std::move(ranking), count);
+}
 
-    for (size_t i = 1; i <= kLhsSize; ++i)
+ResourceCache::ResourceRanking ResourceCache::GetLargest(size_t count) const
+{
+    ResourceRanking ranking;
+    ranking.reserve(m_usage.size());
+    for (auto& usage : m_usage)
     {
-        for (size_t j = 1; j <= kRhsSize; ++j)
-        {
-            if (pPattern[j - 1] == '*')
-            {
-                lookUp[i][j] = lookUp[i][j - 1] || lookUp[i - 1][j];
-            }
-            else if (pPattern[j - 1] == '?' || pStr[i - 1] == pPattern[j - 1])
-            {
-                lookUp[i][j] = lookUp[i - 1][j - 1];
-            }
-            else
-            {
-                lookUp[i][j] = false;
-            }
-        }
+        if (usage.second.m_size > 0)
+            ranking.emplace_back(usage.second.m_name, usage.second.m_size);
     }
+    return KeepHighest(std::move(ranking), count);
+}
 
-    return lookUp[kLhsSize][kRhsSize];
+void ResourceCache::ResetStats()
+{
+    m_numHits = 0;
+    m_numMisses = 0;
+    m_numEvictions = 0;
+    m_peakAllocated = m_allocated;
+    m_usage.clear();
+    m_loadLatencies.clear();
 }
 
-std::shared_ptr<ResourceHandle> ResourceCache::Load(Resource* pResource)
+bool ResourceCache::DumpStats(const std::string& path, size_t topCount) const
 {
-    std::shared_ptr<IResourceLoader> pLoader;
-    std::shared_ptr<ResourceHandle> pHandle;
+    std::ofstream file(path, std::ios_base::out | std::ios_base::trunc);
+    if (!file.is_open())
+        return false;
 
-    for (ResourceLoaders::iterator it = m_resourceLoaders.begin(); it != m_resourceLoaders.end(); ++it)
+    const ResourceCacheStats kStats = GetStats();
+    const uint64_t kRequests = kStats.m_hits + kStats.m_misses;
+    file << "Requests:        " << kRequests << " (" << kStats.m_hits << " hits, " << kStats.m_misses << " misses";
+    if (kRequests > 0)
+        file << ", " << (100 * kStats.m_hits / kRequests) << "% hit rate";
+    file << ")\n";
+    file << "Evictions:       " << kStats.m_evictions << '\n';
+    file << "Resident:        " << kStats.m_bytesResident << " bytes (peak " << kStats.m_peakBytesResident << " of " << m_cacheSize << ")\n";
+    file << "Read:            " << kStats.m_file.m_bytesRead << " bytes\n";
+    file << "Inflated:        " << kStats.m_file.m_bytesInflated << " bytes in " << kStats.m_file.m_decodeMicroseconds / 1000.0 << " ms\n";
+
+    // Sorted, the map order changes from run to run.
+    std::map<std::string, const LoadLatencyHistogram*> latencies;
+    for (auto& latency : m_loadLatencies)
     {
-        std::shared_ptr<IResourceLoader> pTemp = *it;
-
-        if (WildcardMatch(pResource->GetName().c_str(), pTemp->GetPattern().c_str()))
-        {
-            pLoader = pTemp;
-            break;
-        }
+        latencies.emplace(latency.first, &latency.second);
     }
 
-    if (!pLoader)
+    file << "\nLoad latency by loader (microseconds):\n";
+    for (auto& latency : latencies)
     {
-        LOG_ERROR("Default resource loader not found!");
-        return pHandle;
-    }
+        const LoadLatencyHistogram& histogram = *latency.second;
+        file << "  " << (latency.first.empty() ? "<none>" : latency.first) << ": " << histogram.m_numLoads << " loads, mean " 
+             << (histogram.m_numLoads > 0 ? histogram.m_totalMicroseconds / histogram.m_numLoads : 0) << ", max " << histogram.m_maxMicroseconds << '\n';
 
-    //unsigned int rawSize = m_pFile->(*pResource);
-    pHandle = m_pFile->LoadResource(pResource->GetName());
-    size_t rawSize = pHandle->GetSize();
-    if (rawSize < 0)
-    {
-        LOG_ERROR("Resource size returned -1");
-        return nullptr;
+        for (size_t i = 0; i < LoadLatencyHistogram::kNumBuckets; ++i)
+        {
+            if (histogram.m_counts[i] > 0)
+                file << "    >= " << (i == 0 ? 0 : 1ull << i) << ": " << histogram.m_counts[i] << '\n';
+        }
     }
 
-    size_t allocSize = rawSize + ((pLoader->AddNullZero()) ? (1) : (0));
-    char* pMem = Allocate(static_cast<unsigned int>(allocSize));
-    
-    if (!pMem)
+    file << "\nHottest:\n";
+    for (auto& resource : GetHottest(topCount))
     {
-        LOG_ERROR("Resource cache out of memeory");
-        return nullptr;
+        file << "  " << resource.second << '\t' << resource.first << '\n';
     }
 
-    if (pHandle)
+    file << "\nLargest (bytes):\n";
+    for (auto& resource : GetLargest(topCount))
     {
-        m_lru.push_front(pHandle);
-        m_resources[pResource->GetName()] = pHandle;
+        file << "  " << resource.second << '\t' << resource.first << '\n';
     }
 
-    return pHandle;
+    return file.good();
+}
+
+void ResourceCache::RegisterWithScript()
+{
+    auto& scripting = ApplicationLayer::GetInstance()->GetGameLayer()->GetScriptingManager();
+    scripting.GetGlobal("g_logic");
+
+    scripting.CreateTable();
+    scripting.AddToTable("this", this);
+    scripting.AddToTable("GetStats", Lua::ResourceCacheGetStats);
+    scripting.AddToTable("GetHottest", Lua::ResourceCacheGetHottest);
+    scripting.AddToTable("GetLargest", Lua::ResourceCacheGetLargest);
+    scripting.AddToTable("DumpStats", Lua::ResourceCacheDumpStats);
+    scripting.AddToTable("ResourceCache");
+
+    scripting.PopAll();
 }
 
 void ResourceCache::Flush(void)
 {
-    while (!m_lru.empty())
+    for (auto& resource : m_resources)
     {
-        std::shared_ptr<ResourceHandle> pHandle = *(m_lru.begin());
-        Free(pHandle);
-        m_lru.pop_front();
+        resource.second->m_pLruPrev = nullptr;
+        resource.second->m_pLruNext = nullptr;
+        resource.second->m_chargedSize = 0;
+        resource.second->m_isCached = false;
     }
+
+    m_resources.clear();
+    m_contentHandles.clear();
+    m_pLruHead = nullptr;
+    m_pLruTail = nullptr;
+    m_allocated = 0;
 }
 
-bool ResourceCache::MakeRoom(unsigned int size)
+bool ResourceCache::MakeRoom(size_t size)
 {
     if (size > m_cacheSize)
     {
@@ -668,67 +2059,123 @@ bool ResourceCache::MakeRoom(unsigned int size)
 
     while (size > (m_cacheSize - m_allocated))
     {
-        if (m_lru.empty())
+        if (!FreeOneResource())
             return false;
-
-        FreeOneResource();
     }
 
     return true;
 }
 
-char* ResourceCache::Allocate(unsigned int size)
+void ResourceCache::Free(std::shared_ptr<ResourceHandle> pGonner)
+{
+    ResourceHandleMap::iterator iter = m_resources.find(pGonner->m_resource.GetId());
+    if (iter == m_resources.end() || iter->second != pGonner)
+        return;
+
+    Unlink(pGonner.get());
+    m_allocated -= pGonner->m_chargedSize;
+    pGonner->m_chargedSize = 0;
+    pGonner->m_isCached = false;
+
+    m_resources.erase(iter);
+}
+
+std::shared_ptr<ResourceHandle> ResourceCache::Find(Resource* pResource)
 {
-    if (!MakeRoom(size))
+    ResourceHandleMap::iterator iter = m_resources.find(pResource->GetId());
+    if (iter == m_resources.end())
         return nullptr;
 
-    char* pMem = new char[size];
-    
-    if (pMem)
-    {
-        m_allocated += size;
-    }
+    return iter->second;
+}
+
+std::shared_ptr<ResourceHandle> ResourceCache::HandOut(const std::shared_ptr<ResourceHandle>& pHandle)
+{
+    // Not cached, the users own it alone.
+    if (!pHandle->m_isCached)
+        return pHandle;
+
+    std::shared_ptr<ResourceHandle> pLease = pHandle->m_pLease.lock();
+    if (pLease != nullptr)
+        return pLease;
+
+    Unlink(pHandle.get());
+    pLease = std::shared_ptr<ResourceHandle>(pHandle.get(), [this, pOwner = pHandle, mainThread = m_mainThread](ResourceHandle*) mutable
+    {
+        // The LRU list has no lock, e.g. parallel component updates have to defer the release.
+        assert(std::this_thread::get_id() == mainThread && "Handed out resource handles have to be released on the main thread");
+
+        // A flushed or destroyed cache let go of it already, this is only used while it is cached.
+        if (IsEvictable(pOwner.get()))
+            LinkFront(pOwner.get());
+
+        // The deleter lives as long as m_pLease does, holding on would keep the handle forever.
+        pOwner.reset();
+    });
+    pHandle->m_pLease = pLease;
+    return pLease;
+}
+
+bool ResourceCache::FreeOneResource()
+{
+    // Pinned and handed out handles are off the list, so the cold end can always go.
+    if (m_pLruTail == nullptr)
+        return false;
 
-    return pMem;
+    ResourceHandleMap::iterator iter = m_resources.find(m_pLruTail->GetId());
+    Free(iter->second);
+    ++m_numEvictions;
+    return true;
 }
 
-void ResourceCache::Free(std::shared_ptr<ResourceHandle> pGonner)
+void ResourceCache::Pin(std::shared_ptr<ResourceHandle> pHandle)
 {
-    m_lru.remove(pGonner);
-    m_resources.erase(pGonner->m_resource.GetName());
+    if (pHandle != nullptr && pHandle->m_pinCount++ == 0)
+        Unlink(pHandle.get());
 }
 
-std::shared_ptr<ResourceHandle> ResourceCache::Find(Resource* pResource)
+void ResourceCache::Unpin(std::shared_ptr<ResourceHandle> pHandle)
 {
-    ResourceHandleMap::iterator iter = m_resources.find(pResource->GetName());
-    if (iter == m_resources.end())
-        return nullptr;
+    if (pHandle == nullptr || pHandle->m_pinCount == 0)
+        return;
 
-    return iter->second;
+    --pHandle->m_pinCount;
+    if (IsEvictable(pHandle.get()))
+        LinkFront(pHandle.get());
 }
 
-void ResourceCache::Update(std::shared_ptr<ResourceHandle> pHandle)
-{ 
-    m_lru.remove(pHandle);
-    m_lru.push_front(pHandle);
+bool ResourceCache::IsEvictable(const ResourceHandle* pHandle)
+{
+    return pHandle->m_isCached && !pHandle->IsPinned() && pHandle->m_pLease.expired();
 }
 
-void ResourceCache::FreeOneResource()
+void ResourceCache::LinkFront(ResourceHandle* pHandle)
 {
-    ResourceHandleList::iterator gonner = m_lru.end();
-    --gonner;
+    pHandle->m_pLruPrev = nullptr;
+    pHandle->m_pLruNext = m_pLruHead;
 
-    std::shared_ptr<ResourceHandle> pHandle = *gonner;
+    if (m_pLruHead != nullptr)
+        m_pLruHead->m_pLruPrev = pHandle;
+    else
+        m_pLruTail = pHandle;
 
-    m_lru.pop_back();
-    m_resources.erase(pHandle->m_resource.GetName());
-    MemoryHasBeenFreed(static_cast<unsigned int>(pHandle->GetSize())); // Warning because of coversion from 'size_t' to 'unsigned int'???? What the hell???
-    pHandle.reset();
+    m_pLruHead = pHandle;
 }
 
-void ResourceCache::MemoryHasBeenFreed(unsigned int size)
+void ResourceCache::Unlink(ResourceHandle* pHandle)
 {
-    m_allocated -= size;
+    if (pHandle->m_pLruPrev != nullptr)
+        pHandle->m_pLruPrev->m_pLruNext = pHandle->m_pLruNext;
+    else if (m_pLruHead == pHandle)
+        m_pLruHead = pHandle->m_pLruNext;
+
+    if (pHandle->m_pLruNext != nullptr)
+        pHandle->m_pLruNext->m_pLruPrev = pHandle->m_pLruPrev;
+    else if (m_pLruTail == pHandle)
+        m_pLruTail = pHandle->m_pLruPrev;
+
+    pHandle->m_pLruPrev = nullptr;
+    pHandle->m_pLruNext = nullptr;
 }
 
 //std::vector<std::string> ResourceCache::Match(const std::string pattern)
@@ -743,7 +2190,7 @@ void ResourceCache::MemoryHasBeenFreed(unsigned int size)
 //        std::string name = m_pFile->GetResourceName(i);
 //        std::transform(name.begin(), name.end(), name.begin(), (int(*)(int)) std::tolower);
 //        
-//        if (WildcardMatch(pattern.c_str(), name.c_str()))
+//        if (ResourceLoaderTable::MatchWildcard(name, pattern))
 //        {
 //            matchingNames.push_back(name);
 //        }
@@ -751,6 +2198,19 @@ void ResourceCache::MemoryHasBeenFreed(unsigned int size)
 //    return matchingNames;
 //}
 
+/******************************************************************************************
+                                      Resource File
+******************************************************************************************/
+std::unique_ptr<IResourceStream> IResourceFile::OpenStream(const std::string& path)
+{
+    std::shared_ptr<ResourceHandle> pHandle = LoadResource(path);
+    if (pHandle == nullptr)
+    {
+        return nullptr;
+    }
+    return std::make_unique<MemoryResourceStream>(pHandle->GetData().data(), pHandle->GetData().size(), pHandle);
+}
+
 /******************************************************************************************
                                       Resource Zip File
 ******************************************************************************************/
@@ -788,6 +2248,35 @@ int ResourceZipFile::GetNumResources() const
     return (m_pZipFile==nullptr) ? 0 : m_pZipFile->GetNumFiles();
 }
 
+std::vector<std::string> ResourceZipFile::GetResourceNames() const
+{
+    std::vector<std::string> names;
+    for (int i = 0; i < GetNumResources(); ++i)
+    {
+        names.push_back(m_pZipFile->GetFileName(i));
+    }
+    return names;
+}
+
+std::shared_ptr<ResourceHandle> ResourceZipFile::LoadResource(const std::string& path)
+{
+    return LoadResource(Resource(path));
+}
+
+std::shared_ptr<ResourceHandle> ResourceZipFile::LoadResource(const Resource& resource)
+{
+    // Safe from the loader threads, ZipFile hands each of them its own file handle.
+    const int kIndex = (m_pZipFile == nullptr) ? -1 : m_pZipFile->Find(resource.GetId());
+    if (kIndex < 0)
+        return nullptr;
+
+    std::vector<char> data(m_pZipFile->GetFileLength(kIndex));
+    if (!data.empty() && !m_pZipFile->ReadFile(kIndex, data.data()))
+        return nullptr;
+
+    return std::make_shared<ResourceHandle>(resource, std::move(data), m_pCache);
+}
+
 //int ResourceZipFile::GetRawResource(const Resource& resource, char* pBuffer)
 //{
 //    int size = 0;
@@ -845,7 +2334,7 @@ size_t ResourceZlibFile::GetRawResourceSize(const Resource& resource)
 
 int ResourceZlibFile::GetNumResources() const
 {
-    return m_pXmlFile.use_count();
+    return (m_pXmlFile == nullptr) ? 0 : static_cast<int>(m_pXmlFile->GetNumResources());
 }
 
 std::shared_ptr<ResourceHandle> Bel::ResourceZlibFile::LoadResource(const std::string& path)
@@ -853,6 +2342,36 @@ std::shared_ptr<ResourceHandle> Bel::ResourceZlibFile::LoadResource(const std::s
     return m_pXmlFile->LoadResource(path);
 }
 
+std::shared_ptr<ResourceHandle> ResourceZlibFile::LoadResource(const Resource& resource)
+{
+    return m_pXmlFile->LoadResource(resource);
+}
+
+std::unique_ptr<IResourceStream> ResourceZlibFile::OpenStream(const std::string& path)
+{
+    return m_pXmlFile->OpenStream(path);
+}
+
+uint64_t ResourceZlibFile::GetContentId(ResourceId id) const
+{
+    return m_pXmlFile->GetContentId(id);
+}
+
+ResourceFileStats ResourceZlibFile::GetStats() const
+{
+    return m_pXmlFile->GetStats();
+}
+
+void ResourceZlibFile::SetWorkerThreads(ThreadPool* pThreads)
+{
+    m_pXmlFile->SetBlockThreads(pThreads);
+}
+
+std::vector<std::string> ResourceZlibFile::GetResourceNames() const
+{
+    return m_pXmlFile->GetResourceNames();
+}
+
 //std::string ResourceXmlFile::GetResourceName(int num) const
 //{
 //    std::string resName = "";
@@ -864,6 +2383,432 @@ std::shared_ptr<ResourceHandle> Bel::ResourceZlibFile::LoadResource(const std::s
 //    return resName;
 //}
 
+/******************************************************************************************
+                                      Directory File
+******************************************************************************************/
+ResourceDirectoryFile::ResourceDirectoryFile(const std::string& rootPath)
+    : m_rootPath(rootPath)
+{
+}
+
+bool ResourceDirectoryFile::Open()
+{
+    m_files.clear();
+    m_names.clear();
+
+    std::error_code error;
+    std::filesystem::recursive_directory_iterator iter(m_rootPath, error);
+    if (error)
+        return false;
+
+    for (; iter != std::filesystem::recursive_directory_iterator(); iter.increment(error))
+    {
+        if (error)
+            return false;
+        if (!iter->is_regular_file(error))
+            continue;
+
+        const std::string kRelative = ZlibFile::NormalizePath(iter->path().lexically_relative(m_rootPath).generic_string());
+        m_files[ResourceId(kRelative)] = iter->path().string();
+        m_names.push_back(kRelative);
+    }
+    return true;
+}
+
+std::shared_ptr<ResourceHandle> ResourceDirectoryFile::LoadResource(const Resource& resource)
+{
+    auto iter = m_files.find(resource.GetId());
+    if (iter == m_files.end())
+        return nullptr;
+
+    std::ifstream file(iter->second, std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
+    if (!file.is_open())
+        return nullptr;
+
+    std::vector<char> data(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    if (!file.read(data.data(), data.size()))
+        return nullptr;
+
+    return std::make_shared<ResourceHandle>(resource, std::move(data), m_pCache);
+}
+
+size_t ResourceDirectoryFile::GetRawResourceSize(const Resource& resource)
+{
+    auto iter = m_files.find(resource.GetId());
+    if (iter == m_files.end())
+        return 0;
+
+    std::error_code error;
+    const uintmax_t kSize = std::filesystem::file_size(iter->second, error);
+    return error ? 0 : static_cast<size_t>(kSize);
+}
+
+/******************************************************************************************
+                                      Layered File
+******************************************************************************************/
+bool LayeredResourceFile::Mount(std::unique_ptr<IResourceFile> pLayer)
+{
+    if (pLayer == nullptr)
+        return false;
+
+    m_layers.push_back(std::move(pLayer));
+    if (!m_isOpen)
+        return true;
+
+    IResourceFile* pMounted = m_layers.back().get();
+    pMounted->SetResourceCache(m_pCache);
+    pMounted->SetWorkerThreads(m_pWorkerThreads);
+    if (!pMounted->Open())
+    {
+        m_layers.pop_back();
+        return false;
+    }
+    IndexLayer(static_cast<uint32_t>(m_layers.size() - 1));
+    return true;
+}
+
+int LayeredResourceFile::FindLayer(ResourceId id) const
+{
+    auto iter = m_index.find(id);
+    return (iter != m_index.end()) ? static_cast<int>(iter->second) : -1;
+}
+
+bool LayeredResourceFile::Open()
+{
+    m_index.clear();
+    for (uint32_t i = 0; i < m_layers.size(); ++i)
+    {
+        m_layers[i]->SetResourceCache(m_pCache);
+        if (!m_layers[i]->Open())
+            return false;
+
+        // Bottom up, so a higher layer overwrites what it shadows.
+        IndexLayer(i);
+    }
+
+    m_isOpen = true;
+    return true;
+}
+
+void LayeredResourceFile::IndexLayer(uint32_t layer)
+{
+    for (const std::string& name : m_layers[layer]->GetResourceNames())
+    {
+        m_index[ResourceId(name)] = layer;
+    }
+}
+
+std::shared_ptr<ResourceHandle> LayeredResourceFile::LoadResource(const Resource& resource)
+{
+    static constexpr ResourceId kDependencyTableId(kDependencyTablePath);
+    if (resource.GetId() == kDependencyTableId)
+        return LoadDependencyTable();
+
+    const int kLayer = FindLayer(resource.GetId());
+    return (kLayer >= 0) ? m_layers[kLayer]->LoadResource(resource) : nullptr;
+}
+
+std::shared_ptr<ResourceHandle> LayeredResourceFile::LoadDependencyTable()
+{
+    // A patched file brings its own dependencies, the ones the base pack recorded for it no longer apply.
+    ResourceDependencyGraph merged;
+    for (uint32_t i = 0; i < m_layers.size(); ++i)
+    {
+        std::shared_ptr<ResourceHandle> pTable = m_layers[i]->LoadResource(kDependencyTablePath);
+        if (pTable == nullptr)
+            continue;
+
+        ResourceDependencyGraph graph;
+        graph.Deserialize(pTable->GetData());
+        for (auto& dependencies : graph.GetDependencies())
+        {
+            if (FindLayer(dependencies.first) != static_cast<int>(i))
+                continue;
+
+            for (const std::string& child : dependencies.second)
+            {
+                merged.AddDependency(dependencies.first, child);
+            }
+        }
+    }
+
+    if (merged.IsEmpty())
+        return nullptr;
+
+    const std::string kText = merged.Serialize();
+    return std::make_shared<ResourceHandle>(Resource(kDependencyTablePath), std::vector<char>(kText.begin(), kText.end()), m_pCache);
+}
+
+size_t LayeredResourceFile::GetRawResourceSize(const Resource& resource)
+{
+    const int kLayer = FindLayer(resource.GetId());
+    return (kLayer >= 0) ? m_layers[kLayer]->GetRawResourceSize(resource) : 0;
+}
+
+std::unique_ptr<IResourceStream> LayeredResourceFile::OpenStream(const std::string& path)
+{
+    const int kLayer = FindLayer(path);
+    return (kLayer >= 0) ? m_layers[kLayer]->OpenStream(path) : nullptr;
+}
+
+uint64_t LayeredResourceFile::GetContentId(ResourceId id) const
+{
+    const int kLayer = FindLayer(id);
+    const uint64_t kId = (kLayer >= 0) ? m_layers[kLayer]->GetContentId(id) : 0;
+
+    // Ids are only unique within a layer, the low byte keeps two layers apart.
+    return (kId != 0) ? (kId << 8) | static_cast<uint8_t>(kLayer) : 0;
+}
+
+ResourceFileStats LayeredResourceFile::GetStats() const
+{
+    ResourceFileStats stats;
+    for (auto& pLayer : m_layers)
+    {
+        const ResourceFileStats kLayerStats = pLayer->GetStats();
+        stats.m_bytesRead           += kLayerStats.m_bytesRead;
+        stats.m_bytesInflated       += kLayerStats.m_bytesInflated;
+        stats.m_decodeMicroseconds  += kLayerStats.m_decodeMicroseconds;
+    }
+    return stats;
+}
+
+void LayeredResourceFile::SetWorkerThreads(ThreadPool* pThreads)
+{
+    m_pWorkerThreads = pThreads;
+    for (auto& pLayer : m_layers)
+    {
+        pLayer->SetWorkerThreads(pThreads);
+    }
+}
+
+std::vector<std::string> LayeredResourceFile::GetResourceNames() const
+{
+    // Asked from the layers, the index only keeps hashes.
+    std::vector<std::string> names;
+    for (uint32_t i = 0; i < m_layers.size(); ++i)
+    {
+        for (std::string& name : m_layers[i]->GetResourceNames())
+        {
+            if (FindLayer(name) == static_cast<int>(i))
+                names.push_back(std::move(name));
+        }
+    }
+    return names;
+}
+
+/******************************************************************************************
+                                      Loader Table
+******************************************************************************************/
+void ResourceLoaderTable::Register(std::shared_ptr<IResourceLoader> pLoader)
+{
+    CompiledLoader loader;
+    loader.m_pattern = pLoader->GetPattern();
+    loader.m_priority = m_nextPriority++;
+    loader.m_pLoader = std::move(pLoader);
+
+    const std::string& kPattern = loader.m_pattern;
+    const size_t kLastWildcard = kPattern.find_last_of("*?");
+
+    if (kLastWildcard == std::string::npos)
+    {
+        loader.m_kind = PatternKind::kExact;
+        loader.m_literal = kPattern;
+    }
+    else if (kLastWildcard == 0 && kPattern[0] == '*')
+    {
+        loader.m_kind = PatternKind::kSuffix;
+        loader.m_literal = kPattern.substr(1);
+
+        // "*.ext" goes to the extension table, unless the extension itself has a dot.
+        if (loader.m_literal.size() > 1 && loader.m_literal[0] == '.' && loader.m_literal.find('.', 1) == std::string::npos)
+        {
+            loader.m_literal.erase(0, 1);
+            const size_t kHash = std::hash<std::string_view>()(loader.m_literal);
+
+            auto iter = m_extensions.find(kHash);
+            if (iter == m_extensions.end())
+            {
+                m_extensions.emplace(kHash, m_byExtension.size());
+                m_byExtension.emplace_back(std::move(loader));
+                return;
+            }
+            if (m_byExtension[iter->second].m_literal == loader.m_literal)
+            {
+                // Same extension registered again, the newer loader shadows the old one.
+                m_byExtension[iter->second] = std::move(loader);
+                return;
+            }
+
+            // Hash collision with another extension, let it take the slow path.
+            loader.m_literal.insert(0, 1, '.');
+        }
+    }
+    else
+    {
+        loader.m_kind = PatternKind::kWildcard;
+    }
+
+    m_others.insert(m_others.begin(), std::move(loader));
+}
+
+std::shared_ptr<IResourceLoader> ResourceLoaderTable::Find(std::string_view name) const
+{
+    const CompiledLoader* pBest = nullptr;
+
+    const size_t kDot = name.rfind('.');
+    if (kDot != std::string_view::npos)
+    {
+        const std::string_view kExtension = name.substr(kDot + 1);
+        auto iter = m_extensions.find(std::hash<std::string_view>()(kExtension));
+        if (iter != m_extensions.end() && m_byExtension[iter->second].m_literal == kExtension)
+        {
+            pBest = &m_byExtension[iter->second];
+        }
+    }
+
+    // Only loaders registered after the extension match can still beat it.
+    for (const CompiledLoader& loader : m_others)
+    {
+        if (pBest != nullptr && loader.m_priority < pBest->m_priority)
+            break;
+
+        bool match = false;
+        switch (loader.m_kind)
+        {
+        case PatternKind::kExact:
+            match = (name == loader.m_literal);
+            break;
+        case PatternKind::kSuffix:
+            match = name.size() >= loader.m_literal.size() && name.compare(name.size() - loader.m_literal.size(), std::string_view::npos, loader.m_literal) == 0;
+            break;
+        case PatternKind::kWildcard:
+            match = MatchWildcard(name, loader.m_pattern);
+            break;
+        }
+
+        if (match)
+            return loader.m_pLoader;
+    }
+
+    return (pBest != nullptr) ? pBest->m_pLoader : nullptr;
+}
+
+bool ResourceLoaderTable::MatchWildcard(std::string_view name, std::string_view pattern)
+{
+    // Greedy with a single backtrack point: on a mismatch, let the last '*' swallow one more character.
+    size_t nameIndex = 0;
+    size_t patternIndex = 0;
+    size_t starPattern = std::string_view::npos;
+    size_t starName = 0;
+
+    while (nameIndex < name.size())
+    {
+        if (patternIndex < pattern.size() && (pattern[patternIndex] == '?' || pattern[patternIndex] == name[nameIndex]))
+        {
+            ++nameIndex;
+            ++patternIndex;
+        }
+        else if (patternIndex < pattern.size() && pattern[patternIndex] == '*')
+        {
+            starPattern = patternIndex++;
+            starName = nameIndex;
+        }
+        else if (starPattern != std::string_view::npos)
+        {
+            patternIndex = starPattern + 1;
+            nameIndex = ++starName;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while (patternIndex < pattern.size() && pattern[patternIndex] == '*')
+    {
+        ++patternIndex;
+    }
+    return patternIndex == pattern.size();
+}
+
+/******************************************************************************************
+                                    Dependency Graph
+******************************************************************************************/
+void ResourceDependencyGraph::AddDependency(const std::string& parent, const std::string& child)
+{
+    std::vector<std::string>& children = m_dependencies[ZlibFile::NormalizePath(parent)];
+    std::string normalized = ZlibFile::NormalizePath(child);
+    if (std::find(children.begin(), children.end(), normalized) == children.end())
+    {
+        children.emplace_back(std::move(normalized));
+    }
+}
+
+std::vector<std::string> ResourceDependencyGraph::GetGroup(const std::string& root) const
+{
+    std::vector<std::string> group;
+    std::unordered_set<std::string> visited;
+
+    group.push_back(ZlibFile::NormalizePath(root));
+    visited.insert(group.back());
+
+    // Breadth first, the group vector doubles as the queue. Cycles are fine.
+    for (size_t i = 0; i < group.size(); ++i)
+    {
+        auto iter = m_dependencies.find(group[i]);
+        if (iter == m_dependencies.end())
+            continue;
+
+        for (auto& child : iter->second)
+        {
+            if (visited.insert(child).second)
+                group.push_back(child);
+        }
+    }
+    return group;
+}
+
+std::string ResourceDependencyGraph::Serialize() const
+{
+    std::vector<std::pair<std::string, std::string>> edges;
+    for (auto& node : m_dependencies)
+    {
+        for (auto& child : node.second)
+        {
+            edges.emplace_back(node.first, child);
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+
+    std::string text;
+    for (auto& edge : edges)
+    {
+        text += edge.first;
+        text += '\t';
+        text += edge.second;
+        text += '\n';
+    }
+    return text;
+}
+
+void ResourceDependencyGraph::Deserialize(std::string_view text)
+{
+    while (!text.empty())
+    {
+        const size_t kEnd = std::min(text.find('\n'), text.size());
+        std::string_view line = text.substr(0, kEnd);
+        text.remove_prefix(std::min(kEnd + 1, text.size()));
+
+        const size_t kSeparator = line.find('\t');
+        if (kSeparator == std::string_view::npos || kSeparator == 0 || kSeparator + 1 >= line.size())
+            continue;
+
+        AddDependency(std::string(line.substr(0, kSeparator)), std::string(line.substr(kSeparator + 1)));
+    }
+}
+
 /******************************************************************************************
                                      Default ResourceLoader
 ******************************************************************************************/
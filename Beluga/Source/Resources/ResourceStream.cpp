@@ -0,0 +1,262 @@
+#include <string.h>
+#include <algorithm>
+#include <SDL.h>
+
+#include "Resources/ResourceStream.h"
+
+#define ZLIB_WINAPI
+#include "zlib.h"
+
+using namespace Bel;
+
+/******************************************************************************************
+                                        Memory
+******************************************************************************************/
+MemoryResourceStream::MemoryResourceStream(const char* pData, uint64_t size, std::shared_ptr<const void> pOwner)
+    : m_pData(pData)
+    , m_size(size)
+    , m_position(0)
+    , m_pOwner(std::move(pOwner))
+{
+}
+
+size_t MemoryResourceStream::Read(char* pDest, size_t size)
+{
+    const size_t kCount = static_cast<size_t>(std::min<uint64_t>(size, m_size - m_position));
+    memcpy(pDest, m_pData + m_position, kCount);
+    m_position += kCount;
+    return kCount;
+}
+
+bool MemoryResourceStream::Seek(uint64_t position)
+{
+    if (position > m_size)
+        return false;
+
+    m_position = position;
+    return true;
+}
+
+/******************************************************************************************
+                                        Inflate
+******************************************************************************************/
+InflateResourceStream::InflateResourceStream(const char* pSrc, size_t srcSize, uint64_t size, std::shared_ptr<const void> pOwner, size_t windowSize)
+    : m_pSrc(pSrc)
+    , m_srcSize(srcSize)
+    , m_size(size)
+    , m_pOwner(std::move(pOwner))
+    , m_pInflate(std::make_unique<z_stream_s>())
+    , m_failed(false)
+    , m_window(windowSize)
+    , m_windowStart(0)
+    , m_windowSize(0)
+    , m_position(0)
+{
+    memset(m_pInflate.get(), 0, sizeof(z_stream_s));
+    m_failed = (inflateInit(m_pInflate.get()) != Z_OK);
+    if (!m_failed)
+        Restart();
+}
+
+InflateResourceStream::~InflateResourceStream()
+{
+    // Safe even when inflateInit() failed, zlib checks the state first.
+    inflateEnd(m_pInflate.get());
+}
+
+size_t InflateResourceStream::Read(char* pDest, size_t size)
+{
+    size_t count = 0;
+    while (count < size && m_position < m_size && !m_failed)
+    {
+        if (m_position < m_windowStart && !Restart())
+            break;
+
+        if (m_position >= m_windowStart + m_windowSize)
+        {
+            // Forward seeks land here too, the skipped windows are decoded and dropped.
+            if (!DecodeNextWindow())
+                break;
+            continue;
+        }
+
+        const size_t kOffset = static_cast<size_t>(m_position - m_windowStart);
+        const size_t kCount = std::min(size - count, m_windowSize - kOffset);
+        memcpy(pDest + count, m_window.data() + kOffset, kCount);
+        count += kCount;
+        m_position += kCount;
+    }
+    return count;
+}
+
+bool InflateResourceStream::Seek(uint64_t position)
+{
+    if (position > m_size)
+        return false;
+
+    // Decoding is deferred to the next Read(), seeking around before reading costs nothing.
+    m_position = position;
+    return true;
+}
+
+bool InflateResourceStream::Restart()
+{
+    if (inflateReset(m_pInflate.get()) != Z_OK)
+    {
+        m_failed = true;
+        return false;
+    }
+
+    m_pInflate->avail_in    = static_cast<uInt>(m_srcSize);
+    m_pInflate->next_in     = reinterpret_cast<Bytef*>(const_cast<char*>(m_pSrc));   // zlib never writes to the input.
+    m_windowStart = 0;
+    m_windowSize = 0;
+    return true;
+}
+
+bool InflateResourceStream::DecodeNextWindow()
+{
+    m_windowStart += m_windowSize;
+    m_windowSize = 0;
+
+    m_pInflate->avail_out   = static_cast<uInt>(m_window.size());
+    m_pInflate->next_out    = reinterpret_cast<Bytef*>(m_window.data());
+
+    const int kResult = inflate(m_pInflate.get(), Z_SYNC_FLUSH);
+    m_windowSize = m_window.size() - m_pInflate->avail_out;
+
+    if ((kResult != Z_OK && kResult != Z_STREAM_END) || m_windowSize == 0)
+    {
+        m_failed = true;
+        return false;
+    }
+    return true;
+}
+
+/******************************************************************************************
+                                        Blocks
+******************************************************************************************/
+BlockResourceStream::BlockResourceStream(const char* pSrc, size_t srcSize, uint64_t size, const ICodec& innerCodec, std::shared_ptr<const void> pOwner)
+    : m_codec(innerCodec)
+    , m_valid(false)
+    , m_size(size)
+    , m_pOwner(std::move(pOwner))
+    , m_currentBlock(kNoBlock)
+    , m_position(0)
+{
+    m_valid = m_index.Read(pSrc, srcSize, size);
+    if (m_valid)
+        m_block.resize(static_cast<size_t>(std::min<uint64_t>(m_index.GetBlockSize(), size)));
+}
+
+size_t BlockResourceStream::Read(char* pDest, size_t size)
+{
+    size_t count = 0;
+    while (count < size && m_position < m_size && m_valid)
+    {
+        const uint32_t kBlock = static_cast<uint32_t>(m_position / m_index.GetBlockSize());
+        if (kBlock != m_currentBlock)
+        {
+            if (!m_codec.DecompressBlock(m_index, kBlock, m_block.data()))
+            {
+                m_valid = false;
+                break;
+            }
+            m_currentBlock = kBlock;
+        }
+
+        const size_t kOffset = static_cast<size_t>(m_position - m_index.GetBlockStart(kBlock));
+        const size_t kCount = std::min(size - count, m_index.GetDecodedSize(kBlock) - kOffset);
+        memcpy(pDest + count, m_block.data() + kOffset, kCount);
+        count += kCount;
+        m_position += kCount;
+    }
+    return count;
+}
+
+bool BlockResourceStream::Seek(uint64_t position)
+{
+    if (position > m_size)
+        return false;
+
+    m_position = position;
+    return true;
+}
+
+/******************************************************************************************
+                                        SDL_RWops
+******************************************************************************************/
+static IResourceStream* GetStream(SDL_RWops* pContext)
+{
+    return static_cast<IResourceStream*>(pContext->hidden.unknown.data1);
+}
+
+static Sint64 SDLCALL StreamSize(SDL_RWops* pContext)
+{
+    return static_cast<Sint64>(GetStream(pContext)->GetSize());
+}
+
+static Sint64 SDLCALL StreamSeek(SDL_RWops* pContext, Sint64 offset, int whence)
+{
+    IResourceStream* pStream = GetStream(pContext);
+
+    Sint64 position = offset;
+    if (whence == RW_SEEK_CUR)
+        position += static_cast<Sint64>(pStream->Tell());
+    else if (whence == RW_SEEK_END)
+        position += static_cast<Sint64>(pStream->GetSize());
+
+    if (position < 0 || !pStream->Seek(static_cast<uint64_t>(position)))
+    {
+        SDL_SetError("Seek out of range in resource stream");
+        return -1;
+    }
+    return position;
+}
+
+static size_t SDLCALL StreamRead(SDL_RWops* pContext, void* pDest, size_t size, size_t maxNum)
+{
+    if (size == 0)
+        return 0;
+
+    // Whole objects only, a partial one is rewound so the next read sees it again.
+    IResourceStream* pStream = GetStream(pContext);
+    const uint64_t kStart = pStream->Tell();
+    const size_t kRead = pStream->Read(static_cast<char*>(pDest), size * maxNum);
+    if (kRead % size != 0)
+        pStream->Seek(kStart + kRead - kRead % size);
+
+    return kRead / size;
+}
+
+static size_t SDLCALL StreamWrite(SDL_RWops*, const void*, size_t, size_t)
+{
+    SDL_SetError("Resource streams are read only");
+    return 0;
+}
+
+static int SDLCALL StreamClose(SDL_RWops* pContext)
+{
+    delete GetStream(pContext);
+    SDL_FreeRW(pContext);
+    return 0;
+}
+
+SDL_RWops* Bel::CreateResourceRWops(std::unique_ptr<IResourceStream> pStream)
+{
+    if (pStream == nullptr)
+        return nullptr;
+
+    SDL_RWops* pRwops = SDL_AllocRW();
+    if (pRwops == nullptr)
+        return nullptr;
+
+    pRwops->size    = &StreamSize;
+    pRwops->seek    = &StreamSeek;
+    pRwops->read    = &StreamRead;
+    pRwops->write   = &StreamWrite;
+    pRwops->close   = &StreamClose;
+    pRwops->type    = SDL_RWOPS_UNKNOWN;
+    pRwops->hidden.unknown.data1 = pStream.release();
+    return pRwops;
+}